@@ -0,0 +1,86 @@
+/*
+ * Implementation of helper functions shared by the benchmark programs.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include "bench_util.h"
+
+namespace {
+
+std::atomic<size_t> g_allocs(0);
+
+}
+
+// Replacement global allocation functions which count every allocation,
+// so benchmarks can report allocations per operation.
+
+void *operator new(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+/*
+ * Returns the number of allocations made so far by all threads.
+ */
+size_t bench_allocs() {
+  return g_allocs.load(std::memory_order_relaxed);
+}
+
+/*
+ * Returns the current time in nanoseconds from a monotonic clock.
+ */
+uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Appends one result to the file named by BENCH_JSON, if it is set.
+ *
+ * Parameters:
+ *   bench - name of the benchmark program
+ *   case_name - what was measured, e.g. "room_size=100"
+ *   ops - number of operations measured
+ *   ns - nanoseconds they took
+ *   allocs - allocations made while they ran
+ */
+void bench_report(const char *bench, const std::string &case_name,
+                  size_t ops, uint64_t ns, size_t allocs) {
+  const char *path = getenv("BENCH_JSON");
+  if (path == nullptr || ops == 0 || ns == 0) {
+    return;
+  }
+  FILE *f = fopen(path, "a");
+  if (f == nullptr) {
+    return;
+  }
+  const char *commit = getenv("BENCH_COMMIT");
+  fprintf(f, "{\"commit\": \"%s\", \"bench\": \"%s\", \"case\": \"%s\", "
+          "\"ops\": %zu, \"ops_per_sec\": %.0f, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f}\n",
+          commit != nullptr ? commit : "", bench, case_name.c_str(), ops,
+          ops / (ns / 1e9), static_cast<double>(ns) / ops,
+          static_cast<double>(allocs) / ops);
+  fclose(f);
+}
@@ -0,0 +1,32 @@
+/*
+ * Helper functions shared by the benchmark programs.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Number of calls to operator new made by every thread so far.
+// Counted by the replacement operator new in bench_util.cpp.
+size_t bench_allocs();
+
+// Current time in nanoseconds from a monotonic clock.
+uint64_t bench_now_ns();
+
+// Record one result: ops operations took ns nanoseconds and made
+// allocs allocations. If the environment variable BENCH_JSON names a
+// file, the result is appended to it as a one-line JSON object with
+// ops/sec, ns/op and allocs/op (and BENCH_COMMIT, if set), so runs on
+// different commits can be diffed. Otherwise it does nothing.
+void bench_report(const char *bench, const std::string &case_name,
+                  size_t ops, uint64_t ns, size_t allocs);
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,128 @@
+/*
+ * Benchmark for Room::broadcast_message at increasing room sizes, with
+ * and without a history kept for replay, and with the largest rooms
+ * fanned out by a FanoutPool.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../frame.h"
+#include "../user.h"
+#include "../room.h"
+#include "../fanout.h"
+#include "bench_util.h"
+
+namespace {
+
+// every room size is broadcast to until about this many deliveries were made
+const size_t TARGET_DELIVERIES = 2000000;
+
+/*
+ * Takes every frame off each member's queue, as receivers would.
+ *
+ * Parameters:
+ *   users - reference to the vector of room members
+ */
+void drain(std::vector<User *> &users) {
+  for (size_t i = 0; i < users.size(); i++) {
+    Frame *frame;
+    while ((frame = users[i]->mqueue.try_dequeue()) != nullptr) {
+      frame->unref();
+    }
+  }
+}
+
+/*
+ * Broadcasts to a room of the given size and prints allocations and
+ * time per broadcast: until every delivery is queued, and until
+ * broadcast_message returns to the sender (sooner only with a pool).
+ * Allocations are only counted inside broadcast_message, not while
+ * draining the queues.
+ *
+ * Parameters:
+ *   room_size - number of receivers in the room
+ *   history - number of deliveries the room keeps for replay
+ *   fanout_threads - threads fanning out the broadcasts, 0 for none
+ */
+void run(size_t room_size, size_t history, int fanout_threads) {
+  FanoutPool pool(fanout_threads);
+  pool.start();
+  Room room("bench", history);
+  if (fanout_threads > 0) {
+    room.set_fanout(&pool, 0);
+  }
+  std::vector<User *> users;
+  for (size_t i = 0; i < room_size; i++) {
+    users.push_back(new User("user" + std::to_string(i)));
+    room.add_member(users.back());
+  }
+  std::string sender = "sender";
+  std::string text = "the quick brown fox jumps over the lazy dog";
+
+  // warm up so queue storage (and the history) has reached its steady-state size
+  for (size_t i = 0; i < 4 + history; i++) {
+    room.broadcast_message(sender, text);
+    pool.drain();
+    drain(users);
+  }
+
+  size_t rounds = TARGET_DELIVERIES / room_size;
+  if (rounds < 20) {
+    rounds = 20;
+  }
+  size_t allocs = 0;
+  uint64_t ns = 0;
+  uint64_t sender_ns = 0;
+  for (size_t r = 0; r < rounds; r++) {
+    size_t a0 = bench_allocs();
+    uint64_t t0 = bench_now_ns();
+    room.broadcast_message(sender, text);
+    sender_ns += bench_now_ns() - t0;
+    allocs += bench_allocs() - a0;
+    pool.drain();
+    ns += bench_now_ns() - t0;
+    drain(users);
+  }
+
+  printf("%10zu %8zu %7d %14.0f %14.1f %14.1f %12.2f %14.2f\n", room_size, history,
+         fanout_threads, rounds / (ns / 1e9),
+         static_cast<double>(ns) / rounds,
+         static_cast<double>(sender_ns) / rounds,
+         static_cast<double>(allocs) / rounds,
+         static_cast<double>(ns) / (rounds * room_size));
+  std::string name = "room_size=" + std::to_string(room_size);
+  if (history > 0) {
+    name += ",history=" + std::to_string(history);
+  }
+  if (fanout_threads > 0) {
+    name += ",fanout=" + std::to_string(fanout_threads);
+  }
+  bench_report("broadcast_bench", name, rounds, ns, allocs);
+
+  for (size_t i = 0; i < users.size(); i++) {
+    room.remove_member(users[i]);
+    users[i]->unref();
+  }
+}
+
+}
+
+int main() {
+  printf("%10s %8s %7s %14s %14s %14s %12s %14s\n", "room_size", "history", "fanout",
+         "bcasts/sec", "ns/bcast", "ns/sender", "allocs/bcast", "ns/delivery");
+  size_t sizes[] = { 1, 10, 100, 1000, 10000, 100000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    run(sizes[i], 0, 0);
+  }
+  run(1, 1000, 0);
+  run(100, 1000, 0);
+  run(10000, 0, 4);
+  run(100000, 0, 4);
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Benchmark for connection storms: many clients connect, log in and
+ * quit as fast as they can against an in-process server, once per
+ * connection handling mode.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "../message.h"
+#include "../connection.h"
+#include "../server.h"
+#include "bench_util.h"
+
+namespace {
+
+// client threads connecting at once
+const int CLIENTS = 32;
+
+// connections each client thread makes, one after another
+const int PER_CLIENT = 500;
+
+// ports tried for the servers, one per mode
+const int BASE_PORT = 47311;
+
+std::atomic<bool> storm_done;
+std::atomic<int> peak_threads;
+
+/*
+ * Reads the number of threads in this process.
+ *
+ * Returns:
+ *   the thread count, or 0 if it could not be read
+ */
+int thread_count() {
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f == nullptr) {
+    return 0;
+  }
+  char line[256];
+  int threads = 0;
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    if (strncmp(line, "Threads:", 8) == 0) {
+      threads = atoi(line + 8);
+      break;
+    }
+  }
+  fclose(f);
+  return threads;
+}
+
+/*
+ * Sampler thread: records the most threads seen during the storm.
+ *
+ * Parameters:
+ *   arg - unused
+ */
+void *sampler(void *) {
+  while (!storm_done) {
+    int n = thread_count();
+    if (n > peak_threads) {
+      peak_threads = n;
+    }
+    usleep(1000);
+  }
+  return nullptr;
+}
+
+/*
+ * Server thread: accepts clients until the process exits.
+ *
+ * Parameters:
+ *   arg - pointer to the listening Server
+ */
+void *serve(void *arg) {
+  static_cast<Server *>(arg)->handle_client_requests();
+  return nullptr;
+}
+
+/*
+ * Client thread: connects, logs in as a sender and quits, PER_CLIENT times.
+ *
+ * Parameters:
+ *   arg - pointer to the port to connect to
+ */
+void *client(void *arg) {
+  int port = *static_cast<int *>(arg);
+  for (int i = 0; i < PER_CLIENT; i++) {
+    Connection conn;
+    if (!conn.connect("localhost", port)) {
+      continue;
+    }
+    Message login(TAG_SLOGIN, "storm"), quit(TAG_QUIT, "bye"), reply;
+    conn.send(login);
+    conn.receive(reply);
+    conn.send(quit);
+    conn.receive(reply);
+  }
+  return nullptr;
+}
+
+/*
+ * Starts a server in the given mode, storms it with connections and
+ * prints the connect rate and the most threads the process had.
+ *
+ * Parameters:
+ *   name - name of the mode, for the output
+ *   options - reference to the options selecting the mode
+ *   mode - index of the mode, used to pick a port
+ */
+void run(const char *name, const ServerOptions &options, int mode) {
+  int port = 0;
+  Server *server = nullptr;
+  for (int attempt = 0; attempt < 20 && server == nullptr; attempt++) {
+    port = BASE_PORT + mode * 20 + attempt;
+    server = new Server(port, options);
+    if (!server->listen()) {
+      delete server;
+      server = nullptr;
+    }
+  }
+  if (server == nullptr) {
+    printf("%12s could not listen\n", name);
+    return;
+  }
+  // the server thread runs until the process exits
+  pthread_t server_thr;
+  pthread_create(&server_thr, NULL, serve, server);
+
+  storm_done = false;
+  peak_threads = thread_count();
+  pthread_t sampler_thr;
+  pthread_create(&sampler_thr, NULL, sampler, nullptr);
+
+  std::vector<pthread_t> clients(CLIENTS);
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_create(&clients[i], NULL, client, &port);
+  }
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_join(clients[i], NULL);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  storm_done = true;
+  pthread_join(sampler_thr, NULL);
+
+  // the threads the bench itself runs are the same in every mode
+  printf("%12s %14.0f %14d\n", name, CLIENTS * PER_CLIENT / (ns / 1e9),
+         peak_threads.load());
+  bench_report("connect_bench", name, CLIENTS * PER_CLIENT, ns, allocs);
+}
+
+}
+
+int main() {
+  printf("%12s %14s %14s\n", "mode", "connects/sec", "peak_threads");
+
+  ServerOptions per_conn;
+  run("per-conn", per_conn, 0);
+
+  ServerOptions pool;
+  pool.worker_threads = 8;
+  run("threads=8", pool, 1);
+
+  ServerOptions epoll;
+  epoll.event_loops = 2;
+  run("epoll=2", epoll, 2);
+
+  ServerOptions uring;
+  uring.event_loops = 2;
+  uring.io_uring = true;
+  run("uring=2", uring, 3);
+
+  ServerOptions reuseport;
+  reuseport.event_loops = 2;
+  reuseport.reuse_port = true;
+  run("reuseport=2", reuseport, 4);
+  return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Benchmark for encoding outgoing messages: building Frames, and
+ * Connection::send writing a Message in text and binary framing.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <string>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../message.h"
+#include "../frame.h"
+#include "../connection.h"
+#include "bench_util.h"
+
+namespace {
+
+// frames built in each in-memory run
+const size_t FRAMES = 2000000;
+
+// messages written in each send run
+const size_t MESSAGES = 500000;
+
+// the message a busy sender sends over and over
+const char TEXT[] = "the quick brown fox jumps over the lazy dog";
+
+/*
+ * Reader thread: plays the receiving client, discarding everything.
+ *
+ * Parameters:
+ *   arg - pointer to the file descriptor to read from
+ */
+void *reader(void *arg) {
+  int fd = *static_cast<int *>(arg);
+  char buf[65536];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+  return nullptr;
+}
+
+/*
+ * Prints and records one result.
+ *
+ * Parameters:
+ *   name - what was measured
+ *   ops - number of operations
+ *   ns - nanoseconds they took
+ *   allocs - allocations made meanwhile
+ */
+void report(const char *name, size_t ops, uint64_t ns, size_t allocs) {
+  printf("%16s %14.0f %10.1f %12.2f\n", name, ops / (ns / 1e9),
+         static_cast<double>(ns) / ops, static_cast<double>(allocs) / ops);
+  bench_report("encode_bench", name, ops, ns, allocs);
+}
+
+/*
+ * Encodes FRAMES replies with Frame::create.
+ */
+void run_create() {
+  Message msg(TAG_OK, "joined room");
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < FRAMES; i++) {
+    Frame::create(msg)->unref();
+  }
+  report("frame_create", FRAMES, bench_now_ns() - t0, bench_allocs() - a0);
+}
+
+/*
+ * Encodes FRAMES deliveries with Frame::create_delivery.
+ */
+void run_create_delivery() {
+  std::string room = "partytime", sender = "alice", text = TEXT;
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < FRAMES; i++) {
+    Frame::create_delivery(room, sender, text)->unref();
+  }
+  report("create_delivery", FRAMES, bench_now_ns() - t0, bench_allocs() - a0);
+}
+
+/*
+ * Writes MESSAGES messages with Connection::send to a socket drained
+ * by a reader thread.
+ *
+ * Parameters:
+ *   framing - the framing to send in
+ */
+void run_send(Framing framing) {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  pthread_t reader_thr;
+  pthread_create(&reader_thr, NULL, reader, &fds[1]);
+
+  Connection conn(fds[0]);
+  conn.set_framing(framing);
+  Message msg(TAG_SENDALL, TEXT);
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < MESSAGES; i++) {
+    conn.send(msg);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+
+  conn.close();
+  pthread_join(reader_thr, NULL);
+  close(fds[1]);
+  report(framing == FRAMING_BINARY ? "send_binary" : "send_text", MESSAGES, ns, allocs);
+}
+
+}
+
+int main() {
+  printf("%16s %14s %10s %12s\n", "case", "ops/sec", "ns/op", "allocs/op");
+  run_create();
+  run_create_delivery();
+  run_send(FRAMING_TEXT);
+  run_send(FRAMING_BINARY);
+  return 0;
+}
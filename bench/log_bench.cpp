@@ -0,0 +1,201 @@
+/*
+ * Benchmark for the room logs: sustained appends until everything is
+ * on disk (and how many appends each sync covered), the time a log adds
+ * to Room::broadcast_message, and replaying a log through LogReader.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../frame.h"
+#include "../user.h"
+#include "../room.h"
+#include "../room_log.h"
+#include "../metrics.h"
+#include "bench_util.h"
+
+namespace {
+
+// messages appended in each append run
+const size_t APPENDS = 200000;
+
+// broadcasts timed with and without a log
+const size_t BROADCASTS = 200000;
+
+// receivers in the room broadcast to
+const size_t ROOM_SIZE = 10;
+
+// the message a busy sender sends over and over
+const char TEXT[] = "the quick brown fox jumps over the lazy dog";
+
+/*
+ * Counts the room logs synced so far.
+ *
+ * Returns:
+ *   the number of syncs made by every thread
+ */
+uint64_t syncs_so_far() {
+  MetricsTotals totals;
+  metrics_collect(totals);
+  return totals.counters[LOG_SYNCS];
+}
+
+/*
+ * Appends APPENDS messages, spread over some rooms' logs, as fast as
+ * possible, and prints the throughput until all of them are on disk.
+ *
+ * Parameters:
+ *   dir - the directory to put the logs in
+ *   rooms - the number of rooms (and logs)
+ */
+void run_append(const std::string &dir, size_t rooms) {
+  LogWriter writer;
+  writer.start();
+  std::vector<RoomLog *> logs;
+  for (size_t i = 0; i < rooms; i++) {
+    logs.push_back(RoomLog::open(&writer, dir, "append" + std::to_string(rooms) + "_" + std::to_string(i)));
+  }
+  std::string sender = "sender";
+  std::string text = TEXT;
+
+  uint64_t s0 = syncs_so_far();
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < APPENDS; i++) {
+    logs[i % rooms]->append(sender, text);
+  }
+  uint64_t append_ns = bench_now_ns() - t0;
+  writer.drain();
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  uint64_t syncs = syncs_so_far() - s0;
+
+  printf("%10zu %14.0f %14.1f %14.1f %12.1f\n", rooms, APPENDS / (ns / 1e9),
+         static_cast<double>(append_ns) / APPENDS, static_cast<double>(ns) / APPENDS,
+         static_cast<double>(APPENDS) / syncs);
+  bench_report("log_bench", "append/rooms=" + std::to_string(rooms), APPENDS, ns, allocs);
+
+  for (size_t i = 0; i < rooms; i++) {
+    delete logs[i];
+  }
+}
+
+/*
+ * Times Room::broadcast_message to a room of ROOM_SIZE receivers, with
+ * or without the room logging its messages, and prints the time per
+ * broadcast.
+ *
+ * Parameters:
+ *   dir - the directory to put the log in
+ *   logged - true to give the room a log
+ */
+void run_broadcast(const std::string &dir, bool logged) {
+  LogWriter writer;
+  writer.start();
+  Room room("broadcast");
+  if (logged) {
+    room.set_log(RoomLog::open(&writer, dir, "broadcast"));
+  }
+  std::vector<User *> users;
+  for (size_t i = 0; i < ROOM_SIZE; i++) {
+    users.push_back(new User("user" + std::to_string(i)));
+    room.add_member(users.back());
+  }
+  std::string sender = "sender";
+  std::string text = TEXT;
+
+  size_t allocs = 0;
+  uint64_t ns = 0;
+  for (size_t r = 0; r < BROADCASTS; r++) {
+    size_t a0 = bench_allocs();
+    uint64_t t0 = bench_now_ns();
+    room.broadcast_message(sender, text);
+    ns += bench_now_ns() - t0;
+    allocs += bench_allocs() - a0;
+    for (size_t i = 0; i < users.size(); i++) {
+      Frame *frame;
+      while ((frame = users[i]->mqueue.try_dequeue()) != nullptr) {
+        frame->unref();
+      }
+    }
+  }
+  writer.drain();
+
+  printf("%10s %14.0f %14.1f %12.2f\n", logged ? "logged" : "unlogged",
+         BROADCASTS / (ns / 1e9), static_cast<double>(ns) / BROADCASTS,
+         static_cast<double>(allocs) / BROADCASTS);
+  bench_report("log_bench", std::string("broadcast/") + (logged ? "logged" : "unlogged"),
+               BROADCASTS, ns, allocs);
+
+  for (size_t i = 0; i < users.size(); i++) {
+    room.remove_member(users[i]);
+    users[i]->unref();
+  }
+}
+
+/*
+ * Reads back every record of a log and prints the throughput.
+ *
+ * Parameters:
+ *   dir - the directory holding the log
+ *   room_name - the room whose log is read
+ */
+void run_replay(const std::string &dir, const std::string &room_name) {
+  LogReader reader;
+  std::string_view sender, text;
+  size_t records = 0;
+  size_t bytes = 0; // bytes of text seen, so the reads can't be skipped
+  uint64_t t0 = bench_now_ns();
+  reader.open(room_log_path(dir, room_name));
+  while (reader.next(sender, text)) {
+    records++;
+    bytes += text.size();
+  }
+  uint64_t ns = bench_now_ns() - t0;
+
+  printf("%10zu %14.0f %14.1f %12.1f\n", records, records / (ns / 1e9),
+         static_cast<double>(ns) / records, reader.get_size() / (ns / 1e3));
+  bench_report("log_bench", "replay", records, ns, 0);
+  (void) bytes;
+}
+
+}
+
+int main() {
+  char dir_template[] = "/tmp/log_bench.XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = dir_template;
+
+  printf("%10s %14s %14s %14s %12s\n", "rooms", "durable/sec", "ns/append", "ns/durable",
+         "appends/sync");
+  run_append(dir, 1);
+  run_append(dir, 16);
+
+  printf("\n%10s %14s %14s %12s\n", "room", "bcasts/sec", "ns/bcast", "allocs/bcast");
+  run_broadcast(dir, false);
+  run_broadcast(dir, true);
+
+  printf("\n%10s %14s %14s %12s\n", "records", "records/sec", "ns/record", "MB/sec");
+  run_replay(dir, "append1_0");
+
+  // remove the logs
+  std::vector<std::string> names = { "append1_0", "broadcast" };
+  for (size_t i = 0; i < 16; i++) {
+    names.push_back("append16_" + std::to_string(i));
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    unlink(room_log_path(dir, names[i]).c_str());
+  }
+  rmdir(dir.c_str());
+  return 0;
+}
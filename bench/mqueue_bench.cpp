@@ -0,0 +1,103 @@
+/*
+ * Contention benchmark for MessageQueue: several producer threads
+ * enqueue into one queue while a single consumer dequeues.
+ * Built once per MessageQueue implementation.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "../message.h"
+#include "../frame.h"
+#include "../message_queue.h"
+#include "bench_util.h"
+
+#ifdef MQUEUE_LOCKFREE
+#define MQUEUE_IMPL "lockfree"
+#else
+#define MQUEUE_IMPL "mutex"
+#endif
+
+namespace {
+
+// frames enqueued by each producer
+const size_t PER_PRODUCER = 500000;
+
+struct ProducerArg {
+  MessageQueue *mqueue;
+  Frame *frame;
+};
+
+/*
+ * Producer thread: enqueues PER_PRODUCER references to one frame.
+ *
+ * Parameters:
+ *   arg - pointer to the ProducerArg
+ */
+void *producer(void *arg) {
+  ProducerArg *p = static_cast<ProducerArg *>(arg);
+  for (size_t i = 0; i < PER_PRODUCER; i++) {
+    p->frame->ref();
+    p->mqueue->enqueue(p->frame);
+  }
+  return nullptr;
+}
+
+/*
+ * Runs one round with the given number of producers and prints
+ * the throughput seen by the consumer.
+ *
+ * Parameters:
+ *   num_producers - number of producer threads
+ */
+void run(int num_producers) {
+  MessageQueue mqueue;
+  Frame *frame = Frame::create(Message(TAG_DELIVERY, "bench:sender:hello"));
+
+  std::vector<pthread_t> threads(num_producers);
+  ProducerArg arg = { &mqueue, frame };
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < num_producers; i++) {
+    pthread_create(&threads[i], NULL, producer, &arg);
+  }
+
+  // this thread is the single consumer
+  size_t total = PER_PRODUCER * num_producers;
+  for (size_t got = 0; got < total; ) {
+    Frame *f = mqueue.dequeue();
+    if (f != nullptr) {
+      f->unref();
+      got++;
+    }
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  for (int i = 0; i < num_producers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  frame->unref();
+
+  printf("%10s %10d %14.0f %10.1f %12.3f\n", MQUEUE_IMPL, num_producers,
+         total / (ns / 1e9), static_cast<double>(ns) / total,
+         static_cast<double>(allocs) / total);
+  bench_report("mqueue_bench_" MQUEUE_IMPL, "producers=" + std::to_string(num_producers),
+               total, ns, allocs);
+}
+
+}
+
+int main() {
+  printf("%10s %10s %14s %10s %12s\n", "impl", "producers", "ops/sec", "ns/op", "allocs/op");
+  int counts[] = { 1, 2, 4, 8 };
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    run(counts[i]);
+  }
+  return 0;
+}
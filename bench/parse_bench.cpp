@@ -0,0 +1,210 @@
+/*
+ * Benchmark for receiving and decoding messages, comparing the old
+ * copying parse (rio_readlineb into std::strings, substr and trim)
+ * with Connection::receive using text and binary framing (and the
+ * read calls each needs per message), and finding
+ * the delimiters of lines in a buffer with memchr and find against
+ * scan_line.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../csapp.h"
+#include "../message.h"
+#include "../framing.h"
+#include "../connection.h"
+#include "../client_util.h"
+#include "../scan.h"
+#include "bench_util.h"
+
+namespace {
+
+// messages received in each run
+const size_t MESSAGES = 1000000;
+
+// the message a busy sender sends over and over
+const char TEXT[] = "the quick brown fox jumps over the lazy dog";
+
+enum Parser { LEGACY, VIEW, BINARY };
+
+enum Splitter { FIND, SCAN };
+
+struct WriterArg {
+  int fd;
+  Parser parser;
+};
+
+/*
+ * Writer thread: plays the sending client, writing MESSAGES messages.
+ *
+ * Parameters:
+ *   arg - pointer to the WriterArg
+ */
+void *writer(void *arg) {
+  WriterArg *w = static_cast<WriterArg *>(arg);
+  int fd = w->fd;
+  std::string one;
+  if (w->parser == BINARY) {
+    char hdr[BIN_HEADER_LEN];
+    encode_bin_header(hdr, TAG_SENDALL, sizeof(TEXT) - 1);
+    one.assign(hdr, sizeof(hdr));
+    one += TEXT;
+  } else {
+    one = std::string(tag_name(TAG_SENDALL)) + ":" + TEXT + "\n";
+  }
+  std::string chunk;
+  for (int i = 0; i < 256; i++) {
+    chunk += one;
+  }
+  for (size_t sent = 0; sent < MESSAGES; sent += 256) {
+    rio_writen(fd, chunk.data(), chunk.size());
+  }
+  close(fd);
+  return nullptr;
+}
+
+/*
+ * The receive path as it was before, kept here to compare against.
+ *
+ * Parameters:
+ *   fdbuf - pointer to the rio buffer to read from
+ *   msg - reference to the Message to store the tag and data in
+ *
+ * Returns:
+ *   true if a valid message was received
+ */
+bool legacy_receive(rio_t *fdbuf, Message &msg) {
+  char buf[1000];
+  ssize_t n = rio_readlineb(fdbuf, buf, sizeof(buf));
+  if (n <= 0) {
+    return false;
+  }
+  std::string message(buf, n);
+  std::string msgShort = message.substr(0, message.size() - 1);
+  if (msgShort.find('\n') != std::string::npos || msgShort.find('\r') != std::string::npos) {
+    return false;
+  }
+  size_t index = msgShort.find(':');
+  if (index == std::string::npos) {
+    return false;
+  }
+  std::string tag = msgShort.substr(0, index);
+  if (tag != tag_name(TAG_SENDALL)) {
+    return false;
+  }
+  msg.tag = tag_from_name(trim(message.substr(0, index)));
+  msg.data = trim(message.substr(index + 1));
+  return true;
+}
+
+/*
+ * Receives MESSAGES lines over a socket and prints the throughput
+ * and allocations per message.
+ *
+ * Parameters:
+ *   parser - LEGACY for the old copying parse, VIEW or BINARY for
+ *            Connection::receive with text or binary framing
+ */
+void run(Parser parser) {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  WriterArg arg = { fds[1], parser };
+  pthread_t writer_thr;
+  pthread_create(&writer_thr, NULL, writer, &arg);
+
+  Connection conn(fds[0]);
+  if (parser == BINARY) {
+    conn.set_framing(FRAMING_BINARY);
+  }
+  bool legacy = (parser == LEGACY);
+  rio_t fdbuf;
+  rio_readinitb(&fdbuf, fds[0]);
+  Message msg;
+  size_t received = 0;
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  while (legacy ? legacy_receive(&fdbuf, msg) : conn.receive(msg)) {
+    received++;
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+
+  pthread_join(writer_thr, NULL);
+  conn.close();
+
+  // the legacy parse reads through rio's fixed 8192 byte buffer
+  unsigned long reads = legacy ? 0 : conn.get_read_calls();
+  const char *names[] = { "legacy", "view", "binary" };
+  printf("%10s %12zu %14.0f %10.1f %12.2f %10.4f\n", names[parser],
+         received, received / (ns / 1e9), static_cast<double>(ns) / received,
+         static_cast<double>(allocs) / received, static_cast<double>(reads) / received);
+  bench_report("parse_bench", names[parser], received, ns, allocs);
+}
+
+/*
+ * Finds the newline, colon and carriage returns of MESSAGES lines in a
+ * buffer already in memory and prints the throughput.
+ *
+ * Parameters:
+ *   splitter - FIND for memchr and string_view::find, as the receive
+ *              path did before, or SCAN for scan_line
+ */
+void run_split(Splitter splitter) {
+  std::string one = std::string(tag_name(TAG_SENDALL)) + ":" + TEXT + "\n";
+  std::string buf;
+  while (buf.size() < 64 * 1024) {
+    buf += one;
+  }
+  size_t found = 0; // colons found, so the work can't be skipped
+  size_t pos = 0;
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < MESSAGES; i++) {
+    const char *start = buf.data() + pos;
+    size_t avail = buf.size() - pos;
+    size_t len;
+    if (splitter == FIND) {
+      const char *nl = static_cast<const char *>(memchr(start, '\n', avail));
+      len = nl + 1 - start;
+      std::string_view line(start, len - 1);
+      found += (line.find('\r') == std::string_view::npos && line.find(':') != std::string_view::npos);
+    } else {
+      LineScan scan;
+      scan_line(start, avail, scan);
+      len = scan.end;
+      found += (scan.cr == NO_POS && scan.colon != NO_POS);
+    }
+    pos += len;
+    if (buf.size() - pos < one.size()) {
+      pos = 0;
+    }
+  }
+  uint64_t ns = bench_now_ns() - t0;
+
+  const char *names[] = { "find", "scan" };
+  printf("%10s %12zu %14.0f %10.1f\n", names[splitter], found,
+         MESSAGES / (ns / 1e9), static_cast<double>(ns) / MESSAGES);
+  bench_report("parse_bench", std::string("split/") + names[splitter], MESSAGES, ns, 0);
+}
+
+}
+
+int main() {
+  printf("%10s %12s %14s %10s %12s %10s\n", "parser", "messages", "msgs/sec", "ns/msg", "allocs/msg", "reads/msg");
+  run(LEGACY);
+  run(VIEW);
+  run(BINARY);
+
+  printf("\n%10s %12s %14s %10s\n", "splitter", "lines", "lines/sec", "ns/line");
+  run_split(FIND);
+  run_split(SCAN);
+  return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Benchmark for the room registry: several threads repeatedly look up
+ * random rooms, or join and leave them, comparing a registry behind
+ * one global mutex (as Server used to have) with Server's sharded one.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "../user.h"
+#include "../room.h"
+#include "../guard.h"
+#include "../server.h"
+#include "bench_util.h"
+
+namespace {
+
+// rooms the threads pick from
+const size_t NUM_ROOMS = 10000;
+
+// joins (each followed by a leave) made by each thread
+const size_t PER_THREAD = 500000;
+
+// The room registry as it was before: one map behind one mutex.
+class GlobalRegistry {
+public:
+  GlobalRegistry() { pthread_mutex_init(&m_lock, NULL); }
+
+  ~GlobalRegistry() {
+    for (std::map<std::string, Room *>::iterator i = m_rooms.begin(); i != m_rooms.end(); ++i) {
+      delete i->second;
+    }
+    pthread_mutex_destroy(&m_lock);
+  }
+
+  Room *find_or_create_room(const std::string &room_name) {
+    Guard guard(m_lock);
+    std::map<std::string, Room *>::iterator room_it = m_rooms.find(room_name);
+    if (room_it != m_rooms.end()) {
+      return room_it->second;
+    }
+    m_rooms[room_name] = new Room(room_name);
+    return m_rooms[room_name];
+  }
+
+private:
+  std::map<std::string, Room *> m_rooms;
+  pthread_mutex_t m_lock;
+};
+
+std::vector<std::string> room_names;
+
+template<typename Registry>
+struct ChurnArg {
+  Registry *registry;
+  unsigned seed;
+};
+
+/*
+ * Churn thread: joins and leaves PER_THREAD randomly chosen rooms.
+ *
+ * Parameters:
+ *   arg - pointer to the ChurnArg
+ */
+template<typename Registry>
+void *churn(void *arg) {
+  ChurnArg<Registry> *c = static_cast<ChurnArg<Registry> *>(arg);
+  User *user = new User("user" + std::to_string(c->seed));
+  unsigned seed = c->seed;
+  for (size_t i = 0; i < PER_THREAD; i++) {
+    Room *room = c->registry->find_or_create_room(room_names[rand_r(&seed) % NUM_ROOMS]);
+    room->add_member(user);
+    room->remove_member(user);
+  }
+  user->unref();
+  return nullptr;
+}
+
+/*
+ * Lookup thread: finds PER_THREAD randomly chosen rooms, without
+ * joining them.
+ *
+ * Parameters:
+ *   arg - pointer to the ChurnArg
+ */
+template<typename Registry>
+void *lookup(void *arg) {
+  ChurnArg<Registry> *c = static_cast<ChurnArg<Registry> *>(arg);
+  unsigned seed = c->seed;
+  for (size_t i = 0; i < PER_THREAD; i++) {
+    c->registry->find_or_create_room(room_names[rand_r(&seed) % NUM_ROOMS]);
+  }
+  return nullptr;
+}
+
+/*
+ * Runs one round with the given number of threads and prints the
+ * rate of lookups or joins.
+ *
+ * Parameters:
+ *   registry - pointer to the room registry to use
+ *   name - name of the registry, for the output
+ *   join - true to join and leave each room, false only to look it up
+ *   num_threads - number of threads
+ */
+template<typename Registry>
+void run(Registry *registry, const char *name, bool join, int num_threads) {
+  std::vector<pthread_t> threads(num_threads);
+  std::vector<ChurnArg<Registry> > args(num_threads);
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < num_threads; i++) {
+    args[i].registry = registry;
+    args[i].seed = i + 1;
+    pthread_create(&threads[i], NULL, join ? churn<Registry> : lookup<Registry>, &args[i]);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+
+  size_t total = PER_THREAD * num_threads;
+  const char *op = join ? "join" : "lookup";
+  printf("%10s %8s %10d %14.0f %10.1f %12.3f\n", name, op, num_threads,
+         total / (ns / 1e9), static_cast<double>(ns) / total,
+         static_cast<double>(allocs) / total);
+  bench_report("room_churn_bench",
+               std::string(name) + " " + op + " threads=" + std::to_string(num_threads),
+               total, ns, allocs);
+}
+
+}
+
+int main() {
+  for (size_t i = 0; i < NUM_ROOMS; i++) {
+    room_names.push_back("room" + std::to_string(i));
+  }
+
+  printf("%10s %8s %10s %14s %10s %12s\n", "registry", "op", "threads", "ops/sec", "ns/op",
+         "allocs/op");
+  int counts[] = { 1, 2, 4, 8 };
+  GlobalRegistry global;
+  Server sharded(0);
+  // the join rounds run first, so every room exists by the lookups
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    run(&global, "global", true, counts[i]);
+    run(&sharded, "sharded", true, counts[i]);
+  }
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    run(&global, "global", false, counts[i]);
+    run(&sharded, "sharded", false, counts[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Benchmark for concurrent senders in one room: several threads
+ * broadcast to the same room while another keeps joining and leaving
+ * it and another drains the receivers' queues.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "../frame.h"
+#include "../user.h"
+#include "../room.h"
+#include "bench_util.h"
+
+namespace {
+
+// receivers in the room
+const size_t ROOM_SIZE = 100;
+
+// broadcasts made by each sender
+const size_t PER_SENDER = 20000;
+
+struct BenchArg {
+  Room *room;
+  std::vector<User *> *users;
+  std::atomic<bool> *done;
+  size_t joins;
+};
+
+/*
+ * Sender thread: broadcasts PER_SENDER messages to the room.
+ *
+ * Parameters:
+ *   arg - pointer to the BenchArg
+ */
+void *sender(void *arg) {
+  BenchArg *b = static_cast<BenchArg *>(arg);
+  std::string text = "the quick brown fox jumps over the lazy dog";
+  for (size_t i = 0; i < PER_SENDER; i++) {
+    b->room->broadcast_message("sender", text);
+  }
+  return nullptr;
+}
+
+/*
+ * Churn thread: joins and leaves the room until the senders are done.
+ *
+ * Parameters:
+ *   arg - pointer to the BenchArg
+ */
+void *churn(void *arg) {
+  BenchArg *b = static_cast<BenchArg *>(arg);
+  User *user = new User("churn");
+  while (!b->done->load()) {
+    b->room->add_member(user);
+    b->room->remove_member(user);
+    b->joins++;
+  }
+  user->unref();
+  return nullptr;
+}
+
+/*
+ * Drain thread: takes frames off the receivers' queues, as their
+ * server threads would, until the senders are done.
+ *
+ * Parameters:
+ *   arg - pointer to the BenchArg
+ */
+void *drain(void *arg) {
+  BenchArg *b = static_cast<BenchArg *>(arg);
+  std::vector<User *> &users = *b->users;
+  bool last = false;
+  while (!last) {
+    last = b->done->load();
+    for (size_t i = 0; i < users.size(); i++) {
+      Frame *frame;
+      while ((frame = users[i]->mqueue.try_dequeue()) != nullptr) {
+        frame->unref();
+      }
+    }
+  }
+  return nullptr;
+}
+
+/*
+ * Runs one round with the given number of senders and prints the
+ * broadcast rate and the join/leave rate seen alongside it.
+ *
+ * Parameters:
+ *   num_senders - number of sender threads
+ */
+void run(int num_senders) {
+  Room room("bench");
+  std::vector<User *> users;
+  for (size_t i = 0; i < ROOM_SIZE; i++) {
+    users.push_back(new User("user" + std::to_string(i)));
+    room.add_member(users.back());
+  }
+  std::atomic<bool> done(false);
+  BenchArg arg = { &room, &users, &done, 0 };
+
+  pthread_t churn_thr, drain_thr;
+  std::vector<pthread_t> senders(num_senders);
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  pthread_create(&churn_thr, NULL, churn, &arg);
+  pthread_create(&drain_thr, NULL, drain, &arg);
+  for (int i = 0; i < num_senders; i++) {
+    pthread_create(&senders[i], NULL, sender, &arg);
+  }
+  for (int i = 0; i < num_senders; i++) {
+    pthread_join(senders[i], NULL);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  done = true;
+  pthread_join(churn_thr, NULL);
+  pthread_join(drain_thr, NULL);
+
+  printf("%10d %14.0f %14.0f\n", num_senders,
+         PER_SENDER * num_senders / (ns / 1e9), arg.joins / (ns / 1e9));
+  bench_report("room_senders_bench", "senders=" + std::to_string(num_senders),
+               PER_SENDER * num_senders, ns, allocs);
+
+  for (size_t i = 0; i < users.size(); i++) {
+    room.remove_member(users[i]);
+    users[i]->unref();
+  }
+}
+
+}
+
+int main() {
+  printf("%10s %14s %14s\n", "senders", "bcasts/sec", "joins/sec");
+  int counts[] = { 1, 2, 4, 8 };
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    run(counts[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Benchmark for delivering a high-rate room to one receiver, comparing
+ * one write per message with Connection::send_batch.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../frame.h"
+#include "../connection.h"
+#include "../user.h"
+#include "../room.h"
+#include "bench_util.h"
+
+namespace {
+
+// messages broadcast in each run
+const size_t MESSAGES = 500000;
+
+struct SenderArg {
+  Room *room;
+};
+
+/*
+ * Sender thread: broadcasts MESSAGES lines to the room as fast as it can.
+ *
+ * Parameters:
+ *   arg - pointer to the SenderArg
+ */
+void *sender(void *arg) {
+  SenderArg *s = static_cast<SenderArg *>(arg);
+  std::string text = "the quick brown fox jumps over the lazy dog";
+  for (size_t i = 0; i < MESSAGES; i++) {
+    s->room->broadcast_message("alice", text);
+  }
+  return nullptr;
+}
+
+/*
+ * Reader thread: plays the receiving client, discarding everything.
+ *
+ * Parameters:
+ *   arg - pointer to the file descriptor to read from
+ */
+void *reader(void *arg) {
+  int fd = *static_cast<int *>(arg);
+  char buf[65536];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+  return nullptr;
+}
+
+/*
+ * Delivers MESSAGES broadcasts to one receiver and prints the write
+ * system calls made per message.
+ *
+ * Parameters:
+ *   batched - true to use send_batch, false to send one frame per call
+ */
+void run(bool batched) {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  Connection conn(fds[0]);
+  pthread_t reader_thr;
+  pthread_create(&reader_thr, NULL, reader, &fds[1]);
+
+  Room room("bench");
+  User *user = new User("bob");
+  room.add_member(user);
+
+  SenderArg arg = { &room };
+  pthread_t sender_thr;
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  pthread_create(&sender_thr, NULL, sender, &arg);
+
+  // this thread is the receiver's server thread
+  std::vector<Frame *> batch;
+  size_t delivered = 0;
+  while (delivered < MESSAGES) {
+    Frame *frame = user->mqueue.dequeue();
+    if (batched) {
+      batch.push_back(frame);
+      user->mqueue.dequeue_all(batch);
+      delivered += batch.size();
+      conn.send_batch(batch);
+    } else {
+      conn.send(*frame);
+      frame->unref();
+      delivered++;
+    }
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+
+  pthread_join(sender_thr, NULL);
+  room.remove_member(user);
+  user->unref();
+  conn.close();
+  pthread_join(reader_thr, NULL);
+  close(fds[1]);
+
+  printf("%10s %12lu %12lu %14.3f %14.0f\n", batched ? "batched" : "single",
+         conn.get_messages_sent(), conn.get_write_calls(),
+         static_cast<double>(conn.get_write_calls()) / conn.get_messages_sent(),
+         MESSAGES / (ns / 1e9));
+  bench_report("send_batch_bench", batched ? "batched" : "single", MESSAGES, ns, allocs);
+}
+
+}
+
+int main() {
+  printf("%10s %12s %12s %14s %14s\n", "mode", "messages", "writes", "writes/msg", "msgs/sec");
+  run(false);
+  run(true);
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Benchmark for the slab allocator against operator new: blocks of
+ * frame sizes are freed by the thread that allocated them, or handed
+ * to another thread to free, as frames are in the server.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <new>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include "../slab.h"
+#include "bench_util.h"
+
+namespace {
+
+// blocks allocated per case
+const size_t NUM_BLOCKS = 2000000;
+
+// block sizes cycled through, those of short and longer frames
+const size_t SIZES[] = { 80, 150, 300 };
+const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+// blocks in flight between the allocating and the freeing thread
+const size_t RING_SIZE = 1024;
+
+typedef void *(*AllocFn)(size_t);
+typedef void (*FreeFn)(void *);
+
+void *new_alloc(size_t size) { return ::operator new(size); }
+void new_free(void *ptr) { ::operator delete(ptr); }
+
+// Blocks handed from one thread to another.
+struct Handoff {
+  void *ring[RING_SIZE];
+  std::atomic<size_t> head; // next slot to take, written by the consumer
+  std::atomic<size_t> tail; // next slot to fill, written by the producer
+  AllocFn alloc;
+  FreeFn free;
+};
+
+/*
+ * Consumer thread: frees NUM_BLOCKS blocks as they are handed over.
+ *
+ * Parameters:
+ *   arg - pointer to the Handoff
+ */
+void *consumer(void *arg) {
+  Handoff *h = static_cast<Handoff *>(arg);
+  for (size_t i = 0; i < NUM_BLOCKS; i++) {
+    while (h->tail.load(std::memory_order_acquire) == i) {
+      sched_yield();
+    }
+    h->free(h->ring[i % RING_SIZE]);
+    h->head.store(i + 1, std::memory_order_release);
+  }
+  return nullptr;
+}
+
+/*
+ * Allocates NUM_BLOCKS blocks, freeing each on this thread or handing
+ * it to a consumer thread, and prints the time taken.
+ *
+ * Parameters:
+ *   impl - name of the allocator
+ *   alloc - function allocating a block
+ *   free - function freeing a block
+ *   remote - whether blocks are freed by another thread
+ */
+void run(const char *impl, AllocFn alloc, FreeFn free, bool remote) {
+  Handoff h;
+  h.head.store(0);
+  h.tail.store(0);
+  h.alloc = alloc;
+  h.free = free;
+  pthread_t thread;
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  if (remote) {
+    pthread_create(&thread, NULL, consumer, &h);
+  }
+
+  for (size_t i = 0; i < NUM_BLOCKS; i++) {
+    char *block = static_cast<char *>(alloc(SIZES[i % NUM_SIZES]));
+    block[0] = 1;
+    if (!remote) {
+      free(block);
+      continue;
+    }
+    while (i - h.head.load(std::memory_order_acquire) == RING_SIZE) {
+      sched_yield();
+    }
+    h.ring[i % RING_SIZE] = block;
+    h.tail.store(i + 1, std::memory_order_release);
+  }
+
+  if (remote) {
+    pthread_join(thread, NULL);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  const char *where = remote ? "remote" : "local";
+  printf("%10s %10s %14.0f %10.1f %12.3f\n", impl, where,
+         NUM_BLOCKS / (ns / 1e9), static_cast<double>(ns) / NUM_BLOCKS,
+         static_cast<double>(allocs) / NUM_BLOCKS);
+  bench_report("slab_bench", std::string(impl) + "/" + where, NUM_BLOCKS, ns, allocs);
+}
+
+}
+
+int main() {
+  printf("%10s %10s %14s %10s %12s\n", "impl", "free", "ops/sec", "ns/op", "allocs/op");
+  run("new", new_alloc, new_free, false);
+  run("slab", slab_alloc, slab_free, false);
+  run("new", new_alloc, new_free, true);
+  run("slab", slab_alloc, slab_free, true);
+
+  SlabStats stats;
+  slab_collect(stats);
+  printf("slab: %lu allocs, %lu remote frees, %lu live, %lu bytes reserved\n",
+         static_cast<unsigned long>(stats.allocs), static_cast<unsigned long>(stats.remote_frees),
+         static_cast<unsigned long>(stats.get_live()),
+         static_cast<unsigned long>(stats.reserved_bytes));
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Benchmark for a room with one receiver that never reads: a sender
+ * broadcasts while the other receivers are drained, once without a
+ * queue limit and once per slow-consumer policy.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "../frame.h"
+#include "../user.h"
+#include "../room.h"
+#include "bench_util.h"
+
+namespace {
+
+// receivers in the room that keep up
+const size_t ROOM_SIZE = 20;
+
+// broadcasts made by the sender
+const size_t BROADCASTS = 200000;
+
+// queue limit used with each policy
+const size_t LIMIT = 1000;
+
+struct BenchArg {
+  std::vector<User *> *users;
+  std::atomic<bool> *done;
+};
+
+/*
+ * Drain thread: takes frames off the queues of the receivers that keep
+ * up, as their server threads would, until the sender is done.
+ *
+ * Parameters:
+ *   arg - pointer to the BenchArg
+ */
+void *drain(void *arg) {
+  BenchArg *b = static_cast<BenchArg *>(arg);
+  std::vector<User *> &users = *b->users;
+  bool last = false;
+  while (!last) {
+    last = b->done->load();
+    for (size_t i = 0; i < users.size(); i++) {
+      Frame *frame;
+      while ((frame = users[i]->mqueue.try_dequeue()) != nullptr) {
+        frame->unref();
+      }
+    }
+  }
+  return nullptr;
+}
+
+/*
+ * Runs one round and prints the broadcast rate, the frames left
+ * waiting for the frozen receiver and how many were dropped for it.
+ *
+ * Parameters:
+ *   name - name of the configuration, for the output
+ *   limit - queue limit of the frozen receiver, or 0 for none
+ *   policy - policy of the frozen receiver's queue
+ */
+void run(const char *name, size_t limit, MessageQueue::Policy policy) {
+  Room room("bench");
+  std::vector<User *> users;
+  for (size_t i = 0; i < ROOM_SIZE; i++) {
+    users.push_back(new User("user" + std::to_string(i)));
+    room.add_member(users.back());
+  }
+  User *frozen = new User("frozen");
+  frozen->mqueue.set_limit(limit, policy);
+  room.add_member(frozen);
+
+  std::atomic<bool> done(false);
+  BenchArg arg = { &users, &done };
+  pthread_t drain_thr;
+  pthread_create(&drain_thr, NULL, drain, &arg);
+
+  std::string text = "the quick brown fox jumps over the lazy dog";
+  size_t a0 = bench_allocs();
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < BROADCASTS; i++) {
+    room.broadcast_message("sender", text);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+  size_t allocs = bench_allocs() - a0;
+  done = true;
+  pthread_join(drain_thr, NULL);
+
+  std::vector<Frame *> held;
+  frozen->mqueue.dequeue_all(held);
+  for (size_t i = 0; i < held.size(); i++) {
+    held[i]->unref();
+  }
+  printf("%12s %14.0f %12zu %12zu\n", name, BROADCASTS / (ns / 1e9),
+         held.size(), frozen->mqueue.get_drops());
+  bench_report("slow_consumer_bench", name, BROADCASTS, ns, allocs);
+
+  room.remove_member(frozen);
+  frozen->unref();
+  for (size_t i = 0; i < users.size(); i++) {
+    room.remove_member(users[i]);
+    users[i]->unref();
+  }
+}
+
+}
+
+int main() {
+  printf("%12s %14s %12s %12s\n", "policy", "bcasts/sec", "held", "drops");
+  run("unbounded", 0, MessageQueue::DROP_OLDEST);
+  run("drop-oldest", LIMIT, MessageQueue::DROP_OLDEST);
+  run("drop-newest", LIMIT, MessageQueue::DROP_NEWEST);
+  run("disconnect", LIMIT, MessageQueue::DISCONNECT);
+  return 0;
+}
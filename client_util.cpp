@@ -64,3 +64,22 @@ std::string rtrim(const std::string &s) {
 std::string trim(const std::string &s) {
   return rtrim(ltrim(s));
 }
+
+/*
+ * Removes leading and trailing whitespace from a view, without copying.
+ *
+ * Parameters:
+ *   s - a view of a string
+ *
+ * Returns:
+ *   a view of s with the leading and trailing whitespace removed.
+ *   if s is all whitespace, then an empty view is returned.
+ */
+std::string_view trim_view(std::string_view s) {
+  size_t start = s.find_first_not_of(WHITESPACE);
+  if (start == std::string_view::npos) {
+    return std::string_view();
+  }
+  size_t end = s.find_last_not_of(WHITESPACE);
+  return s.substr(start, end + 1 - start);
+}
@@ -11,6 +11,7 @@
 #define CLIENT_UTIL_H
 
 #include <string>
+#include <string_view>
 class Connection;
 struct Message;
 
@@ -20,6 +21,7 @@ struct Message;
 std::string ltrim(const std::string &s);
 std::string rtrim(const std::string &s);
 std::string trim(const std::string &s);
+std::string_view trim_view(std::string_view s);
 
 // you can add additional declarations here...
 
@@ -10,26 +10,36 @@
 #include <sstream>
 #include <cctype>
 #include <cassert>
+#include <cstring>
+#include <vector>
+#include <string_view>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
 #include "message.h"
+#include "framing.h"
+#include "frame.h"
 #include "connection.h"
 #include <iostream>
 #include "client_util.h"
 
-const std::unordered_set<std::string> tags = {
-    TAG_ERR, TAG_OK, TAG_SLOGIN, TAG_RLOGIN, TAG_JOIN, TAG_LEAVE, TAG_SENDALL, TAG_SENDUSER, TAG_QUIT, TAG_DELIVERY, TAG_EMPTY
-};
+// most buffers passed to one writev call (Linux's IOV_MAX)
+const int MAX_IOV = 1024;
 
   /*
-  * Checks if the provided string of a Message is a valid Message.
+  * Checks if the provided line is a valid Message and splits it into
+  * tag and payload, without copying anything.
   *
   * Parameters:
-  *   message - a reference to a string representing the tag and data of a Message (in tag:data format)
-  * 
+  *   message - a view of one line in tag:data format, including its newline
+  *   scan - reference to what scan_line found in the line
+  *   tag - reference to the Tag to set on success
+  *   data - reference to a view to point at the (untrimmed) payload on success
+  *
   * Returns:
   *   true if this Message is a valid message
   */
-  bool validMessage(std::string& message) {
+  bool validMessage(std::string_view message, const LineScan &scan, Tag &tag, std::string_view &data) {
     size_t length = message.size();
 
     // message must not be more than max_len bytes (one char = one byte)
@@ -37,35 +47,29 @@ const std::unordered_set<std::string> tags = {
       return false;
     }
 
-    // message must end at new line delimiter
-    bool hasRF = length >= 2 && message[length - 2] == '\r' && message[length - 1] == '\n';
-    bool hasNL = length >= 1 && message[length - 1] == '\n';
-    if (!hasRF && !hasNL) {
+    // message must end at its first new line delimiter...
+    if (scan.end != length) {
       return false;
     }
 
-    // message must be single line of text with no new line delimiters contained within
-    std::string msgShort;
-    if (hasRF) {
-      msgShort = message.substr(0, length-2);
-    } else {
-      msgShort = message.substr(0, length-1);
-    }
-    if (msgShort.find('\n') != std::string::npos || msgShort.find('\r') != std::string::npos) {
+    // ...with no carriage return before it but (maybe) one right before it
+    bool hasRF = scan.cr != NO_POS;
+    if (hasRF && scan.cr != length - 2) {
       return false;
     }
+    std::string_view msgShort = message.substr(0, length - (hasRF ? 2 : 1));
 
     // message must have colon separator for tag and payload
-    size_t indexColon = msgShort.find(':');
-    if (indexColon == std::string::npos) {
+    if (scan.colon == NO_POS) {
       return false;
     }
 
-    std::string tag = msgShort.substr(0,indexColon);
-    if (tags.find(tag) == tags.end()) {
+    tag = tag_from_name(msgShort.substr(0, scan.colon));
+    if (tag == TAG_NONE) {
       return false;
     }
 
+    data = msgShort.substr(scan.colon + 1);
     return true;
   }
 
@@ -79,7 +83,12 @@ const std::unordered_set<std::string> tags = {
  */
 Connection::Connection()
   : m_fd(-1)
-  , m_last_result(SUCCESS) {
+  , m_framing(FRAMING_TEXT)
+  , m_max_payload(DEFAULT_MAX_PAYLOAD)
+  , m_last_result(SUCCESS)
+  , m_read_calls(0)
+  , m_write_calls(0)
+  , m_messages_sent(0) {
 }
 
 /*
@@ -95,8 +104,13 @@ Connection::Connection()
  */
 Connection::Connection(int fd)
   : m_fd(fd)
-  , m_last_result(SUCCESS) {
-  rio_readinitb(&m_fdbuf, m_fd);  
+  , m_framing(FRAMING_TEXT)
+  , m_max_payload(DEFAULT_MAX_PAYLOAD)
+  , m_last_result(SUCCESS)
+  , m_read_calls(0)
+  , m_write_calls(0)
+  , m_messages_sent(0) {
+  set_nodelay();
 }
 
 /*
@@ -116,10 +130,22 @@ bool Connection::connect(const std::string &hostname, int port) {
     std::cerr << "Failed to connect to server" << std::endl;
     return false;
   }
-  rio_readinitb(&m_fdbuf, m_fd);
+  m_in.consume(m_in.size());
+  m_scan = LineScan();
+  set_nodelay();
   return true;
 }
 
+/*
+ * Disables Nagle's algorithm on the socket. Every send already writes
+ * whole messages (or whole batches of them) in one call, so holding back
+ * small segments only adds delayed-ACK stalls.
+ */
+void Connection::set_nodelay() {
+  int one = 1;
+  setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
 /*
  * Destructor for a Connection object.
  * Insures that the file descriptor is closed.
@@ -163,27 +189,148 @@ void Connection::close() {
  *   true if message was succesfully sent
  */
 bool Connection::send(Message &msg) {
-  if (!is_open()) {
-    m_last_result = EOF_OR_ERROR;
+  if (m_framing == FRAMING_BINARY) {
+    char hdr[BIN_HEADER_LEN];
+    encode_bin_header(hdr, msg.tag, msg.data.size());
+    struct iovec iov[2];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = const_cast<char *>(msg.data.data());
+    iov[1].iov_len = msg.data.size();
+    if (!write_all(iov, 2)) {
+      return false;
+    }
+    m_messages_sent++;
+    return true;
+  }
+
+  // write tag, separator, data and newline in one call, without
+  // first concatenating them
+  std::string_view tag = tag_name(msg.tag);
+  struct iovec iov[4];
+  iov[0].iov_base = const_cast<char *>(tag.data());
+  iov[0].iov_len = tag.size();
+  iov[1].iov_base = const_cast<char *>(":");
+  iov[1].iov_len = 1;
+  iov[2].iov_base = const_cast<char *>(msg.data.data());
+  iov[2].iov_len = msg.data.size();
+  iov[3].iov_base = const_cast<char *>("\n");
+  iov[3].iov_len = 1;
+  if (!write_all(iov, 4)) {
     return false;
   }
-  ssize_t result = rio_writen(m_fd, msg.strMessage().c_str(), msg.sizeMessage());
-  if ( result != static_cast<ssize_t>(msg.sizeMessage())) {
-    m_last_result = EOF_OR_ERROR;
+  m_messages_sent++;
+  return true;
+}
+
+/*
+ * Function to facilitate sending an already encoded frame across the
+ * connection and sets m_last_result appropriately.
+ *
+ * Parameters:
+ *   frame - reference to the Frame being sent.
+ *
+ * Returns:
+ *   true if the frame was succesfully sent
+ */
+bool Connection::send(const Frame &frame) {
+  struct iovec iov;
+  iov.iov_base = const_cast<char *>(frame.data(m_framing));
+  iov.iov_len = frame.size(m_framing);
+  if (!write_all(&iov, 1)) {
     return false;
   }
-  result = rio_writen(m_fd, "\n", 1);
-  if (result != 1) {
+  m_messages_sent++;
+  return true;
+}
+
+/*
+ * Function to send a batch of encoded frames with as few writev calls
+ * as possible, and sets m_last_result appropriately. The reference to
+ * every frame is dropped and frames is cleared, whether or not the
+ * send succeeded.
+ *
+ * Parameters:
+ *   frames - reference to the vector of Frames being sent, in order.
+ *
+ * Returns:
+ *   true if every frame was succesfully sent
+ */
+bool Connection::send_batch(std::vector<Frame *> &frames) {
+  bool ok = true;
+  size_t i = 0;
+  while (ok && i < frames.size()) {
+    struct iovec iov[MAX_IOV];
+    int iovcnt = 0;
+    for (; i < frames.size() && iovcnt < MAX_IOV; i++, iovcnt++) {
+      iov[iovcnt].iov_base = const_cast<char *>(frames[i]->data(m_framing));
+      iov[iovcnt].iov_len = frames[i]->size(m_framing);
+    }
+    ok = write_all(iov, iovcnt);
+    if (ok) {
+      m_messages_sent += iovcnt;
+    }
+  }
+  if (frames.empty()) {
+    m_last_result = SUCCESS;
+  }
+
+  for (size_t j = 0; j < frames.size(); j++) {
+    frames[j]->unref();
+  }
+  frames.clear();
+  return ok;
+}
+
+/*
+ * Helper function to write a gather list completely, resuming after
+ * partial writes, and sets m_last_result appropriately.
+ *
+ * Parameters:
+ *   iov - pointer to the array of buffers to write (modified as
+ *         partial writes are consumed)
+ *   iovcnt - number of buffers
+ *
+ * Returns:
+ *   true if every byte was written
+ */
+bool Connection::write_all(struct iovec *iov, int iovcnt) {
+  if (!is_open()) {
     m_last_result = EOF_OR_ERROR;
     return false;
   }
+  while (iovcnt > 0) {
+    ssize_t n = writev(m_fd, iov, iovcnt);
+    m_write_calls++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      m_last_result = EOF_OR_ERROR;
+      return false;
+    }
+    // skip the buffers that were written completely...
+    size_t written = n;
+    while (iovcnt > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    // ...and the written part of the first one that was not
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
   m_last_result = SUCCESS;
   return true;
 }
 
 /*
  * Function to facilitate receiving a message across the connection
- * and sets m_last_result appropriately.
+ * and sets m_last_result appropriately. The tag and data are parsed
+ * in place in the input buffer and only copied into msg at the end;
+ * receiving repeatedly into the same Message reuses its strings' storage.
  *
  * Parameters:
  *   msg - reference to the Message object to store received tag and data.
@@ -192,22 +339,214 @@ bool Connection::send(Message &msg) {
  *   true if message was succesfully received
  */
 bool Connection::receive(Message &msg) {
-  char buf[1000];
-  ssize_t n = rio_readlineb(&m_fdbuf, buf, sizeof(buf));
-  if (n <= 0) {
-    m_last_result = EOF_OR_ERROR;
-    return false;
+  if (m_framing == FRAMING_BINARY) {
+    m_last_result = read_frame(msg);
+  } else {
+    std::string_view line;
+    LineScan scan;
+    if (!read_line(line, scan)) {
+      m_last_result = EOF_OR_ERROR;
+    } else if (!decode(line, scan, msg)) {
+      m_last_result = INVALID_MSG;
+    } else {
+      m_last_result = SUCCESS;
+    }
   }
-  buf[n] = '\0';
-  std::string response(buf);
-  if (!validMessage(response)) {
-    m_last_result = INVALID_MSG;
+  m_in.settle();
+  return m_last_result == SUCCESS;
+}
+
+/*
+ * Function to check whether the next message has already been read
+ * in full, without reading from the socket.
+ *
+ * Returns:
+ *   true if receive can return the next message (or find it invalid)
+ *   without waiting for more input
+ */
+bool Connection::has_message() {
+  size_t avail = m_in.size();
+  if (m_framing == FRAMING_BINARY) {
+    if (avail < BIN_HEADER_LEN) {
+      return false;
+    }
+    uint32_t len = decode_bin_length(m_in.data());
+    return len == 0 || len - 1 > m_max_payload || avail >= BIN_HEADER_LEN - 1 + len;
+  }
+  // what is found is kept in m_scan, so read_line won't look again
+  size_t limit = avail < MAX_TEXT_LINE ? avail : MAX_TEXT_LINE;
+  return scan_line(m_in.data(), limit, m_scan) || avail >= MAX_TEXT_LINE;
+}
+
+/*
+ * Function to decode one line of the wire protocol into a Message.
+ * Used by receive, and by the server's event loops which do their
+ * own socket reads.
+ *
+ * Parameters:
+ *   line - view of one line, including its newline
+ *   scan - reference to what scan_line found in the line
+ *   msg - reference to the Message object to store decoded tag and data.
+ *
+ * Returns:
+ *   true if the line was a valid message
+ */
+bool Connection::decode(std::string_view line, const LineScan &scan, Message &msg) {
+  Tag tag;
+  std::string_view data;
+  if (!validMessage(line, scan, tag, data)) {
     return false;
   }
-  size_t index = response.find(':');
-  msg.tag = trim(response.substr(0, index));
-  msg.data = trim(response.substr(index + 1));
+  data = trim_view(data);
+  msg.tag = tag;
+  msg.data.assign(data.data(), data.size());
+  return true;
+}
 
-  m_last_result = SUCCESS;
+/*
+ * Function to decode the body of one binary frame (the tag id and the
+ * payload, without the length) into a Message.
+ *
+ * Parameters:
+ *   body - view of the frame's body
+ *   msg - reference to the Message object to store decoded tag and data.
+ *
+ * Returns:
+ *   true if the frame was a valid message
+ */
+bool Connection::decode_binary(std::string_view body, Message &msg) {
+  if (body.empty()) {
+    return false;
+  }
+  Tag tag = tag_from_id(static_cast<unsigned char>(body[0]));
+  if (tag == TAG_NONE) {
+    return false;
+  }
+  msg.tag = tag;
+  msg.data.assign(body.data() + 1, body.size() - 1);
   return true;
-}
\ No newline at end of file
+}
+
+/*
+ * Switches the framing used for messages sent and received from now on.
+ *
+ * Parameters:
+ *   framing - the framing to use
+ *   max_payload - largest binary payload that will be accepted
+ */
+void Connection::set_framing(Framing framing, size_t max_payload) {
+  m_framing = framing;
+  m_max_payload = max_payload;
+}
+
+/*
+ * Helper function to find the next line in the input buffer, reading
+ * from the socket as needed. A line longer than MAX_TEXT_LINE bytes is
+ * returned in MAX_TEXT_LINE byte pieces, and a final line without a newline
+ * is returned as it is at EOF.
+ *
+ * Parameters:
+ *   line - reference to a view to point at the line; it stays valid
+ *          until the next read from this connection
+ *   scan - reference to a LineScan to store what scan_line found in it
+ *
+ * Returns:
+ *   true if a line was found, false on EOF or error
+ */
+bool Connection::read_line(std::string_view &line, LineScan &scan) {
+  while (1) {
+    size_t avail = m_in.size();
+    size_t limit = avail < MAX_TEXT_LINE ? avail : MAX_TEXT_LINE;
+    // read_more moves the line, but scan_line picks up where it left off
+    if (scan_line(m_in.data(), limit, m_scan) || avail >= MAX_TEXT_LINE) {
+      take_line((m_scan.end != NO_POS) ? m_scan.end : MAX_TEXT_LINE, line, scan);
+      return true;
+    }
+
+    if (!read_more()) {
+      if (avail == 0) {
+        return false; // EOF, no data read
+      }
+      take_line(avail, line, scan); // EOF, some data was read
+      return true;
+    }
+  }
+}
+
+/*
+ * Helper function to take the line at the front of the input buffer.
+ *
+ * Parameters:
+ *   len - number of bytes in the line
+ *   line - reference to a view to point at the line
+ *   scan - reference to a LineScan to store what scan_line found in it
+ */
+void Connection::take_line(size_t len, std::string_view &line, LineScan &scan) {
+  line = std::string_view(m_in.data(), len);
+  scan = m_scan;
+  m_scan = LineScan();
+  m_in.consume(len);
+}
+
+/*
+ * Helper function to read the next binary frame, reading from the
+ * socket as needed. Payloads too big for the input buffer are read
+ * straight into msg.
+ *
+ * Parameters:
+ *   msg - reference to the Message object to store received tag and data.
+ *
+ * Returns:
+ *   SUCCESS, INVALID_MSG if the frame was too long or had an unknown
+ *   tag, or EOF_OR_ERROR
+ */
+Connection::Result Connection::read_frame(Message &msg) {
+  while (m_in.size() < BIN_HEADER_LEN) {
+    if (!read_more()) {
+      return EOF_OR_ERROR;
+    }
+  }
+  uint32_t len = decode_bin_length(m_in.data());
+  if (len == 0 || len - 1 > m_max_payload) {
+    // the rest of the stream can't be trusted to be frames
+    return INVALID_MSG;
+  }
+  int tag_id = static_cast<unsigned char>(m_in.data()[BIN_HEADER_LEN - 1]);
+  m_in.consume(BIN_HEADER_LEN);
+
+  size_t payload_len = len - 1;
+  size_t avail = m_in.size();
+  size_t have = avail < payload_len ? avail : payload_len;
+  msg.data.assign(m_in.data(), have);
+  m_in.consume(have);
+  if (have < payload_len) {
+    msg.data.resize(payload_len);
+    ssize_t n = rio_readn(m_fd, &msg.data[have], payload_len - have);
+    m_read_calls++;
+    if (n != static_cast<ssize_t>(payload_len - have)) {
+      return EOF_OR_ERROR;
+    }
+  }
+
+  Tag tag = tag_from_id(tag_id);
+  if (tag == TAG_NONE) {
+    return INVALID_MSG;
+  }
+  msg.tag = tag;
+  return SUCCESS;
+}
+
+/*
+ * Helper function to read as much more of the stream into the input
+ * buffer as it has room for (see ReadBuffer for how the room grows).
+ *
+ * Returns:
+ *   true if more bytes were read, false on EOF or error
+ */
+bool Connection::read_more() {
+  if (m_fd < 0) {
+    return false;
+  }
+  m_read_calls++;
+  return m_in.fill(m_fd) > 0;
+}
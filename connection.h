@@ -10,8 +10,15 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <string>
+#include <string_view>
+#include <vector>
 #include "csapp.h"
+#include "framing.h"
+#include "scan.h"
+#include "read_buffer.h"
 struct Message;
+class Frame;
 
 class Connection {
 public:
@@ -40,6 +47,7 @@ public:
   bool connect(const std::string &hostname, int port);
 
   bool is_open() const;
+  int get_fd() const { return m_fd; }
 
   void close();
 
@@ -48,20 +56,67 @@ public:
   // and if not, whether the reason was an I/O error or reaching EOF,
   // or whether the format of the received message was invalid
   bool send(Message &msg);
+  bool send(const Frame &frame);
   bool receive(Message &msg);
 
+  // Whether a complete message (or a line or frame that will turn out
+  // to be invalid) has already been read, so receive won't block.
+  // Lets a server handle everything a client has pipelined before
+  // replying to any of it.
+  bool has_message();
+
+  // Send several frames with a single writev where possible (for
+  // example everything MessageQueue::dequeue_all returned). Drops the
+  // reference to each frame and clears the vector.
+  bool send_batch(std::vector<Frame *> &frames);
+
   Result get_last_result() const { return m_last_result; }
 
+  // Connections start out using text framing; switch to binary once
+  // it has been negotiated. Binary frames with payloads larger than
+  // max_payload are rejected as invalid.
+  void set_framing(Framing framing, size_t max_payload = DEFAULT_MAX_PAYLOAD);
+  Framing get_framing() const { return m_framing; }
+
+  // number of read and write system calls made and messages sent, so
+  // the effect of batching can be measured as syscalls per message
+  unsigned long get_read_calls() const { return m_read_calls; }
+  unsigned long get_write_calls() const { return m_write_calls; }
+  unsigned long get_messages_sent() const { return m_messages_sent; }
+
+  // Decode one line (including its trailing newline) into msg, given
+  // what scan_line found in it, returning false if the line is not a
+  // valid message.
+  static bool decode(std::string_view line, const LineScan &scan, Message &msg);
+
+  // Decode the body of one binary frame (the tag id byte and the
+  // payload) into msg, returning false if the tag id is unknown.
+  static bool decode_binary(std::string_view body, Message &msg);
+
 private:
   // prohibit value semantics
   Connection(const Connection &);
   Connection &operator=(const Connection &);
 
+  void set_nodelay();
+  bool write_all(struct iovec *iov, int iovcnt);
+  bool read_line(std::string_view &line, LineScan &scan);
+  void take_line(size_t len, std::string_view &line, LineScan &scan);
+  Result read_frame(Message &msg);
+  bool read_more();
+
   // these are the recommended member variables for the
   // Connection class
   int m_fd;
-  rio_t m_fdbuf; // used to allow buffered input
+  // buffered input, and what has been found in the line at its front
+  ReadBuffer m_in;
+  LineScan m_scan;
+  Framing m_framing;
+  size_t m_max_payload;
   Result m_last_result;
+  unsigned long m_read_calls;
+  unsigned long m_write_calls;
+  unsigned long m_messages_sent;
 };
 
 #endif // CONNECTION_H
@@ -0,0 +1,148 @@
+/*
+ * Implementation of class describing the pool of threads fanning
+ * broadcasts out to large rooms.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include "guard.h"
+#include "fanout.h"
+
+/*
+ * Non-Default constructor for FanoutPool object.
+ *
+ * Parameters:
+ *   num_threads - number of threads (and parts each broadcast is split into)
+ *
+ * Returns:
+ *   a new FanoutPool whose threads have not been started yet
+ */
+FanoutPool::FanoutPool(int num_threads)
+  : m_num_threads(num_threads)
+  , m_started(0) {
+  for (int i = 0; i < num_threads; i++) {
+    Worker *worker = new Worker();
+    worker->pool = this;
+    worker->part = i;
+    worker->busy = false;
+    worker->stop = false;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->ready, NULL);
+    pthread_cond_init(&worker->idle, NULL);
+    m_workers.push_back(worker);
+  }
+}
+
+/*
+ * Destructor for a FanoutPool object. Each thread runs what is
+ * still queued for it before it exits.
+ */
+FanoutPool::~FanoutPool() {
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    Guard guard(m_workers[i]->lock);
+    m_workers[i]->stop = true;
+    pthread_cond_signal(&m_workers[i]->ready);
+  }
+  for (size_t i = 0; i < m_started; i++) {
+    pthread_join(m_workers[i]->thread, NULL);
+  }
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    pthread_cond_destroy(&m_workers[i]->idle);
+    pthread_cond_destroy(&m_workers[i]->ready);
+    pthread_mutex_destroy(&m_workers[i]->lock);
+    delete m_workers[i];
+  }
+}
+
+/*
+ * Starts every thread.
+ *
+ * Returns:
+ *   true if all threads started
+ */
+bool FanoutPool::start() {
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    if (pthread_create(&m_workers[i]->thread, NULL, run_thread, m_workers[i]) != 0) {
+      return false;
+    }
+    m_started++;
+  }
+  return true;
+}
+
+/*
+ * Function to give a thread the part of a broadcast that is its own.
+ *
+ * Parameters:
+ *   part - the thread (and part), from 0 to get_num_threads() - 1
+ *   fn - function the thread calls
+ *   arg - passed on to fn
+ */
+void FanoutPool::submit(int part, PartFn fn, void *arg) {
+  Worker *worker = m_workers[part];
+  Task task = { fn, arg };
+  Guard guard(worker->lock);
+  worker->tasks.push_back(task);
+  pthread_cond_signal(&worker->ready);
+}
+
+/*
+ * Function to wait until every thread has run everything it was
+ * given so far.
+ */
+void FanoutPool::drain() {
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    Worker *worker = m_workers[i];
+    Guard guard(worker->lock);
+    while (!worker->tasks.empty() || worker->busy) {
+      pthread_cond_wait(&worker->idle, &worker->lock);
+    }
+  }
+}
+
+/*
+ * Thread entry point for a pool thread.
+ *
+ * Parameters:
+ *   arg - pointer to the thread's Worker
+ */
+void *FanoutPool::run_thread(void *arg) {
+  Worker *worker = static_cast<Worker *>(arg);
+  worker->pool->run(worker);
+  return nullptr;
+}
+
+/*
+ * Thread loop: takes everything queued at once and runs it in order,
+ * until stopped with nothing left to run.
+ *
+ * Parameters:
+ *   worker - pointer to the thread's Worker
+ */
+void FanoutPool::run(Worker *worker) {
+  std::deque<Task> batch;
+  while (1) {
+    {
+      Guard guard(worker->lock);
+      worker->busy = false;
+      if (worker->tasks.empty()) {
+        pthread_cond_broadcast(&worker->idle);
+      }
+      while (worker->tasks.empty() && !worker->stop) {
+        pthread_cond_wait(&worker->ready, &worker->lock);
+      }
+      if (worker->tasks.empty()) {
+        return;
+      }
+      batch.swap(worker->tasks);
+      worker->busy = true;
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i].fn(batch[i].arg, worker->part);
+    }
+    batch.clear();
+  }
+}
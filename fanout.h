@@ -0,0 +1,83 @@
+/*
+ * Class describing the pool of threads fanning broadcasts out to large rooms.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+// default number of members a room needs for its broadcasts to be
+// fanned out by the pool rather than by the sender's thread
+const size_t DEFAULT_FANOUT_MIN_MEMBERS = 10000;
+
+// most broadcasts to one room the pool may have yet to finish; a sender
+// broadcasting faster than that waits for the pool to catch up
+const size_t MAX_ROOM_FANOUTS = 64;
+
+// A FanoutPool runs a fixed number of threads, each with a queue of
+// its own. A room large enough splits its members into one part per
+// thread, always putting a given member in the same part, and hands
+// each part of a broadcast to that part's thread. Each thread runs
+// what it is given in order, so every member gets each sender's
+// messages in the order they were broadcast, while the sender only
+// waits for the parts to be handed over.
+class FanoutPool {
+public:
+  // Function run on a thread for the part of a broadcast given to it
+  typedef void (*PartFn)(void *arg, int part);
+
+  FanoutPool(int num_threads);
+  // Stops the threads once everything given to them has run.
+  ~FanoutPool();
+
+  // Start the threads, returning false if they could not be created.
+  bool start();
+
+  int get_num_threads() const { return m_num_threads; }
+
+  // Have thread part call fn(arg, part), after everything given to it before.
+  void submit(int part, PartFn fn, void *arg);
+
+  // Wait until everything submitted so far has run.
+  void drain();
+
+private:
+  // prohibit value semantics
+  FanoutPool(const FanoutPool &);
+  FanoutPool &operator=(const FanoutPool &);
+
+  struct Task {
+    PartFn fn;
+    void *arg;
+  };
+
+  struct Worker {
+    FanoutPool *pool;
+    int part;
+    pthread_t thread;
+    pthread_mutex_t lock; // must be held while accessing the members below
+    pthread_cond_t ready; // signalled when a task is submitted or on shutdown
+    pthread_cond_t idle;  // broadcast when the queue has been run dry
+    std::deque<Task> tasks;
+    bool busy;            // running tasks taken off the queue
+    bool stop;
+  };
+
+  static void *run_thread(void *arg);
+  void run(Worker *worker);
+
+  int m_num_threads;
+  std::vector<Worker *> m_workers;
+  size_t m_started;
+};
+
+#endif // FANOUT_H
@@ -0,0 +1,137 @@
+/*
+ * Implementation of class describing an encoded, reference-counted message frame.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <new>
+#include <cstring>
+#include <ctime>
+#include "message.h"
+#include "frame.h"
+#include "slab.h"
+
+/*
+ * Constructor for Frame object, only run on storage from allocate.
+ *
+ * Parameters:
+ *   text_len - number of bytes of the text encoding the frame holds
+ *   bin_len - number of bytes of the binary encoding the frame holds
+ */
+Frame::Frame(size_t text_len, size_t bin_len)
+  : m_refs(1)
+  , m_text_len(text_len)
+  , m_bin_len(bin_len)
+  , m_created_ns(0) {
+}
+
+/*
+ * Allocates a frame with room for both encodings in a single block
+ * from this thread's slabs.
+ *
+ * Parameters:
+ *   text_len - number of bytes of the text encoding the frame will hold
+ *   bin_len - number of bytes of the binary encoding the frame will hold
+ *
+ * Returns:
+ *   a pointer to the new Frame, with a reference count of one
+ */
+Frame *Frame::allocate(size_t text_len, size_t bin_len) {
+  void *mem = slab_alloc(offsetof(Frame, m_buf) + text_len + bin_len);
+  return new (mem) Frame(text_len, bin_len);
+}
+
+/*
+ * Creates a frame holding the wire encoding of a Message.
+ *
+ * Parameters:
+ *   msg - reference to the Message to encode
+ *
+ * Returns:
+ *   a pointer to the new Frame, owned by the caller
+ */
+Frame *Frame::create(const Message &msg) {
+  std::string_view tag = tag_name(msg.tag);
+  size_t text_len = tag.size() + 1 + msg.data.size() + 1;
+  size_t bin_len = BIN_HEADER_LEN + msg.data.size();
+  Frame *frame = allocate(text_len, bin_len);
+  char *p = frame->m_buf;
+  memcpy(p, tag.data(), tag.size());
+  p += tag.size();
+  *p++ = ':';
+  memcpy(p, msg.data.data(), msg.data.size());
+  p += msg.data.size();
+  *p++ = '\n';
+
+  encode_bin_header(p, msg.tag, msg.data.size());
+  p += BIN_HEADER_LEN;
+  memcpy(p, msg.data.data(), msg.data.size());
+  return frame;
+}
+
+/*
+ * Creates a frame holding a delivery of a message to a room.
+ *
+ * Parameters:
+ *   room_name - reference to string holding the room's name
+ *   sender_username - reference to string holding the sender's username
+ *   message_text - reference to string holding the text sent
+ *
+ * Returns:
+ *   a pointer to the new Frame, owned by the caller
+ */
+Frame *Frame::create_delivery(const std::string &room_name,
+                              const std::string &sender_username,
+                              const std::string &message_text) {
+  constexpr std::string_view TAG = tag_name(TAG_DELIVERY);
+  size_t payload_len = room_name.size() + 1 + sender_username.size() + 1
+    + message_text.size();
+  size_t text_len = TAG.size() + 1 + payload_len + 1;
+  // text framing can only carry messages that fit on one line
+  if (text_len > MAX_TEXT_LINE
+      || message_text.find_first_of("\r\n") != std::string::npos) {
+    text_len = 0;
+  }
+  Frame *frame = allocate(text_len, BIN_HEADER_LEN + payload_len);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  frame->m_created_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+
+  // the binary encoding goes after the text one, and its payload is
+  // the same as the text one's, so write the payload there first...
+  char *payload = frame->m_buf + text_len + BIN_HEADER_LEN;
+  char *p = payload;
+  memcpy(p, room_name.data(), room_name.size());
+  p += room_name.size();
+  *p++ = ':';
+  memcpy(p, sender_username.data(), sender_username.size());
+  p += sender_username.size();
+  *p++ = ':';
+  memcpy(p, message_text.data(), message_text.size());
+  encode_bin_header(frame->m_buf + text_len, TAG_DELIVERY, payload_len);
+
+  // ...then copy it into the text encoding
+  if (text_len > 0) {
+    p = frame->m_buf;
+    memcpy(p, TAG.data(), TAG.size());
+    p += TAG.size();
+    *p++ = ':';
+    memcpy(p, payload, payload_len);
+    p += payload_len;
+    *p = '\n';
+  }
+  return frame;
+}
+
+/*
+ * Drops a reference to the frame, freeing it if it was the last one.
+ */
+void Frame::unref() {
+  if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    this->~Frame();
+    slab_free(this);
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ * Class describing an encoded, reference-counted message frame.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "framing.h"
+struct Message;
+
+// A Frame holds one message exactly as it goes on the wire, in both
+// the text ("tag:data\n") and the binary framing. Frames are immutable
+// once created and reference counted, so a broadcast is encoded once
+// and the same Frame is queued to every receiver in the room.
+class Frame {
+public:
+  // Create a frame holding the encoding of msg, with a reference
+  // count of one owned by the caller.
+  static Frame *create(const Message &msg);
+
+  // Create a frame holding "delivery:room:sender:text\n", with a
+  // reference count of one owned by the caller. There is no text
+  // encoding if the text holds a line break or the line would be
+  // longer than MAX_TEXT_LINE.
+  static Frame *create_delivery(const std::string &room_name,
+                                const std::string &sender_username,
+                                const std::string &message_text);
+
+  // Take another reference to this frame.
+  void ref() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drop a reference, freeing the frame when the last one is dropped.
+  void unref();
+
+  // The encoding of the message in the given framing. A delivery
+  // that cannot be sent as one text line (see create_delivery) has
+  // a text size of zero.
+  const char *data(Framing framing = FRAMING_TEXT) const {
+    return framing == FRAMING_TEXT ? m_buf : m_buf + m_text_len;
+  }
+  size_t size(Framing framing = FRAMING_TEXT) const {
+    return framing == FRAMING_TEXT ? m_text_len : m_bin_len;
+  }
+
+  // Bytes the frame takes up, its header included.
+  size_t footprint() const { return offsetof(Frame, m_buf) + m_text_len + m_bin_len; }
+
+  // When a delivery was created, in nanoseconds from the monotonic
+  // clock, or 0 for frames made by create.
+  uint64_t get_created_ns() const { return m_created_ns; }
+
+private:
+  // frames are only created through create, and never copied
+  Frame(size_t text_len, size_t bin_len);
+  Frame(const Frame &);
+  Frame &operator=(const Frame &);
+
+  static Frame *allocate(size_t text_len, size_t bin_len);
+
+  std::atomic<unsigned> m_refs;
+  size_t m_text_len;
+  size_t m_bin_len;
+  uint64_t m_created_ns;
+  char m_buf[1]; // actually m_text_len + m_bin_len bytes long
+};
+
+#endif // FRAME_H
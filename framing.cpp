@@ -0,0 +1,28 @@
+/*
+ * Implementation of helpers for the two ways messages can be framed on the wire.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include "message.h"
+#include "framing.h"
+
+/*
+ * Writes the header of a binary frame.
+ *
+ * Parameters:
+ *   hdr - pointer to BIN_HEADER_LEN bytes to write the header to
+ *   tag - the frame's tag
+ *   payload_len - number of payload bytes following the header
+ */
+void encode_bin_header(char *hdr, Tag tag, size_t payload_len) {
+  uint32_t len = static_cast<uint32_t>(payload_len + 1);
+  hdr[0] = static_cast<char>(len >> 24);
+  hdr[1] = static_cast<char>(len >> 16);
+  hdr[2] = static_cast<char>(len >> 8);
+  hdr[3] = static_cast<char>(len);
+  hdr[4] = static_cast<char>(tag);
+}
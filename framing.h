@@ -0,0 +1,56 @@
+/*
+ * Definitions for the two ways messages can be framed on the wire.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+enum Tag : unsigned char;
+
+// Every connection starts out with text framing ("tag:data\n" lines).
+// A client may ask for binary framing by adding ";framing=binary" to
+// its slogin or rlogin payload; if the server accepts, its "ok" reply
+// (still a text line) ends in ";framing=binary", and every message
+// after it, in both directions, is a binary frame:
+//
+//   4 bytes  length of what follows, big-endian (1 + payload size)
+//   1 byte   tag id (the Tag's value, see message.h)
+//   payload  the message data as is: no trimming, any bytes allowed
+enum Framing {
+  FRAMING_TEXT,
+  FRAMING_BINARY,
+};
+
+// login payload option asking for binary framing
+#define FRAMING_OPTION_BINARY "framing=binary"
+
+// bytes in a binary frame before the payload
+const size_t BIN_HEADER_LEN = 5;
+
+// default limit on a binary frame's payload
+const size_t DEFAULT_MAX_PAYLOAD = 64 * 1024;
+
+// longest line the text protocol reads whole; text lines
+// never grow past it, so broadcasts that would are only
+// delivered to binary receivers
+const size_t MAX_TEXT_LINE = 999;
+
+// Write the binary header for a payload of payload_len bytes to hdr,
+// which must have room for BIN_HEADER_LEN bytes.
+void encode_bin_header(char *hdr, Tag tag, size_t payload_len);
+
+// Read the length field of a binary header.
+inline uint32_t decode_bin_length(const char *hdr) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(hdr);
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+#endif // FRAMING_H
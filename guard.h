@@ -29,4 +29,40 @@ private:
   pthread_mutex_t &lock;
 };
 
+// Block-scoped shared (read) hold of a reader-writer lock
+class ReadGuard {
+public:
+  ReadGuard(pthread_rwlock_t &lock)
+    : lock(lock) {
+    pthread_rwlock_rdlock(&lock);
+  }
+
+  ~ReadGuard() {
+    pthread_rwlock_unlock(&lock);
+  }
+
+private:
+  ReadGuard(const ReadGuard &);
+  ReadGuard &operator=(const ReadGuard &);
+  pthread_rwlock_t &lock;
+};
+
+// Block-scoped exclusive (write) hold of a reader-writer lock
+class WriteGuard {
+public:
+  WriteGuard(pthread_rwlock_t &lock)
+    : lock(lock) {
+    pthread_rwlock_wrlock(&lock);
+  }
+
+  ~WriteGuard() {
+    pthread_rwlock_unlock(&lock);
+  }
+
+private:
+  WriteGuard(const WriteGuard &);
+  WriteGuard &operator=(const WriteGuard &);
+  pthread_rwlock_t &lock;
+};
+
 #endif // GUARD_H
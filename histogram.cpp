@@ -0,0 +1,121 @@
+/*
+ * Implementation of class describing a histogram of latencies or other non-negative values.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstring>
+#include "histogram.h"
+
+/*
+ * Default constructor for Histogram object.
+ *
+ * Returns:
+ *   an empty Histogram
+ */
+Histogram::Histogram()
+  : m_count(0)
+  , m_max(0) {
+  memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+/*
+ * Function to count one value.
+ *
+ * Parameters:
+ *   value - the value to count
+ */
+void Histogram::record(uint64_t value) {
+  m_buckets[bucket_for(value)]++;
+  m_count++;
+  if (value > m_max) {
+    m_max = value;
+  }
+}
+
+/*
+ * Function to add every value counted by another histogram to this one.
+ *
+ * Parameters:
+ *   other - reference to the Histogram to add
+ */
+void Histogram::merge(const Histogram &other) {
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    m_buckets[i] += other.m_buckets[i];
+  }
+  m_count += other.m_count;
+  if (other.m_max > m_max) {
+    m_max = other.m_max;
+  }
+}
+
+/*
+ * Function to find a percentile of the counted values.
+ *
+ * Parameters:
+ *   fraction - the percentile as a fraction, e.g. 0.99 for p99
+ *
+ * Returns:
+ *   the top of the bucket holding the percentile (never more than the
+ *   largest value counted), or 0 if nothing was counted
+ */
+uint64_t Histogram::percentile(double fraction) const {
+  if (m_count == 0) {
+    return 0;
+  }
+  // the rank of the value wanted, counting from 1
+  uint64_t rank = static_cast<uint64_t>(fraction * m_count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    seen += m_buckets[i];
+    if (seen >= rank) {
+      uint64_t top = bucket_top(i);
+      return top < m_max ? top : m_max;
+    }
+  }
+  return m_max;
+}
+
+/*
+ * Helper function to find the bucket a value is counted in.
+ *
+ * Parameters:
+ *   value - the value
+ *
+ * Returns:
+ *   the bucket's index
+ */
+int Histogram::bucket_for(uint64_t value) {
+  if (value < static_cast<uint64_t>(SUB_BUCKETS)) {
+    return static_cast<int>(value);
+  }
+  // values with their top bit at position msb share an octave of
+  // SUB_BUCKETS buckets, told apart by the next SUB_BITS bits
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - SUB_BITS;
+  return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) - SUB_BUCKETS);
+}
+
+/*
+ * Helper function to find the largest value counted in a bucket.
+ *
+ * Parameters:
+ *   bucket - the bucket's index
+ *
+ * Returns:
+ *   the largest value bucket_for maps to the bucket
+ */
+uint64_t Histogram::bucket_top(int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t sub = bucket % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
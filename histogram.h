@@ -0,0 +1,48 @@
+/*
+ * Class describing a histogram of latencies or other non-negative values.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// A Histogram counts values in log-linear buckets: every power of two
+// is split into 2^SUB_BITS equal buckets, so any value is stored with
+// a relative error of at most 1/2^SUB_BITS, whatever its size. It is
+// not thread safe; give each thread its own and merge them afterwards.
+class Histogram {
+public:
+  Histogram();
+
+  void record(uint64_t value);
+  void merge(const Histogram &other);
+
+  uint64_t get_count() const { return m_count; }
+  uint64_t get_max() const { return m_max; }
+
+  // The smallest recorded value v such that at least the given
+  // fraction (0..1) of all values are <= v, rounded up to the top of
+  // its bucket. Returns 0 if nothing was recorded.
+  uint64_t percentile(double fraction) const;
+
+private:
+  static const int SUB_BITS = 5;
+  static const int SUB_BUCKETS = 1 << SUB_BITS;
+  static const int NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  static int bucket_for(uint64_t value);
+  static uint64_t bucket_top(int bucket);
+
+  uint64_t m_buckets[NUM_BUCKETS];
+  uint64_t m_count;
+  uint64_t m_max;
+};
+
+#endif // HISTOGRAM_H
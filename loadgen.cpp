@@ -0,0 +1,501 @@
+/*
+ * Main function and helper functions for the load generator, which
+ * drives a server with many senders and receivers at once and reports
+ * throughput and end-to-end latency.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <ctime>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "message.h"
+#include "connection.h"
+#include "histogram.h"
+
+namespace {
+
+struct LoadOptions {
+  std::string host;
+  int port;
+  int senders;
+  int receivers;
+  int rooms;
+  double rate;     // messages per second from all senders together, 0 for no limit
+  double duration; // seconds the senders run for
+  size_t size;     // length of each message's text
+  uint64_t pipeline; // messages each sender keeps in flight, 0 to wait for each ok
+
+  LoadOptions()
+    : port(0), senders(10), receivers(10), rooms(1), rate(1000), duration(10), size(64)
+    , pipeline(0) { }
+};
+
+// One simulated client, run by its own thread.
+struct Client {
+  int index;
+  bool is_sender;
+  std::string room;
+  Connection conn;
+  pthread_t thr;
+  bool ok;          // logged in and joined
+  uint64_t count;   // messages sent or delivered
+  Histogram latency; // receivers: ns from the sender's write to our read
+
+  Client(int i, bool sender, const std::string &room_name)
+    : index(i), is_sender(sender), room(room_name), ok(false), count(0) { }
+};
+
+LoadOptions options;
+std::atomic<uint64_t> start_ns(0); // when the senders start, 0 until then
+std::atomic<int> joined(0);        // clients done logging in, whether or not they succeeded
+
+// stack size of the client threads, so thousands of them fit easily
+const size_t CLIENT_STACK = 256 * 1024;
+
+// how long receivers may take to catch up once the senders finish
+const double GRACE_SECS = 2.0;
+
+/*
+ * Current time in nanoseconds from a monotonic clock, which every
+ * process on the host shares.
+ *
+ * Returns:
+ *   the time in nanoseconds
+ */
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Sleeps until the monotonic clock reaches the given time.
+ *
+ * Parameters:
+ *   when_ns - the time to wake up, in nanoseconds
+ */
+void sleep_until(uint64_t when_ns) {
+  struct timespec ts;
+  ts.tv_sec = when_ns / 1000000000ull;
+  ts.tv_nsec = when_ns % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) { }
+}
+
+/*
+ * Sends a request and waits for the server's ok.
+ *
+ * Parameters:
+ *   conn - reference to the client's Connection
+ *   msg - reference to the request to send
+ *
+ * Returns:
+ *   true if the server replied ok
+ */
+bool request(Connection &conn, Message &msg) {
+  Message reply;
+  return conn.send(msg) && conn.receive(reply) && reply.tag == TAG_OK;
+}
+
+/*
+ * Connects a client, logs it in and joins its room.
+ *
+ * Parameters:
+ *   client - reference to the Client
+ *
+ * Returns:
+ *   true if every step succeeded
+ */
+bool log_in(Client &client) {
+  if (!client.conn.connect(options.host, options.port)) {
+    return false;
+  }
+  std::string name = (client.is_sender ? "loads" : "loadr") + std::to_string(client.index);
+  if (client.is_sender && options.pipeline > 0) {
+    name += ";" LOGIN_OPTION_PIPELINE;
+  }
+  Message login(client.is_sender ? TAG_SLOGIN : TAG_RLOGIN, name);
+  Message join(TAG_JOIN, client.room);
+  return request(client.conn, login) && request(client.conn, join);
+}
+
+/*
+ * Receives a pipelined sender's next acknowledgement.
+ *
+ * Parameters:
+ *   conn - reference to the sender's Connection
+ *   acked - reference to the number of the last command acknowledged
+ *
+ * Returns:
+ *   true if the server acknowledged more commands without an error
+ */
+bool receive_ack(Connection &conn, uint64_t &acked) {
+  Message reply;
+  size_t prefix_len = strlen(PIPELINE_ACK_PREFIX);
+  if (!conn.receive(reply) || reply.tag != TAG_OK
+      || reply.data.compare(0, prefix_len, PIPELINE_ACK_PREFIX) != 0) {
+    return false;
+  }
+  acked = strtoull(reply.data.c_str() + prefix_len, NULL, 10);
+  return true;
+}
+
+/*
+ * Checks whether a reply can be received without waiting.
+ *
+ * Parameters:
+ *   conn - reference to the client's Connection
+ *
+ * Returns:
+ *   true if receive won't block
+ */
+bool reply_waiting(Connection &conn) {
+  if (conn.has_message()) {
+    return true;
+  }
+  struct pollfd pfd = { conn.get_fd(), POLLIN, 0 };
+  return poll(&pfd, 1, 0) > 0;
+}
+
+/*
+ * Sender loop: sends a message stamped with the time it is written at
+ * the sender's share of the target rate until the run is over.
+ *
+ * Parameters:
+ *   client - reference to the sending Client
+ */
+void run_sender(Client &client) {
+  // each sender sends on its own evenly spaced schedule; senders are
+  // staggered so the messages are spread over each interval
+  uint64_t interval = 0;
+  uint64_t first = start_ns;
+  if (options.rate > 0) {
+    interval = static_cast<uint64_t>(1e9 * options.senders / options.rate);
+    first += interval * client.index / options.senders;
+  }
+  uint64_t end_ns = start_ns + static_cast<uint64_t>(options.duration * 1e9);
+
+  Message msg(TAG_SENDALL, "");
+  Message reply;
+  // pipelined commands sent and acknowledged, counting the join
+  uint64_t sent = 1, acked = 1;
+  bool failed = false;
+  std::string padding(options.size, 'x');
+  char stamp[48];
+  for (uint64_t seq = 0; ; seq++) {
+    uint64_t when = first + seq * interval;
+    if (when >= end_ns) {
+      break;
+    }
+    if (interval > 0) {
+      sleep_until(when);
+    } else if (now_ns() >= end_ns) {
+      break;
+    }
+    // the stamp goes first so receivers can parse it; the padding
+    // brings the text up to the requested size
+    int len = snprintf(stamp, sizeof(stamp), "%llu %llu ",
+                       static_cast<unsigned long long>(now_ns()),
+                       static_cast<unsigned long long>(seq));
+    msg.data.assign(stamp, len);
+    if (static_cast<size_t>(len) < options.size) {
+      msg.data.append(padding, 0, options.size - len);
+    }
+    if (options.pipeline == 0) {
+      if (!client.conn.send(msg) || !client.conn.receive(reply) || reply.tag != TAG_OK) {
+        failed = true;
+        break;
+      }
+      client.count++;
+      continue;
+    }
+    if (!client.conn.send(msg)) {
+      failed = true;
+      break;
+    }
+    sent++;
+    client.count++;
+    // wait while the window is full, and take in any acks already here
+    while (!failed && (sent - acked >= options.pipeline || (acked < sent && reply_waiting(client.conn)))) {
+      failed = !receive_ack(client.conn, acked);
+    }
+    if (failed) {
+      break;
+    }
+  }
+  while (!failed && acked < sent) {
+    failed = !receive_ack(client.conn, acked);
+  }
+  if (failed) {
+    std::cerr << "sender " << client.index << ": message not accepted" << std::endl;
+  }
+  Message quit(TAG_QUIT, "bye");
+  request(client.conn, quit);
+}
+
+/*
+ * Receiver loop: records the latency of every delivery until the
+ * connection is shut down.
+ *
+ * Parameters:
+ *   client - reference to the receiving Client
+ */
+void run_receiver(Client &client) {
+  Message msg;
+  while (client.conn.receive(msg)) {
+    if (msg.tag != TAG_DELIVERY) {
+      continue;
+    }
+    uint64_t now = now_ns();
+    // the payload is room:sender:text, and the text starts with the stamp
+    size_t colon = msg.data.find(':');
+    colon = (colon == std::string::npos) ? colon : msg.data.find(':', colon + 1);
+    if (colon == std::string::npos) {
+      continue;
+    }
+    uint64_t sent = strtoull(msg.data.c_str() + colon + 1, NULL, 10);
+    client.latency.record(now > sent ? now - sent : 0);
+    client.count++;
+  }
+}
+
+/*
+ * Thread entry point for a client.
+ *
+ * Parameters:
+ *   arg - pointer to the Client
+ */
+void *client_thread(void *arg) {
+  Client &client = *static_cast<Client *>(arg);
+  client.ok = log_in(client);
+  joined++;
+  if (!client.ok) {
+    return nullptr;
+  }
+  if (client.is_sender) {
+    // wait for every receiver to be in its room before sending
+    while (start_ns == 0) {
+      usleep(1000);
+    }
+    run_sender(client);
+  } else {
+    run_receiver(client);
+  }
+  return nullptr;
+}
+
+/*
+ * Starts a thread for each client in a range.
+ *
+ * Parameters:
+ *   clients - reference to every Client
+ *   begin - index of the first client to start
+ *   end - index after the last client to start
+ */
+void start_clients(std::vector<Client *> &clients, size_t begin, size_t end) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, CLIENT_STACK);
+  for (size_t i = begin; i < end; i++) {
+    if (pthread_create(&clients[i]->thr, &attr, client_thread, clients[i]) != 0) {
+      std::cerr << "Could not create client thread" << std::endl;
+      exit(1);
+    }
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/*
+ * Waits until a number of clients are done logging in.
+ *
+ * Parameters:
+ *   count - number of clients to wait for
+ */
+void wait_joined(int count) {
+  while (joined < count) {
+    usleep(1000);
+  }
+}
+
+/*
+ * Allows as many open files as the hard limit permits, since every
+ * client needs a socket.
+ */
+void raise_fd_limit() {
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+}
+
+/*
+ * Prints the usage message for the load generator.
+ */
+void usage() {
+  std::cerr << "Usage: ./loadgen [--senders <n>] [--receivers <n>] [--rooms <n>] [--rate <msgs/sec>]\n"
+            << "                 [--duration <secs>] [--size <bytes>] [--pipeline <depth>]\n"
+            << "                 <server_address> <port>\n";
+}
+
+/*
+ * Parses the command line into options.
+ *
+ * Parameters:
+ *   argc - number of arguments
+ *   argv - the arguments
+ *
+ * Returns:
+ *   true if the command line was valid
+ */
+bool parse_args(int argc, char **argv) {
+  int argi = 1;
+  while (argi < argc - 2 && argv[argi][0] == '-') {
+    std::string opt = argv[argi];
+    if (argi + 1 >= argc - 2) {
+      return false;
+    }
+    const char *value = argv[argi + 1];
+    if (opt == "--senders") {
+      options.senders = atoi(value);
+    } else if (opt == "--receivers") {
+      options.receivers = atoi(value);
+    } else if (opt == "--rooms") {
+      options.rooms = atoi(value);
+    } else if (opt == "--rate") {
+      options.rate = atof(value);
+    } else if (opt == "--duration") {
+      options.duration = atof(value);
+    } else if (opt == "--size") {
+      options.size = strtoul(value, NULL, 10);
+    } else if (opt == "--pipeline") {
+      options.pipeline = strtoull(value, NULL, 10);
+    } else {
+      return false;
+    }
+    argi += 2;
+  }
+  if (argi != argc - 2) {
+    return false;
+  }
+  options.host = argv[argi];
+  options.port = atoi(argv[argi + 1]);
+  return options.senders > 0 && options.receivers >= 0 && options.rooms > 0
+    && options.rate >= 0 && options.duration > 0 && options.port > 0;
+}
+
+}
+
+/*
+ * Main Function which runs the load generator.
+ *
+ * Parameters:
+ *   argc - integer identifying how many arguments were passed in on command line
+ *   argv - array of C strings where each argument is an individiual string
+ *
+ * Returns:
+ *   0 if every client ran successfully
+ *   1 otherwise
+ */
+int main(int argc, char **argv) {
+  if (!parse_args(argc, argv)) {
+    usage();
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  raise_fd_limit();
+
+  // clients are spread evenly over the rooms; receivers come first so
+  // they are all listening before anyone sends
+  std::vector<Client *> clients;
+  std::vector<int> room_receivers(options.rooms, 0);
+  for (int i = 0; i < options.receivers; i++) {
+    clients.push_back(new Client(i, false, "load" + std::to_string(i % options.rooms)));
+    room_receivers[i % options.rooms]++;
+  }
+  for (int i = 0; i < options.senders; i++) {
+    clients.push_back(new Client(i, true, "load" + std::to_string(i % options.rooms)));
+  }
+
+  uint64_t t0 = now_ns();
+  start_clients(clients, 0, options.receivers);
+  wait_joined(options.receivers);
+  start_clients(clients, options.receivers, clients.size());
+  wait_joined(clients.size());
+  double setup_secs = (now_ns() - t0) / 1e9;
+
+  int failed = 0;
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (!clients[i]->ok) {
+      failed++;
+    }
+  }
+  start_ns = now_ns();
+
+  // wait for the senders, then give the receivers time to catch up
+  uint64_t sent = 0, expected = 0;
+  for (size_t i = options.receivers; i < clients.size(); i++) {
+    pthread_join(clients[i]->thr, NULL);
+    sent += clients[i]->count;
+    expected += clients[i]->count * room_receivers[clients[i]->index % options.rooms];
+  }
+  double send_secs = (now_ns() - start_ns) / 1e9;
+
+  uint64_t grace_end = now_ns() + static_cast<uint64_t>(GRACE_SECS * 1e9);
+  uint64_t delivered = 0;
+  while (now_ns() < grace_end) {
+    delivered = 0;
+    for (int i = 0; i < options.receivers; i++) {
+      delivered += clients[i]->count;
+    }
+    if (delivered >= expected) {
+      break;
+    }
+    usleep(10000);
+  }
+  double recv_secs = (now_ns() - start_ns) / 1e9;
+
+  // shutting down the sockets wakes the receivers out of receive
+  Histogram latency;
+  delivered = 0;
+  for (int i = 0; i < options.receivers; i++) {
+    if (clients[i]->ok) {
+      shutdown(clients[i]->conn.get_fd(), SHUT_RDWR);
+    }
+  }
+  for (int i = 0; i < options.receivers; i++) {
+    pthread_join(clients[i]->thr, NULL);
+    delivered += clients[i]->count;
+    latency.merge(clients[i]->latency);
+  }
+
+  printf("clients:    %d senders, %d receivers, %d rooms (%d failed to join, %.2f s to connect)\n",
+         options.senders, options.receivers, options.rooms, failed, setup_secs);
+  printf("sent:       %llu messages in %.2f s (%.0f msgs/sec)\n",
+         static_cast<unsigned long long>(sent), send_secs, sent / send_secs);
+  printf("delivered:  %llu of %llu expected in %.2f s (%.0f deliveries/sec)\n",
+         static_cast<unsigned long long>(delivered), static_cast<unsigned long long>(expected),
+         recv_secs, delivered / recv_secs);
+  printf("latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+         latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3,
+         latency.percentile(0.999) / 1e3, latency.get_max() / 1e3);
+
+  for (size_t i = 0; i < clients.size(); i++) {
+    delete clients[i];
+  }
+  return (failed == 0 && delivered == expected) ? 0 : 1;
+}
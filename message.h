@@ -10,24 +10,100 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
-#include <vector>
-#include <unordered_set>
+#include <array>
 #include <string>
+#include <string_view>
 
 
 // standard message tags (note that you don't need to worry about
-// "senduser" or "empty" messages)
-#define TAG_ERR       "err"       // protocol error
-#define TAG_OK        "ok"        // success response
-#define TAG_SLOGIN    "slogin"    // register as specific user for sending
-#define TAG_RLOGIN    "rlogin"    // register as specific user for receiving
-#define TAG_JOIN      "join"      // join a chat room
-#define TAG_LEAVE     "leave"     // leave a chat room
-#define TAG_SENDALL   "sendall"   // send message to all users in chat room
-#define TAG_SENDUSER  "senduser"  // send message to specific user in chat room
-#define TAG_QUIT      "quit"      // quit
-#define TAG_DELIVERY  "delivery"  // message delivered by server to receiving client
-#define TAG_EMPTY     "empty"     // sent by server to receiving client to indicate no msgs available
+// "senduser" or "empty" messages); each is also the tag's id in the
+// binary framing (see framing.h), so the values must not change
+enum Tag : unsigned char {
+  TAG_NONE = 0, // no tag (an empty Message, or a name that is not a tag)
+  TAG_ERR,      // protocol error
+  TAG_OK,       // success response
+  TAG_SLOGIN,   // register as specific user for sending
+  TAG_RLOGIN,   // register as specific user for receiving
+  TAG_JOIN,     // join a chat room
+  TAG_LEAVE,    // leave a chat room
+  TAG_SENDALL,  // send message to all users in chat room
+  TAG_SENDUSER, // send message to specific user in chat room
+  TAG_QUIT,     // quit
+  TAG_DELIVERY, // message delivered by server to receiving client
+  TAG_EMPTY,    // sent by server to receiving client to indicate no msgs available
+  NUM_TAGS
+};
+
+// each tag as it is written in the text protocol
+constexpr std::string_view TAG_NAMES[NUM_TAGS] = {
+  "", "err", "ok", "slogin", "rlogin", "join", "leave",
+  "sendall", "senduser", "quit", "delivery", "empty"
+};
+
+// Tag names are looked up through a perfect hash: a hash of a name's
+// length and first and last characters, with a seed (found at compile
+// time) for which no two tags share a slot of TAGS_BY_HASH. Looking up
+// a name is then one hash, one load and one compare.
+const unsigned TAG_HASH_SIZE = 16;
+
+constexpr unsigned tag_hash(std::string_view name, unsigned seed) {
+  unsigned key = static_cast<unsigned char>(name.front())
+    + static_cast<unsigned char>(name.back()) * 31 + static_cast<unsigned>(name.size());
+  return ((key * seed) >> 4) % TAG_HASH_SIZE;
+}
+
+constexpr unsigned find_tag_hash_seed() {
+  for (unsigned seed = 1; seed < 4096; seed++) {
+    bool used[TAG_HASH_SIZE] = { };
+    bool perfect = true;
+    for (int tag = TAG_NONE + 1; tag < NUM_TAGS && perfect; tag++) {
+      unsigned slot = tag_hash(TAG_NAMES[tag], seed);
+      perfect = !used[slot];
+      used[slot] = true;
+    }
+    if (perfect) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+constexpr unsigned TAG_HASH_SEED = find_tag_hash_seed();
+static_assert(TAG_HASH_SEED != 0, "no perfect hash for the tag names");
+
+constexpr std::array<Tag, TAG_HASH_SIZE> make_tags_by_hash() {
+  std::array<Tag, TAG_HASH_SIZE> table = { };
+  for (int tag = TAG_NONE + 1; tag < NUM_TAGS; tag++) {
+    table[tag_hash(TAG_NAMES[tag], TAG_HASH_SEED)] = static_cast<Tag>(tag);
+  }
+  return table;
+}
+
+// tags by the hash of their name; TAG_NONE in unused slots
+constexpr std::array<Tag, TAG_HASH_SIZE> TAGS_BY_HASH = make_tags_by_hash();
+
+// Get the name of a tag, as written in the text protocol.
+constexpr std::string_view tag_name(Tag tag) {
+  return TAG_NAMES[tag];
+}
+
+// Look up the tag with a name, or TAG_NONE if it is not a tag's name.
+constexpr Tag tag_from_name(std::string_view name) {
+  if (name.empty()) {
+    return TAG_NONE;
+  }
+  Tag tag = TAGS_BY_HASH[tag_hash(name, TAG_HASH_SEED)];
+  return (TAG_NAMES[tag] == name) ? tag : TAG_NONE;
+}
+
+// Look up the tag with a binary tag id, or TAG_NONE if it is not a tag's id.
+constexpr Tag tag_from_id(int id) {
+  return (id > TAG_NONE && id < NUM_TAGS) ? static_cast<Tag>(id) : TAG_NONE;
+}
+
+static_assert(tag_from_name("sendall") == TAG_SENDALL && tag_from_name("empty") == TAG_EMPTY
+              && tag_from_name("sendal") == TAG_NONE && tag_from_name("") == TAG_NONE,
+              "tag_from_name is broken");
 
 struct Message {
   // An encoded message may have at most this many characters,
@@ -36,7 +112,7 @@ struct Message {
   // temporarily store the encoded message.)
   static const unsigned MAX_LEN = 255;
 
-  std::string tag;
+  Tag tag;
   std::string data;
 
   
@@ -46,23 +122,49 @@ struct Message {
   * Returns:
   *   a new Message.
   */
-  Message() { }
+  Message() : tag(TAG_NONE) { }
 
   /*
   * Non-Default constructor for Message struct. 
   *
   * Parameters:
-  *   tag - reference to a string holding the message tag
+  *   tag - the message tag
   *   data - reference to a string holding the message payload
   * 
   * Returns:
   *   a new Message with tag and data set to tag and data.
   */
-  Message(const std::string &tag, const std::string &data)
+  Message(Tag tag, const std::string &data)
     : tag(tag), data(data) { }
 
   // TODO: you could add helper functions
 
+  /*
+  * Sets the tag and data of this Message, reusing the storage
+  * the data already has.
+  *
+  * Parameters:
+  *   new_tag - the message tag
+  *   new_data - the message payload
+  */
+  void set(Tag new_tag, const std::string &new_data) {
+    tag = new_tag;
+    data.assign(new_data);
+  }
+
+  void set(Tag new_tag, const char *new_data) {
+    tag = new_tag;
+    data.assign(new_data);
+  }
+
+  /*
+  * Empties the tag and data of this Message, keeping the data's storage.
+  */
+  void clear() {
+    tag = TAG_NONE;
+    data.clear();
+  }
+
   /*
   * Creating a string of this Message.
   * The tag and data are combined, separated by a colon.
@@ -71,7 +173,7 @@ struct Message {
   *   tag:data (a string)
   */
   std::string strMessage() {
-    return tag + ":" + data;
+    return std::string(tag_name(tag)) + ":" + data;
   }
 
   /*
@@ -88,4 +190,13 @@ struct Message {
 
 };
 
+// A sender that adds ";pipeline" to its slogin payload may send
+// commands without waiting for each reply. The server numbers them from
+// 1 and, instead of an ok for each, replies "ok:through N" once it has
+// handled everything read so far, N being the last command handled. A
+// command that fails is answered at once with "err:N:reason", which
+// also acknowledges everything before it.
+#define LOGIN_OPTION_PIPELINE "pipeline"
+#define PIPELINE_ACK_PREFIX "through "
+
 #endif // MESSAGE_H
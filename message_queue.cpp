@@ -8,88 +8,484 @@
  */
 
 #include <cassert>
-#include <ctime>
+#include <cerrno>
+#include <cstdint>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "message_queue.h"
 #include "guard.h"
-#include "message.h"
+#include "frame.h"
+#include "metrics.h"
 
 /*
  * Default constructor for MessageQueue object. 
  *
  * Returns:
  *   a new instance of a MessageQueue object
- *   with the mutex and semaphore initialied.
+ *   with the mutex initialied.
  */
-MessageQueue::MessageQueue() {
+MessageQueue::MessageQueue()
+  : m_head(0)
+  , m_count(0)
+  , m_waiting(false)
+  , m_efd(-1)
+  , m_limit(0)
+  , m_policy(DROP_OLDEST)
+  , m_overrun(false)
+  , m_drops(0)
+  , m_notify(nullptr)
+  , m_notify_arg(nullptr) {
   // initialize the mutex
   pthread_mutex_init(&m_lock, NULL);
-  // initialize the semaphore
-  sem_init(&m_avail, 0, 0);
+#ifdef MQUEUE_LOCKFREE
+  // slot i is first claimed by the producer whose position is i
+  m_ring = new Slot[MQUEUE_RING_SIZE];
+  for (size_t i = 0; i < MQUEUE_RING_SIZE; i++) {
+    m_ring[i].seq.store(i, std::memory_order_relaxed);
+    m_ring[i].frame = nullptr;
+  }
+  m_enqueue_pos.store(0, std::memory_order_relaxed);
+  m_dequeue_pos = 0;
+  m_overflowed.store(false, std::memory_order_relaxed);
+#endif
 }
 
 /*
  * Destructor for a MessageQueue object.
- * Ensures that the mutex and semaphore are destroyed
+ * Ensures that the mutex and eventfd are destroyed
  * and that all pointers in queue are freed.
  */
 MessageQueue::~MessageQueue() {
-  // destroy the mutex and the semaphore
+  // destroy the mutex and the eventfd
   pthread_mutex_destroy(&m_lock);
-  sem_destroy(&m_avail);
-  //  free pointers in queue
-  std::deque<Message *>::iterator msg_it;
-  for (msg_it = m_messages.begin(); msg_it != m_messages.end(); msg_it++){
-    delete (*msg_it);
+  if (m_efd >= 0) {
+    close(m_efd);
+  }
+  //  drop the references held by frames still in queue
+  for (size_t i = m_head; i < m_frames.size(); i++) {
+    m_frames[i]->unref();
+  }
+#ifdef MQUEUE_LOCKFREE
+  for (size_t i = 0; i < MQUEUE_RING_SIZE; i++) {
+    // a slot holds a frame when its seq is one past its position
+    if (m_ring[i].seq.load(std::memory_order_relaxed) % MQUEUE_RING_SIZE == (i + 1) % MQUEUE_RING_SIZE) {
+      m_ring[i].frame->unref();
+    }
+  }
+  delete[] m_ring;
+#endif
+}
+
+/*
+ * Function to limit the number of frames the queue holds.
+ *
+ * Parameters:
+ *   limit - most frames held at once, or 0 for no limit
+ *   policy - what to do with frames enqueued while the queue is full
+ */
+void MessageQueue::set_limit(size_t limit, Policy policy) {
+  m_limit = limit;
+  m_policy = policy;
+}
+
+/*
+ * Function to add a Frame to the MessageQueue. If the queue is at its
+ * limit, the frame or the oldest frame is dropped instead, according
+ * to the queue's policy.
+ *
+ * Parameters:
+ *   frame - pointer to Frame object; the caller's reference passes to the queue
+ */
+void MessageQueue::enqueue(Frame *frame) {
+  // put the specified frame on the queue
+  PushResult result = push(frame);
+  if (result != PUSHED) {
+    m_drops.fetch_add(1, std::memory_order_relaxed);
+    metrics_count(DELIVERIES_DROPPED);
+  }
+  if (result == DROPPED) {
+    frame->unref();
+    if (m_policy == DISCONNECT && !m_overrun.exchange(true, std::memory_order_acq_rel)) {
+      // make sure an event loop looks at the queue and sees it overrun
+      if (m_notify != nullptr) {
+        m_notify(m_notify_arg);
+      }
+    }
+    return;
+  }
+  if (result == REPLACED) {
+    // the number of frames queued did not change
+    return;
+  }
+
+  // count it, and wake the consumer only if it is (about to be) asleep;
+  // both this and the consumer's check in wait are sequentially
+  // consistent, so one of the two always sees the other
+  m_count.fetch_add(1, std::memory_order_seq_cst);
+  if (m_waiting.load(std::memory_order_seq_cst)) {
+    signal();
+  }
+
+  // let an event loop know the queue is non-empty
+  if (m_notify != nullptr) {
+    m_notify(m_notify_arg);
   }
 }
 
 /*
- * Function to add a Message to the MessageQueue
+ * Function to remove a Frame from the MessageQueue, sleeping until
+ * one is available. The thread uses no CPU while it waits.
  *
  * Parameters:
- *   msg - pointer to Message object
+ *   watch_fd - file descriptor to also wait on, or -1 for none
+ *
+ * Returns:
+ *   a pointer to the removed Frame object (the caller must unref it),
+ *   or nullptr if watch_fd became readable
+ */
+Frame *MessageQueue::dequeue(int watch_fd) {
+  while (m_count.load(std::memory_order_acquire) == 0) {
+    if (!wait(watch_fd)) {
+      return nullptr;
+    }
+  }
+  m_count.fetch_sub(1, std::memory_order_relaxed);
+  // remove the next frame from the queue, return it
+  return pop();
+}
+
+/*
+ * Function to remove a Frame from the MessageQueue without waiting
+ *
+ * Returns:
+ *   a pointer to the removed Frame object (the caller must unref it),
+ *   or nullptr if the queue is empty
+ */
+Frame *MessageQueue::try_dequeue() {
+  if (m_count.load(std::memory_order_acquire) == 0) {
+    return nullptr;
+  }
+  m_count.fetch_sub(1, std::memory_order_relaxed);
+  return pop();
+}
+
+/*
+ * Function to remove every Frame currently in the MessageQueue
+ * without waiting.
+ *
+ * Parameters:
+ *   frames - reference to a vector the removed frames are appended to,
+ *            oldest first (the caller must unref each)
+ *
+ * Returns:
+ *   the number of frames removed
+ */
+size_t MessageQueue::dequeue_all(std::vector<Frame *> &frames) {
+  // only frames counted before this point are taken; anything
+  // enqueued meanwhile is left for the next call
+  size_t count = m_count.exchange(0, std::memory_order_acquire);
+  if (count > 0) {
+    pop_batch(count, frames);
+  }
+  return count;
+}
+
+/*
+ * Helper function to sleep until a frame may have been enqueued.
+ *
+ * Parameters:
+ *   watch_fd - file descriptor to also wait on, or -1 for none
+ *
+ * Returns:
+ *   false if watch_fd became readable (or poll failed)
+ */
+bool MessageQueue::wait(int watch_fd) {
+  // the eventfd is only created once a thread actually blocks, so
+  // queues drained by event loops never need one
+  if (m_efd < 0) {
+    m_efd = eventfd(0, EFD_CLOEXEC);
+    if (m_efd < 0) {
+      return false;
+    }
+  }
+
+  m_waiting.store(true, std::memory_order_seq_cst);
+  bool keep_waiting = true;
+  if (m_count.load(std::memory_order_seq_cst) == 0) {
+    struct pollfd fds[2];
+    fds[0].fd = m_efd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch_fd;
+    fds[1].events = POLLIN;
+    int n = poll(fds, watch_fd >= 0 ? 2 : 1, -1);
+    if (n > 0 && (fds[0].revents & POLLIN)) {
+      uint64_t count;
+      ssize_t ignored = read(m_efd, &count, sizeof(count));
+      (void) ignored;
+    }
+    if (n < 0 && errno != EINTR) {
+      keep_waiting = false;
+    } else if (n > 0 && watch_fd >= 0 && fds[1].revents != 0) {
+      keep_waiting = false;
+    }
+  }
+  m_waiting.store(false, std::memory_order_relaxed);
+
+  return keep_waiting || m_count.load(std::memory_order_acquire) > 0;
+}
+
+/*
+ * Helper function to wake a consumer sleeping in wait.
+ */
+void MessageQueue::signal() {
+  uint64_t one = 1;
+  ssize_t ignored = write(m_efd, &one, sizeof(one));
+  (void) ignored;
+}
+
+#ifndef MQUEUE_LOCKFREE
+
+/*
+ * Helper function to store a frame at the back of the queue, unless
+ * the queue is full.
+ *
+ * Parameters:
+ *   frame - pointer to the Frame to store
+ *
+ * Returns:
+ *   whether the frame was stored, and if an older one was dropped for it
  */
-void MessageQueue::enqueue(Message *msg) {
+MessageQueue::PushResult MessageQueue::push(Frame *frame) {
   // lock the mqueue mutex before modifying it
   Guard guard(m_lock);
-  // put the specified message on the queue
-  m_messages.push_back(msg);
-  
-  // be sure to notify any thread waiting for a message to be
-  // available by calling sem_post
-  sem_post(&m_avail);
+  if (m_overrun.load(std::memory_order_relaxed)) {
+    return DROPPED;
+  }
+  // the frames still in m_frames include any the consumer has counted
+  // but not yet popped, so it always finds one to pop
+  if (m_limit > 0 && m_frames.size() - m_head >= m_limit) {
+    if (m_policy != DROP_OLDEST) {
+      return DROPPED;
+    }
+    pop_front()->unref();
+    m_frames.push_back(frame);
+    return REPLACED;
+  }
+  m_frames.push_back(frame);
+  return PUSHED;
+}
+
+/*
+ * Helper function to take the oldest frame off the queue. The caller
+ * must already have taken one count from m_count.
+ *
+ * Returns:
+ *   a pointer to the removed Frame object
+ */
+Frame *MessageQueue::pop() {
+  // lock the mqueue mutex before modifying it
+  Guard guard(m_lock);
+  return pop_front();
+}
+
+/*
+ * Helper function to take the oldest count frames off the queue,
+ * locking only once. The caller must already have taken count
+ * from m_count.
+ *
+ * Parameters:
+ *   count - number of frames to take
+ *   frames - reference to the vector to append them to
+ */
+void MessageQueue::pop_batch(size_t count, std::vector<Frame *> &frames) {
+  Guard guard(m_lock);
+  frames.insert(frames.end(), m_frames.begin() + m_head, m_frames.begin() + m_head + count);
+  m_head += count;
+  if (m_head == m_frames.size()) {
+    m_frames.clear();
+    m_head = 0;
+  } else if (m_head >= 64 && m_head * 2 >= m_frames.size()) {
+    m_frames.erase(m_frames.begin(), m_frames.begin() + m_head);
+    m_head = 0;
+  }
 }
 
+#else // MQUEUE_LOCKFREE
+
 /*
- * Function to remove a Message from the MessageQueue
+ * Helper function to store a frame at the back of the queue, unless
+ * the queue is full. Frames go to the lock-free ring unless it is full
+ * or earlier frames have already overflowed, in which case they are
+ * appended to the overflow list so the consumer still sees them in order.
+ *
+ * Parameters:
+ *   frame - pointer to the Frame to store
  *
  * Returns:
- *   a pointer to the removed Message object
+ *   whether the frame was stored (never REPLACED: only the consumer
+ *   may take frames off the ring)
  */
-Message *MessageQueue::dequeue() {
-  struct timespec ts;
+MessageQueue::PushResult MessageQueue::push(Frame *frame) {
+  // concurrent producers can each see room for one more, so the
+  // limit may be overshot by up to the number of producers
+  if (m_overrun.load(std::memory_order_relaxed)
+      || (m_limit > 0 && m_count.load(std::memory_order_relaxed) >= m_limit)) {
+    return DROPPED;
+  }
+  if (!m_overflowed.load(std::memory_order_acquire) && push_ring(frame)) {
+    return PUSHED;
+  }
 
-  // get the current time using clock_gettime:
-  // we don't check the return value because the only reason
-  // this call would fail is if we specify a clock that doesn't
-  // exist
-  clock_gettime(CLOCK_REALTIME, &ts);
+  // lock the mqueue mutex before modifying the overflow list
+  Guard guard(m_lock);
+  m_frames.push_back(frame);
+  m_overflowed.store(true, std::memory_order_release);
+  return PUSHED;
+}
 
-  // compute a time one second in the future
-  ts.tv_sec += 1;
+/*
+ * Helper function to claim a ring slot and publish a frame in it.
+ *
+ * Parameters:
+ *   frame - pointer to the Frame to store
+ *
+ * Returns:
+ *   false if the ring is full
+ */
+bool MessageQueue::push_ring(Frame *frame) {
+  size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+  while (1) {
+    Slot &slot = m_ring[pos % MQUEUE_RING_SIZE];
+    size_t seq = slot.seq.load(std::memory_order_acquire);
+    long diff = static_cast<long>(seq) - static_cast<long>(pos);
+    if (diff == 0) {
+      // the slot is free for position pos: try to claim it
+      if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        slot.frame = frame;
+        // publish: the consumer reads the slot once seq is pos + 1
+        slot.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+      // lost the race, pos now holds the current position
+    } else if (diff < 0) {
+      // the consumer has not freed this slot yet: the ring is full
+      return false;
+    } else {
+      // another producer claimed pos first
+      pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
 
-  // call sem_timedwait to wait up to 1 second for a message to be available
-  int msg_wait = sem_timedwait(&m_avail, &ts);
-  // return nullptr if no message is available
-  if (msg_wait == -1) {
+/*
+ * Helper function to take the oldest frame off the queue. The caller
+ * must already have taken one count from m_count, so a frame is either
+ * in the ring (possibly still being published by its producer) or in
+ * the overflow list.
+ *
+ * Returns:
+ *   a pointer to the removed Frame object
+ */
+Frame *MessageQueue::pop() {
+  while (1) {
+    Frame *frame = pop_ring();
+    if (frame != nullptr) {
+      return frame;
+    }
+
+    if (m_overflowed.load(std::memory_order_acquire)) {
+      Guard guard(m_lock);
+      // a producer publishes its ring frame before it can add a later
+      // frame to the overflow list, so check the ring again now that
+      // the lock is held to keep each producer's frames in order
+      frame = pop_ring();
+      if (frame != nullptr) {
+        return frame;
+      }
+      if (m_head < m_frames.size()) {
+        frame = pop_front();
+        if (m_head == 0 && m_frames.empty()) {
+          m_overflowed.store(false, std::memory_order_release);
+        }
+        return frame;
+      }
+    }
+
+    // a producer has claimed the slot but not yet published its frame
+    sched_yield();
+  }
+}
+
+/*
+ * Helper function to take the oldest count frames off the queue. The
+ * caller must already have taken count from m_count.
+ *
+ * Parameters:
+ *   count - number of frames to take
+ *   frames - reference to the vector to append them to
+ */
+void MessageQueue::pop_batch(size_t count, std::vector<Frame *> &frames) {
+  for (size_t i = 0; i < count; i++) {
+    frames.push_back(pop());
+  }
+}
+
+/*
+ * Helper function to take the frame in the consumer's next ring slot.
+ *
+ * Returns:
+ *   a pointer to the removed Frame object, or nullptr if the slot
+ *   has not been published yet
+ */
+Frame *MessageQueue::pop_ring() {
+  Slot &slot = m_ring[m_dequeue_pos % MQUEUE_RING_SIZE];
+  size_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq != m_dequeue_pos + 1) {
     return nullptr;
   }
+  Frame *frame = slot.frame;
+  // hand the slot to the producer one lap ahead
+  slot.seq.store(m_dequeue_pos + MQUEUE_RING_SIZE, std::memory_order_release);
+  m_dequeue_pos++;
+  return frame;
+}
 
-  Message *msg = nullptr;
-  // lock the mqueue mutex before modifying it
+#endif // MQUEUE_LOCKFREE
+
+/*
+ * Helper function to take the oldest frame off m_frames, which
+ * must be non-empty. m_lock must be held.
+ *
+ * Returns:
+ *   a pointer to the removed Frame object
+ */
+Frame *MessageQueue::pop_front() {
+  Frame *frame = m_frames[m_head++];
+  if (m_head == m_frames.size()) {
+    // empty again: reuse the storage from the start
+    m_frames.clear();
+    m_head = 0;
+  } else if (m_head >= 64 && m_head * 2 >= m_frames.size()) {
+    // mostly consumed: slide the pending frames down so the
+    // vector does not grow without bound while never emptied
+    m_frames.erase(m_frames.begin(), m_frames.begin() + m_head);
+    m_head = 0;
+  }
+  return frame;
+}
+
+/*
+ * Function to register a callback run after every enqueue. Must be
+ * called before the queue is visible to other threads.
+ *
+ * Parameters:
+ *   fn - pointer to the callback function (nullptr to disable)
+ *   arg - argument passed to the callback
+ */
+void MessageQueue::set_notify(NotifyFn fn, void *arg) {
   Guard guard(m_lock);
-  // remove the next message from the queue, return it
-  msg = m_messages.front();
-  m_messages.pop_front();
-  return msg;
+  m_notify = fn;
+  m_notify_arg = arg;
 }
@@ -10,33 +10,126 @@
 #ifndef MESSAGE_QUEUE_H
 #define MESSAGE_QUEUE_H
 
-#include <deque>
+#include <vector>
+#include <cstddef>
+#include <atomic>
 #include <pthread.h>
-#include <semaphore.h>
-struct Message;
+class Frame;
 
-// This data type represents a queue of Messages waiting to
-// be delivered to a receiver
+// Number of slots in the lock-free ring of each queue (must be a power
+// of two). Frames enqueued while the ring is full go to an overflow list.
+#ifndef MQUEUE_RING_SIZE
+#define MQUEUE_RING_SIZE 256
+#endif
+
+// This data type represents a queue of encoded Frames waiting to
+// be delivered to a receiver. The queue owns one reference to each
+// Frame it holds, which passes to whoever dequeues it.
+//
+// Building with MQUEUE_LOCKFREE defined replaces the mutex-protected
+// vector with a bounded lock-free multi-producer/single-consumer ring,
+// so concurrent broadcasts enqueue without taking the queue's lock.
+// Only one thread may dequeue from a given queue.
+//
+// A queue may be given a limit on the frames it holds, with a policy
+// for what happens to a frame enqueued when it is full.
 class MessageQueue {
 public:
+  // Callback invoked after a message is enqueued, used by event loops
+  // to learn that a receiver has messages waiting
+  typedef void (*NotifyFn)(void *arg);
+
+  // What to do with a frame enqueued while the queue is at its limit
+  enum Policy {
+    DROP_OLDEST, // make room by dropping the oldest frame queued (with
+                 // MQUEUE_LOCKFREE, only the consumer may remove frames,
+                 // so this drops the new frame like DROP_NEWEST)
+    DROP_NEWEST, // drop the frame being enqueued
+    DISCONNECT,  // drop it and every later frame, and mark the queue
+                 // overrun so the receiver gets disconnected
+  };
+
   MessageQueue();
   ~MessageQueue();
 
-  void enqueue(Message *msg); // will not block
-  Message *dequeue();         // blocks for at most a finite amount of time
+  // Limit the queue to limit frames (0 for no limit). Must be called
+  // before the queue is visible to other threads.
+  void set_limit(size_t limit, Policy policy);
+
+  void enqueue(Frame *frame);          // will not block, may drop the frame when full
+  Frame *dequeue(int watch_fd = -1);   // sleeps until a frame or watch_fd readable
+  Frame *try_dequeue();                // never blocks, returns nullptr if empty
+  size_t dequeue_all(std::vector<Frame *> &frames); // never blocks
+
+  void set_notify(NotifyFn fn, void *arg);
+
+  // true once a DISCONNECT queue has overflowed
+  bool is_overrun() const { return m_overrun.load(std::memory_order_acquire); }
+
+  // number of frames dropped because the queue was full
+  size_t get_drops() const { return m_drops.load(std::memory_order_relaxed); }
+
+  // number of frames waiting for the consumer (may be stale by the
+  // time it is used, unless called by the consumer)
+  size_t get_depth() const { return m_count.load(std::memory_order_relaxed); }
 
 private:
   // value semantics prohibited
   MessageQueue(const MessageQueue &);
   MessageQueue &operator=(const MessageQueue &);
 
-  // these data members are sufficient to implement the
-  // enqueue and dequeue operations: the idea is that the semaphore
-  // keeps a count of how many messages are currently in the queue
+  // outcome of push for a queue with a limit
+  enum PushResult {
+    PUSHED,   // the frame was added
+    REPLACED, // the frame was added and the oldest one dropped
+    DROPPED,  // the frame was not added
+  };
+
+  PushResult push(Frame *frame);
+  Frame *pop();
+  Frame *pop_front();
+  void pop_batch(size_t count, std::vector<Frame *> &frames);
+  bool wait(int watch_fd);
+  void signal();
+
+  pthread_mutex_t m_lock; // must be held while accessing m_frames
+  // pending frames are m_frames[m_head..]; the vector keeps its
+  // capacity, so a queue that is drained regularly stops allocating.
+  // With MQUEUE_LOCKFREE these only hold frames that overflowed the ring.
+  std::vector<Frame *> m_frames;
+  size_t m_head;
+
+  // number of frames enqueued and not yet dequeued
+  std::atomic<size_t> m_count;
+  // the consumer is (about to be) asleep in poll on m_efd, so
+  // producers must write to m_efd to wake it
+  std::atomic<bool> m_waiting;
+  int m_efd; // eventfd, created the first time the consumer sleeps
+
+  size_t m_limit; // 0 for no limit
+  Policy m_policy;
+  std::atomic<bool> m_overrun;
+  std::atomic<size_t> m_drops;
+
+#ifdef MQUEUE_LOCKFREE
+  // one slot of the ring: seq tells producers and the consumer whose
+  // turn the slot is (see push and pop)
+  struct Slot {
+    std::atomic<size_t> seq;
+    Frame *frame;
+  };
+
+  bool push_ring(Frame *frame);
+  Frame *pop_ring();
+
+  Slot *m_ring;
+  std::atomic<size_t> m_enqueue_pos; // next slot a producer claims
+  size_t m_dequeue_pos;              // next slot the consumer reads
+  std::atomic<bool> m_overflowed;    // m_frames is non-empty
+#endif
 
-  pthread_mutex_t m_lock; // must be held while accessing queue
-  sem_t m_avail;
-  std::deque<Message *> m_messages;
+  NotifyFn m_notify;
+  void *m_notify_arg;
 };
 
 #endif // MESSAGE_QUEUE_H
@@ -0,0 +1,265 @@
+/*
+ * Implementation of functions for counting what the server does, for the admin port.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <pthread.h>
+#include "guard.h"
+#include "metrics.h"
+
+const uint64_t LATENCY_BOUNDS_NS[NUM_LATENCY_BOUNDS] = {
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+  100000000, 250000000, 500000000, 1000000000, 2500000000ull, 5000000000ull
+};
+
+const size_t FANOUT_SIZE_BOUNDS[NUM_FANOUT_SIZE_BOUNDS] = {
+  10, 100, 1000, 10000, 100000
+};
+
+namespace {
+
+// A count only ever changed by one thread. It is atomic so other
+// threads can read it meanwhile, but it is changed with a plain load
+// and store rather than a locked read-modify-write.
+struct OwnedCounter {
+  std::atomic<uint64_t> value;
+
+  OwnedCounter() : value(0) { }
+
+  void add(uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Everything one thread has counted.
+struct ThreadMetrics {
+  OwnedCounter counters[NUM_COUNTERS];
+  OwnedCounter latency_buckets[NUM_LATENCIES][NUM_LATENCY_BOUNDS + 1];
+  OwnedCounter latency_sum_ns[NUM_LATENCIES];
+
+  // Messages per room. Only the owning thread adds rooms, but a scrape
+  // iterates the map, so adding one (not counting) takes rooms_lock.
+  pthread_mutex_t rooms_lock;
+  std::unordered_map<const Room *, OwnedCounter> room_messages;
+
+  // the room counted last and its count, since a sender usually
+  // sends many messages to one room
+  const Room *last_room;
+  OwnedCounter *last_room_count;
+
+  ThreadMetrics() : last_room(nullptr), last_room_count(nullptr) {
+    pthread_mutex_init(&rooms_lock, NULL);
+  }
+  ~ThreadMetrics() {
+    pthread_mutex_destroy(&rooms_lock);
+  }
+};
+
+// The ThreadMetrics of every live thread, and the sum of those of the
+// threads that have exited. Never freed, as threads may still exit
+// while the process does.
+struct Registry {
+  pthread_mutex_t lock;
+  std::vector<ThreadMetrics *> live;
+  ThreadMetrics retired;
+
+  Registry() { pthread_mutex_init(&lock, NULL); }
+};
+
+Registry *registry() {
+  static Registry *reg = new Registry;
+  return reg;
+}
+
+/*
+ * Adds everything one thread counted to another thread's counts.
+ *
+ * Parameters:
+ *   from - reference to the ThreadMetrics to add
+ *   to - reference to the ThreadMetrics to add them to (whose owner
+ *        must not be counting meanwhile)
+ */
+void fold(ThreadMetrics &from, ThreadMetrics &to) {
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    to.counters[i].add(from.counters[i].get());
+  }
+  for (int l = 0; l < NUM_LATENCIES; l++) {
+    for (int b = 0; b <= NUM_LATENCY_BOUNDS; b++) {
+      to.latency_buckets[l][b].add(from.latency_buckets[l][b].get());
+    }
+    to.latency_sum_ns[l].add(from.latency_sum_ns[l].get());
+  }
+  Guard guard(to.rooms_lock);
+  for (std::unordered_map<const Room *, OwnedCounter>::iterator i = from.room_messages.begin();
+       i != from.room_messages.end(); ++i) {
+    to.room_messages[i->first].add(i->second.get());
+  }
+}
+
+// Owns a thread's ThreadMetrics, and hands its counts over to the
+// registry's retired counts when the thread exits.
+struct ThreadSlot {
+  ThreadMetrics *metrics;
+
+  ThreadSlot() : metrics(nullptr) { }
+
+  ~ThreadSlot() {
+    if (metrics == nullptr) {
+      return;
+    }
+    Registry *reg = registry();
+    {
+      Guard guard(reg->lock);
+      fold(*metrics, reg->retired);
+      for (size_t i = 0; i < reg->live.size(); i++) {
+        if (reg->live[i] == metrics) {
+          reg->live[i] = reg->live.back();
+          reg->live.pop_back();
+          break;
+        }
+      }
+    }
+    delete metrics;
+  }
+};
+
+thread_local ThreadSlot t_slot;
+
+/*
+ * Finds this thread's ThreadMetrics, creating it the first time.
+ *
+ * Returns:
+ *   a reference to this thread's ThreadMetrics
+ */
+ThreadMetrics &this_thread() {
+  if (t_slot.metrics == nullptr) {
+    ThreadMetrics *metrics = new ThreadMetrics;
+    Registry *reg = registry();
+    Guard guard(reg->lock);
+    reg->live.push_back(metrics);
+    t_slot.metrics = metrics;
+  }
+  return *t_slot.metrics;
+}
+
+}
+
+/*
+ * Constructor for MetricsTotals object.
+ *
+ * Returns:
+ *   totals with every count zero
+ */
+MetricsTotals::MetricsTotals() {
+  memset(counters, 0, sizeof(counters));
+  memset(latency_buckets, 0, sizeof(latency_buckets));
+  memset(latency_sum_ns, 0, sizeof(latency_sum_ns));
+}
+
+/*
+ * Returns the current time in nanoseconds from a monotonic clock.
+ */
+uint64_t metrics_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Function to count events on this thread.
+ *
+ * Parameters:
+ *   counter - the kind of event
+ *   n - the number of events
+ */
+void metrics_count(Counter counter, uint64_t n) {
+  this_thread().counters[counter].add(n);
+}
+
+/*
+ * Function to count a latency on this thread.
+ *
+ * Parameters:
+ *   latency - what took this long
+ *   ns - how long it took, in nanoseconds
+ */
+void metrics_observe(Latency latency, uint64_t ns) {
+  ThreadMetrics &metrics = this_thread();
+  int b = 0;
+  while (b < NUM_LATENCY_BOUNDS && ns > LATENCY_BOUNDS_NS[b]) {
+    b++;
+  }
+  metrics.latency_buckets[latency][b].add(1);
+  metrics.latency_sum_ns[latency].add(ns);
+}
+
+/*
+ * Function to find the fan-out latency of a room's size.
+ *
+ * Parameters:
+ *   members - the number of members the broadcast went to
+ *
+ * Returns:
+ *   the latency counting broadcasts to rooms of that size
+ */
+Latency fanout_latency(size_t members) {
+  int s = 0;
+  while (s < NUM_FANOUT_SIZE_BOUNDS && members > FANOUT_SIZE_BOUNDS[s]) {
+    s++;
+  }
+  return static_cast<Latency>(FANOUT_LATENCY + s);
+}
+
+/*
+ * Function to count a message broadcast to a room on this thread.
+ *
+ * Parameters:
+ *   room - pointer to the Room
+ */
+void metrics_count_room_message(const Room *room) {
+  ThreadMetrics &metrics = this_thread();
+  if (room != metrics.last_room) {
+    Guard guard(metrics.rooms_lock);
+    metrics.last_room_count = &metrics.room_messages[room];
+    metrics.last_room = room;
+  }
+  metrics.last_room_count->add(1);
+}
+
+/*
+ * Function to add up what every thread has counted.
+ *
+ * Parameters:
+ *   totals - reference to the MetricsTotals to add the counts to
+ */
+void metrics_collect(MetricsTotals &totals) {
+  Registry *reg = registry();
+  Guard guard(reg->lock);
+  for (size_t t = 0; t <= reg->live.size(); t++) {
+    ThreadMetrics &metrics = (t < reg->live.size()) ? *reg->live[t] : reg->retired;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+      totals.counters[i] += metrics.counters[i].get();
+    }
+    for (int l = 0; l < NUM_LATENCIES; l++) {
+      for (int b = 0; b <= NUM_LATENCY_BOUNDS; b++) {
+        totals.latency_buckets[l][b] += metrics.latency_buckets[l][b].get();
+      }
+      totals.latency_sum_ns[l] += metrics.latency_sum_ns[l].get();
+    }
+    Guard rooms_guard(metrics.rooms_lock);
+    for (std::unordered_map<const Room *, OwnedCounter>::iterator i = metrics.room_messages.begin();
+         i != metrics.room_messages.end(); ++i) {
+      totals.room_messages[i->first] += i->second.get();
+    }
+  }
+}
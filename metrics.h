@@ -0,0 +1,89 @@
+/*
+ * Functions for counting what the server does, for the admin port.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+class Room;
+
+// Every thread counts into its own ThreadMetrics, created the first
+// time it counts anything, so counting never writes memory another
+// thread writes: a counter is bumped with a plain load and store, and
+// the only atomics are there so a scrape can read them meanwhile.
+// Scrapes add up the counts of every thread, including those of
+// threads that have exited.
+
+enum Counter {
+  CONNECTIONS_OPENED, // sessions started
+  CONNECTIONS_CLOSED, // sessions ended
+  MESSAGES_RECEIVED,  // valid messages received from clients
+  DELIVERIES_QUEUED,  // deliveries handed to receivers' queues (some may be dropped)
+  DELIVERIES_SENT,    // deliveries written to receivers
+  DELIVERIES_DROPPED, // deliveries dropped by full receiver queues
+  LOG_RECORDS,        // broadcasts appended to room logs
+  LOG_BYTES_WRITTEN,  // bytes written to room logs
+  LOG_SYNCS,          // room logs synced to disk
+  NUM_COUNTERS
+};
+
+// upper bounds of the room sizes (in members) fan-out latency is
+// counted by; one more size counts every larger room
+const int NUM_FANOUT_SIZE_BOUNDS = 5;
+extern const size_t FANOUT_SIZE_BOUNDS[NUM_FANOUT_SIZE_BOUNDS];
+
+enum Latency {
+  REQUEST_LATENCY,  // handling one message received from a client
+  DELIVERY_LATENCY, // from a broadcast to its delivery being written
+  LOG_SYNC_LATENCY, // syncing one room log to disk
+  FANOUT_LATENCY,   // from a broadcast to its last delivery being queued, in
+                    // rooms of up to FANOUT_SIZE_BOUNDS[0] members; each one
+                    // after it is for rooms up to the next bound (see fanout_latency)
+  NUM_LATENCIES = FANOUT_LATENCY + NUM_FANOUT_SIZE_BOUNDS + 1
+};
+
+// upper bounds of the latency histogram buckets, in nanoseconds,
+// from 1us to 5s; one more bucket counts everything slower
+const int NUM_LATENCY_BOUNDS = 21;
+extern const uint64_t LATENCY_BOUNDS_NS[NUM_LATENCY_BOUNDS];
+
+// The counts of every thread added up, as taken by metrics_collect.
+struct MetricsTotals {
+  uint64_t counters[NUM_COUNTERS];
+  // per latency: the count of each bucket (the last one counting
+  // values above every bound), and the sum of all values in ns
+  uint64_t latency_buckets[NUM_LATENCIES][NUM_LATENCY_BOUNDS + 1];
+  uint64_t latency_sum_ns[NUM_LATENCIES];
+  std::unordered_map<const Room *, uint64_t> room_messages;
+
+  MetricsTotals();
+};
+
+// Current time in nanoseconds from a monotonic clock.
+uint64_t metrics_now_ns();
+
+// Count n events of the given kind on this thread.
+void metrics_count(Counter counter, uint64_t n = 1);
+
+// Count one latency, in nanoseconds, on this thread.
+void metrics_observe(Latency latency, uint64_t ns);
+
+// The fan-out latency counting broadcasts to a room of this many members.
+Latency fanout_latency(size_t members);
+
+// Count one message broadcast to a room on this thread.
+void metrics_count_room_message(const Room *room);
+
+// Add up the counts of every thread.
+void metrics_collect(MetricsTotals &totals);
+
+#endif // METRICS_H
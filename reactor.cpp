@@ -0,0 +1,1379 @@
+/*
+ * Implementation of class describing an event-driven connection handler.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include "message.h"
+#include "framing.h"
+#include "frame.h"
+#include "message_queue.h"
+#include "connection.h"
+#include "user.h"
+#include "session.h"
+#include "guard.h"
+#include "metrics.h"
+#include "server.h"
+#include "uring.h"
+#include "reactor.h"
+
+namespace {
+
+// stop pulling deliveries off a receiver's queue while this much
+// output is already waiting for the socket to become writable
+const size_t OUT_HIGH_WATER = 64 * 1024;
+
+// number of epoll events handled per epoll_wait call
+const int MAX_EVENTS = 128;
+
+// most frames handed to a single writev or sendmsg call
+const int MAX_IOV = 64;
+
+// io_uring: submission queue entries per loop
+const unsigned URING_ENTRIES = 1024;
+
+// io_uring: buffers registered per loop for receives to pick from, so
+// only sockets with data waiting hold one; what a receive puts in one
+// is then copied to the connection's ReadBuffer
+const unsigned URING_BUFFERS = 256;
+
+// io_uring: size of each of those buffers, the most a single receive
+// can return
+const size_t URING_BUFFER_SIZE = 4096;
+
+// io_uring: most linked sendmsgs writing one batch of output
+const int MAX_LINKED_SENDS = 8;
+
+// io_uring: accepts kept in flight on each listening socket
+const int ACCEPT_DEPTH = 16;
+
+// io_uring: what a completion is for, in the low bits of its user
+// data (the rest is the LoopConn, or null for the wakeup eventfd and
+// the loop's listening socket)
+const uint64_t OP_RECV = 1;
+const uint64_t OP_SEND = 2;
+const uint64_t OP_ACCEPT = 3;
+const uint64_t OP_MASK = 3;
+
+/*
+ * Lists the CPUs this process may run on.
+ *
+ * Returns:
+ *   the CPU numbers, in order (empty if they could not be found)
+ */
+std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// Event loop data types
+////////////////////////////////////////////////////////////////////////
+
+// A frame waiting to be written, in the framing that was in use
+// when it was queued (the login reply goes out as text even though
+// the connection may switch to binary right after it)
+struct OutFrame {
+  Frame *frame;
+  Framing framing;
+
+  const char *data() const { return frame->data(framing); }
+  size_t size() const { return frame->size(framing); }
+};
+
+// State for one client socket owned by an event loop
+struct LoopConn {
+  EventLoop *loop;
+  uint64_t id;
+  int fd;
+  Session *session;
+  Framing framing;
+  ReadBuffer in;              // bytes read but not yet decoded
+  std::deque<OutFrame> out;   // frames waiting to be written (one reference each)
+  size_t out_off;           // how much of the first frame has been written
+  size_t out_bytes;         // total unwritten bytes in out
+  bool want_write;  // EPOLLOUT is registered
+  bool closing;     // close as soon as out has been flushed
+  std::atomic<bool> wake_pending; // id is already on the loop's ready list
+  // false while a receiver's User may still be queued to (and notify
+  // this connection), which can be after its session is gone
+  std::atomic<bool> user_freed;
+
+  // io_uring only: operations submitted for this connection and not yet
+  // completed (it is freed only once there are none), and the batch of
+  // linked sendmsgs in flight with the headers and iovecs they point to
+  int ops_in_flight;
+  int sends_in_flight;
+  bool send_failed;
+  std::vector<struct msghdr> send_msgs;
+  std::vector<struct iovec> send_iov;
+
+  LoopConn(EventLoop *loop, uint64_t id, int fd, Server *server)
+    : loop(loop), id(id), fd(fd), session(new Session(server)), framing(FRAMING_TEXT)
+    , out_off(0), out_bytes(0), want_write(false), closing(false), wake_pending(false)
+    , user_freed(true)
+    , ops_in_flight(0), sends_in_flight(0), send_failed(false) { }
+
+  ~LoopConn() {
+    for (size_t i = 0; i < out.size(); i++) {
+      out[i].frame->unref();
+    }
+  }
+
+  // queue a frame for writing, taking over the caller's reference
+  void push_out(Frame *frame) {
+    OutFrame item = { frame, framing };
+    out.push_back(item);
+    out_bytes += item.size();
+  }
+};
+
+// One event loop thread and the connections it owns. Other threads only
+// interact with a loop through add_client and wake, which hand work over
+// under m_lock and signal the loop's eventfd.
+//
+// A loop waits for its sockets either with epoll, reading and writing
+// once they are ready, or with io_uring, keeping a receive in flight on
+// every socket and sending each batch of output as linked sendmsgs, so
+// that one io_uring_enter call submits the I/O of every connection that
+// had work and collects the results. Everything between the I/O and the
+// Session is the same for both.
+//
+// A loop given a listening socket of its own accepts its clients itself,
+// so with one SO_REUSEPORT socket per loop, the kernel spreads new
+// connections over the loops and no thread hands them over.
+class EventLoop {
+public:
+  EventLoop(Server *server, bool use_uring);
+  ~EventLoop();
+
+  void set_listener(int listen_fd, int cpu);
+  bool start();
+  void stop();
+  void wait();
+
+  void add_client(int fd);
+  void wake(LoopConn *conn);
+
+private:
+  // prohibit value semantics
+  EventLoop(const EventLoop &);
+  EventLoop &operator=(const EventLoop &);
+
+  static void *run_thread(void *arg);
+  static void on_notify(void *arg);
+  static void on_user_released(void *arg);
+
+  void run();
+  void run_uring();
+  void signal_wakefd();
+  void handle_wakeup();
+  void handle_acceptable();
+  bool queue_accept();
+  void open_conn(int fd);
+  bool start_conn(LoopConn *conn);
+  void handle_readable(LoopConn *conn);
+  void handle_received(LoopConn *conn, int res, uint32_t flags);
+  void handle_sent(LoopConn *conn, int res);
+  void handle_input(LoopConn *conn, bool eof);
+  void handle_writable(LoopConn *conn);
+  void process_line(LoopConn *conn, std::string_view line, const LineScan &scan);
+  void process_frame(LoopConn *conn, std::string_view body);
+  void process_message(LoopConn *conn, const Message &msg);
+  void process_error(LoopConn *conn, Connection::Result result);
+  void queue_reply(LoopConn *conn, Message &reply);
+  void drain_deliveries(LoopConn *conn);
+  void flush(LoopConn *conn);
+  void send_out(LoopConn *conn);
+  void release_written(LoopConn *conn, size_t n);
+  void update_interest(LoopConn *conn);
+  void close_conn(LoopConn *conn);
+  void free_closed();
+
+  Server *m_server;
+  Uring *m_ring; // null when using epoll
+  int m_epfd;
+  int m_wakefd;
+  uint64_t m_wake_count; // io_uring reads the eventfd into this
+  int m_listen_fd; // -1 unless the loop accepts its own clients
+  int m_cpu;       // CPU the thread is pinned to, or -1
+  pthread_t m_thread;
+  bool m_started;
+
+  pthread_mutex_t m_lock; // protects everything below that other threads touch
+  std::vector<int> m_new_fds;
+  std::vector<uint64_t> m_ready;
+  bool m_signaled;
+  bool m_stopping;
+
+  // only touched by the loop thread
+  std::unordered_map<uint64_t, LoopConn *> m_conns;
+  std::vector<LoopConn *> m_closed; // freed once no event or completion can refer to them
+  uint64_t m_next_id;
+  Message m_msg;   // reused for every line, so its storage is too
+  Message m_reply;
+};
+
+////////////////////////////////////////////////////////////////////////
+// EventLoop implementation
+////////////////////////////////////////////////////////////////////////
+
+/*
+ * Non-Default constructor for EventLoop object.
+ *
+ * Parameters:
+ *   server - pointer to the Server the loop's clients are connected to
+ *   use_uring - true to do I/O with io_uring rather than epoll
+ *
+ * Returns:
+ *   a new EventLoop with its epoll instance or io_uring, and wakeup
+ *   eventfd, created
+ */
+EventLoop::EventLoop(Server *server, bool use_uring)
+  : m_server(server)
+  , m_ring(nullptr)
+  , m_epfd(-1)
+  , m_wakefd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  , m_wake_count(0)
+  , m_listen_fd(-1)
+  , m_cpu(-1)
+  , m_started(false)
+  , m_signaled(false)
+  , m_stopping(false)
+  , m_next_id(1) {
+  pthread_mutex_init(&m_lock, NULL);
+  if (use_uring) {
+    m_ring = new Uring;
+    if (!m_ring->init(URING_ENTRIES) || !m_ring->init_buffers(URING_BUFFERS, URING_BUFFER_SIZE)) {
+      delete m_ring;
+      m_ring = nullptr; // start fails
+    }
+    return;
+  }
+  m_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epfd >= 0 && m_wakefd >= 0) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // the wakeup fd is the only one without a LoopConn
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &ev);
+  }
+}
+
+/*
+ * Destructor for an EventLoop object.
+ * Stops the loop thread and closes every connection it owned.
+ */
+EventLoop::~EventLoop() {
+  stop();
+  while (!m_conns.empty()) {
+    close_conn(m_conns.begin()->second);
+  }
+  // closing the ring cancels whatever is in flight, so every
+  // connection can be freed
+  delete m_ring;
+  m_ring = nullptr;
+  free_closed();
+  // the users of the rest are freed once broadcasts still under way
+  // to them are done, each signalling the wakeup fd
+  while (!m_closed.empty()) {
+    struct pollfd pfd = { m_wakefd, POLLIN, 0 };
+    poll(&pfd, 1, -1);
+    ssize_t ignored = read(m_wakefd, &m_wake_count, sizeof(m_wake_count));
+    (void) ignored;
+    free_closed();
+  }
+  {
+    // wait for on_user_released to be done with the loop
+    Guard guard(m_lock);
+  }
+  for (size_t i = 0; i < m_new_fds.size(); i++) {
+    ::close(m_new_fds[i]);
+  }
+  if (m_epfd >= 0) {
+    ::close(m_epfd);
+  }
+  if (m_wakefd >= 0) {
+    ::close(m_wakefd);
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+/*
+ * Gives the loop a listening socket to accept clients on itself, and a
+ * CPU to run on. Must be called before start.
+ *
+ * Parameters:
+ *   listen_fd - the listening socket, which the loop makes non-blocking
+ *   cpu - the CPU to pin the loop thread to, or -1 for none
+ */
+void EventLoop::set_listener(int listen_fd, int cpu) {
+  m_listen_fd = listen_fd;
+  m_cpu = cpu;
+  int flags = fcntl(listen_fd, F_GETFL, 0);
+  fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+  if (m_epfd >= 0) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &m_listen_fd; // tells it apart from the LoopConns
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+  }
+}
+
+/*
+ * Starts the loop thread.
+ *
+ * Returns:
+ *   true if the thread was created
+ */
+bool EventLoop::start() {
+  if ((m_epfd < 0 && m_ring == nullptr) || m_wakefd < 0) {
+    return false;
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (m_cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(m_cpu, &set);
+    pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+  }
+  int rc = pthread_create(&m_thread, &attr, run_thread, this);
+  pthread_attr_destroy(&attr);
+  if (rc != 0) {
+    return false;
+  }
+  m_started = true;
+  return true;
+}
+
+/*
+ * Asks the loop thread to exit and waits for it.
+ */
+void EventLoop::stop() {
+  if (!m_started) {
+    return;
+  }
+  {
+    Guard guard(m_lock);
+    m_stopping = true;
+  }
+  signal_wakefd();
+  wait();
+}
+
+/*
+ * Waits for the loop thread to exit, which it only does when asked to
+ * or if waiting for events fails.
+ */
+void EventLoop::wait() {
+  if (!m_started) {
+    return;
+  }
+  pthread_join(m_thread, NULL);
+  m_started = false;
+}
+
+/*
+ * Hands a newly accepted client socket to this loop. Safe to call
+ * from any thread.
+ *
+ * Parameters:
+ *   fd - file descriptor of the accepted (non-blocking) socket
+ */
+void EventLoop::add_client(int fd) {
+  bool signal;
+  {
+    Guard guard(m_lock);
+    m_new_fds.push_back(fd);
+    signal = !m_signaled;
+    m_signaled = true;
+  }
+  if (signal) {
+    signal_wakefd();
+  }
+}
+
+/*
+ * Marks a connection as having deliveries waiting. Safe to call from
+ * any thread while the connection's user is a member of a room.
+ *
+ * Parameters:
+ *   conn - pointer to the LoopConn whose queue is non-empty
+ */
+void EventLoop::wake(LoopConn *conn) {
+  // only the first wakeup after the loop has drained the queue does any work
+  if (conn->wake_pending.exchange(true)) {
+    return;
+  }
+  bool signal;
+  {
+    Guard guard(m_lock);
+    m_ready.push_back(conn->id);
+    signal = !m_signaled;
+    m_signaled = true;
+  }
+  if (signal) {
+    signal_wakefd();
+  }
+}
+
+/*
+ * Thread entry point for the loop.
+ *
+ * Parameters:
+ *   arg - pointer to the EventLoop to run
+ */
+void *EventLoop::run_thread(void *arg) {
+  static_cast<EventLoop *>(arg)->run();
+  return nullptr;
+}
+
+/*
+ * MessageQueue notify callback for receivers owned by a loop.
+ *
+ * Parameters:
+ *   arg - pointer to the receiver's LoopConn
+ */
+void EventLoop::on_notify(void *arg) {
+  LoopConn *conn = static_cast<LoopConn *>(arg);
+  conn->loop->wake(conn);
+}
+
+/*
+ * User released callback for receivers owned by a loop: the
+ * connection can be freed now that nothing can notify it.
+ *
+ * Parameters:
+ *   arg - pointer to the receiver's LoopConn
+ */
+void EventLoop::on_user_released(void *arg) {
+  LoopConn *conn = static_cast<LoopConn *>(arg);
+  EventLoop *loop = conn->loop;
+  // the loop may free the connection as soon as user_freed is set, and
+  // is only destroyed once it has, after taking m_lock
+  Guard guard(loop->m_lock);
+  conn->user_freed.store(true, std::memory_order_release);
+  loop->signal_wakefd();
+}
+
+/*
+ * Main loop: waits for socket readiness or wakeups and dispatches them.
+ */
+void EventLoop::run() {
+  if (m_ring != nullptr) {
+    run_uring();
+    return;
+  }
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    int n = epoll_wait(m_epfd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "epoll_wait failed" << std::endl;
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &m_listen_fd) {
+        handle_acceptable();
+        continue;
+      }
+      LoopConn *conn = static_cast<LoopConn *>(events[i].data.ptr);
+      if (conn == nullptr) {
+        ssize_t ignored = read(m_wakefd, &m_wake_count, sizeof(m_wake_count));
+        (void) ignored;
+        handle_wakeup();
+        Guard guard(m_lock);
+        if (m_stopping) {
+          return;
+        }
+        continue;
+      }
+      // skip connections closed earlier in this batch
+      if (conn->session == nullptr) {
+        continue;
+      }
+      uint32_t ev = events[i].events;
+      if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        handle_readable(conn);
+      }
+      if ((ev & EPOLLOUT) && conn->session != nullptr) {
+        handle_writable(conn);
+      }
+    }
+    free_closed();
+  }
+}
+
+/*
+ * Main loop with io_uring: submits everything queued while handling the
+ * last batch of completions, and waits for the next batch.
+ */
+void EventLoop::run_uring() {
+  if (!m_ring->enable() || !m_ring->read(m_wakefd, &m_wake_count, sizeof(m_wake_count), 0)) {
+    std::cerr << "io_uring submission failed" << std::endl;
+    return;
+  }
+  for (int i = 0; m_listen_fd >= 0 && i < ACCEPT_DEPTH; i++) {
+    if (!queue_accept()) {
+      std::cerr << "io_uring submission failed" << std::endl;
+      return;
+    }
+  }
+  while (1) {
+    int ret = m_ring->submit(1);
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+      std::cerr << "io_uring_enter failed" << std::endl;
+      return;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = m_ring->peek_cqe()) != nullptr) {
+      uint64_t data = cqe->user_data;
+      int res = cqe->res;
+      uint32_t flags = cqe->flags;
+      m_ring->cqe_seen();
+
+      LoopConn *conn = reinterpret_cast<LoopConn *>(data & ~OP_MASK);
+      if (conn == nullptr && (data & OP_MASK) == OP_ACCEPT) {
+        if (res < 0 && res != -EINTR && res != -ECONNABORTED) {
+          std::cerr << "Error accepting client connection" << std::endl;
+          continue; // this accept is not queued again
+        }
+        if (res >= 0) {
+          open_conn(res);
+        }
+        if (!queue_accept()) {
+          std::cerr << "io_uring submission failed" << std::endl;
+        }
+        continue;
+      }
+      if (conn == nullptr) {
+        handle_wakeup();
+        {
+          Guard guard(m_lock);
+          if (m_stopping) {
+            return;
+          }
+        }
+        if (!m_ring->read(m_wakefd, &m_wake_count, sizeof(m_wake_count), 0)) {
+          std::cerr << "io_uring submission failed" << std::endl;
+          return;
+        }
+        continue;
+      }
+      conn->ops_in_flight--;
+      if ((data & OP_MASK) == OP_RECV) {
+        handle_received(conn, res, flags);
+      } else {
+        handle_sent(conn, res);
+      }
+    }
+    free_closed();
+  }
+}
+
+/*
+ * Wakes the loop thread out of epoll_wait or io_uring_enter.
+ */
+void EventLoop::signal_wakefd() {
+  uint64_t one = 1;
+  ssize_t ignored = write(m_wakefd, &one, sizeof(one));
+  (void) ignored;
+}
+
+/*
+ * Takes over newly accepted sockets and connections with deliveries
+ * waiting from other threads.
+ */
+void EventLoop::handle_wakeup() {
+  std::vector<int> new_fds;
+  std::vector<uint64_t> ready;
+  {
+    Guard guard(m_lock);
+    new_fds.swap(m_new_fds);
+    ready.swap(m_ready);
+    m_signaled = false;
+  }
+
+  for (size_t i = 0; i < new_fds.size(); i++) {
+    open_conn(new_fds[i]);
+  }
+
+  for (size_t i = 0; i < ready.size(); i++) {
+    std::unordered_map<uint64_t, LoopConn *>::iterator it = m_conns.find(ready[i]);
+    if (it == m_conns.end()) {
+      continue; // closed since it was woken
+    }
+    LoopConn *conn = it->second;
+    conn->wake_pending.store(false);
+    drain_deliveries(conn);
+  }
+}
+
+/*
+ * Accepts every client waiting on the loop's listening socket (epoll).
+ */
+void EventLoop::handle_acceptable() {
+  while (1) {
+    int clientfd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (clientfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // stop accepting, as the accepting thread would
+        std::cerr << "Error accepting client connection" << std::endl;
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, m_listen_fd, NULL);
+      }
+      return;
+    }
+    open_conn(clientfd);
+  }
+}
+
+/*
+ * Queues an accept on the loop's listening socket (io_uring).
+ *
+ * Returns:
+ *   true if it was queued
+ */
+bool EventLoop::queue_accept() {
+  return m_ring->accept(m_listen_fd, SOCK_NONBLOCK, OP_ACCEPT);
+}
+
+/*
+ * Takes over a newly accepted (non-blocking) client socket.
+ *
+ * Parameters:
+ *   fd - the client's socket
+ */
+void EventLoop::open_conn(int fd) {
+  // replies and deliveries are written in whole batches already
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  LoopConn *conn = new LoopConn(this, m_next_id++, fd, m_server);
+  if (!start_conn(conn)) {
+    ::close(conn->fd);
+    delete conn->session;
+    delete conn;
+    return;
+  }
+  m_conns[conn->id] = conn;
+}
+
+/*
+ * Starts waiting for input on a newly accepted connection.
+ *
+ * Parameters:
+ *   conn - pointer to the new connection
+ *
+ * Returns:
+ *   true if it is being waited on
+ */
+bool EventLoop::start_conn(LoopConn *conn) {
+  if (m_ring != nullptr) {
+    if (!m_ring->recv(conn->fd, reinterpret_cast<uint64_t>(conn) | OP_RECV)) {
+      return false;
+    }
+    conn->ops_in_flight++;
+    return true;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = conn;
+  return epoll_ctl(m_epfd, EPOLL_CTL_ADD, conn->fd, &ev) == 0;
+}
+
+/*
+ * Reads whatever the socket has available and processes it.
+ *
+ * Parameters:
+ *   conn - pointer to the readable connection
+ */
+void EventLoop::handle_readable(LoopConn *conn) {
+  if (conn->closing) {
+    return;
+  }
+
+  // read straight into the connection's buffer, as much as it has
+  // room for; it grows while reads keep filling it
+  ssize_t n = conn->in.fill(conn->fd);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    }
+    close_conn(conn);
+    return;
+  }
+  handle_input(conn, n == 0);
+}
+
+/*
+ * io_uring: processes what a receive put in a provided buffer, hands
+ * the buffer back and starts the next receive.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   res - the receive's result: bytes received, 0 at EOF, or -errno
+ *   flags - the completion's flags, which say which buffer was used
+ */
+void EventLoop::handle_received(LoopConn *conn, int res, uint32_t flags) {
+  if (conn->session == nullptr || conn->closing) {
+    // a closing connection ignores input, like with epoll
+    m_ring->recycle_buffer(flags);
+    return;
+  }
+  if (res >= 0) {
+    conn->in.append(m_ring->get_buffer(flags), res);
+    m_ring->recycle_buffer(flags);
+    handle_input(conn, res == 0);
+    if (conn->session == nullptr || conn->closing) {
+      return;
+    }
+  } else if (res != -ENOBUFS && res != -EINTR && res != -EAGAIN) {
+    close_conn(conn);
+    return;
+  }
+  // on ENOBUFS every buffer was taken, but they have been handed back
+  // by the time this receive is submitted
+  if (!m_ring->recv(conn->fd, reinterpret_cast<uint64_t>(conn) | OP_RECV)) {
+    close_conn(conn);
+    return;
+  }
+  conn->ops_in_flight++;
+}
+
+/*
+ * io_uring: accounts for one completed sendmsg of a batch, and once the
+ * whole batch is done, sends what is left.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   res - the sendmsg's result: bytes sent, or -errno
+ */
+void EventLoop::handle_sent(LoopConn *conn, int res) {
+  conn->sends_in_flight--;
+  if (res < 0) {
+    // the sends linked after a failed or short one are cancelled
+    if (res != -ECANCELED) {
+      conn->send_failed = true;
+    }
+  } else if (conn->session != nullptr) {
+    release_written(conn, res);
+  }
+  if (conn->sends_in_flight > 0 || conn->session == nullptr) {
+    return;
+  }
+  if (conn->send_failed) {
+    close_conn(conn);
+    return;
+  }
+  handle_writable(conn);
+}
+
+/*
+ * Processes every complete line or frame in the connection's buffer
+ * once more input has arrived, then flushes all the replies at once.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   eof - true if the client closed its side instead
+ */
+void EventLoop::handle_input(LoopConn *conn, bool eof) {
+  if (eof) {
+    // EOF: a trailing partial line is invalid, otherwise the client is gone
+    process_error(conn, conn->in.empty() ? Connection::EOF_OR_ERROR : Connection::INVALID_MSG);
+    if (conn->session != nullptr && !conn->closing) {
+      // the session chose to carry on, but there is nothing more to read
+      conn->closing = true;
+      flush(conn);
+    }
+    return;
+  }
+
+  size_t start = 0;
+  while (!conn->closing) {
+    size_t avail = conn->in.size() - start;
+    if (conn->framing == FRAMING_BINARY) {
+      if (avail < BIN_HEADER_LEN) {
+        break;
+      }
+      uint32_t len = decode_bin_length(conn->in.data() + start);
+      if (len == 0 || len - 1 > m_server->get_options().max_payload) {
+        // the rest of the stream can't be trusted to be frames
+        process_error(conn, Connection::INVALID_MSG);
+        if (conn->session != nullptr && !conn->closing) {
+          conn->closing = true;
+          flush(conn);
+        }
+        return;
+      }
+      size_t frame_len = BIN_HEADER_LEN - 1 + len;
+      if (avail < frame_len) {
+        break;
+      }
+      process_frame(conn, std::string_view(conn->in.data() + start + BIN_HEADER_LEN - 1, len));
+      start += frame_len;
+    } else {
+      LineScan scan;
+      std::string_view line;
+      if (scan_line(conn->in.data() + start, avail < MAX_TEXT_LINE ? avail : MAX_TEXT_LINE, scan)) {
+        line = std::string_view(conn->in.data() + start, scan.end);
+        start += scan.end;
+      } else if (avail >= MAX_TEXT_LINE) {
+        // overlong line: hand on a truncated piece, which fails to decode
+        line = std::string_view(conn->in.data() + start, MAX_TEXT_LINE);
+        start += MAX_TEXT_LINE;
+      } else {
+        break;
+      }
+      process_line(conn, line, scan);
+    }
+    if (conn->session == nullptr) {
+      return; // closed while processing the message
+    }
+  }
+  conn->in.consume(start);
+  conn->in.settle();
+  // a pipelined sender gets one acknowledgement for all of it
+  if (conn->session->take_ack(m_reply)) {
+    queue_reply(conn, m_reply);
+  }
+
+  if (conn->session->get_state() == Session::RECEIVER) {
+    drain_deliveries(conn);
+  } else {
+    flush(conn);
+  }
+}
+
+/*
+ * Writes pending output and, for receivers, pulls more deliveries
+ * off the queue once there is room (after EPOLLOUT, or once a batch
+ * of sends has completed).
+ *
+ * Parameters:
+ *   conn - pointer to the writable connection
+ */
+void EventLoop::handle_writable(LoopConn *conn) {
+  if (conn->session->get_state() == Session::RECEIVER) {
+    drain_deliveries(conn);
+  } else {
+    flush(conn);
+  }
+}
+
+/*
+ * Decodes one line and lets the connection's Session process it.
+ *
+ * Parameters:
+ *   conn - pointer to the connection the line was read from
+ *   line - view of the line in the connection's input buffer,
+ *          including its newline if it had one
+ *   scan - reference to what scan_line found in the line
+ */
+void EventLoop::process_line(LoopConn *conn, std::string_view line, const LineScan &scan) {
+  if (!Connection::decode(line, scan, m_msg)) {
+    process_error(conn, Connection::INVALID_MSG);
+    return;
+  }
+  process_message(conn, m_msg);
+}
+
+/*
+ * Decodes one binary frame and lets the connection's Session process it.
+ *
+ * Parameters:
+ *   conn - pointer to the connection the frame was read from
+ *   body - view of the frame's tag id and payload in the connection's
+ *          input buffer
+ */
+void EventLoop::process_frame(LoopConn *conn, std::string_view body) {
+  if (!Connection::decode_binary(body, m_msg)) {
+    process_error(conn, Connection::INVALID_MSG);
+    return;
+  }
+  process_message(conn, m_msg);
+}
+
+/*
+ * Lets the connection's Session process one decoded message and
+ * queues its reply.
+ *
+ * Parameters:
+ *   conn - pointer to the connection the message was read from
+ *   msg - reference to the decoded message
+ */
+void EventLoop::process_message(LoopConn *conn, const Message &msg) {
+  Session::State before = conn->session->get_state();
+  Message &reply = m_reply;
+  bool keep_open = conn->session->handle(msg, reply);
+  if (before == Session::AWAIT_LOGIN && conn->session->get_state() == Session::RECEIVER_AWAIT_JOIN) {
+    // register for deliveries before the user can be added to a room,
+    // and keep the connection until the user is freed
+    User *user = conn->session->get_user();
+    conn->user_freed.store(false, std::memory_order_relaxed);
+    user->mqueue.set_notify(on_notify, conn);
+    user->set_released(on_user_released, conn);
+  }
+  queue_reply(conn, reply);
+  // binary framing starts after the reply to the login that asked for it
+  conn->framing = conn->session->get_framing();
+  if (!keep_open) {
+    conn->closing = true;
+  }
+}
+
+/*
+ * Lets the connection's Session process a failure to receive a message.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   result - the reason no message could be received
+ */
+void EventLoop::process_error(LoopConn *conn, Connection::Result result) {
+  Message reply;
+  bool keep_open = conn->session->handle_error(result, reply);
+  queue_reply(conn, reply);
+  if (!keep_open) {
+    conn->closing = true;
+    flush(conn);
+  }
+}
+
+/*
+ * Appends an encoded reply to the connection's output.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   reply - reference to the Message to send (nothing if its tag is empty)
+ */
+void EventLoop::queue_reply(LoopConn *conn, Message &reply) {
+  if (reply.tag == TAG_NONE) {
+    return;
+  }
+  conn->push_out(Frame::create(reply));
+}
+
+/*
+ * Moves deliveries from a receiver's queue to its output until the
+ * queue is empty or enough output is pending, then flushes. Repeats
+ * while the socket takes everything, since no further wakeup comes
+ * for frames that were already queued.
+ *
+ * Parameters:
+ *   conn - pointer to the receiver's connection
+ */
+void EventLoop::drain_deliveries(LoopConn *conn) {
+  if (conn->session->get_state() != Session::RECEIVER || conn->closing) {
+    flush(conn);
+    return;
+  }
+  MessageQueue &mqueue = conn->session->get_user()->mqueue;
+  if (mqueue.is_overrun()) {
+    // fell too far behind: say why after what is already pending, and disconnect
+    conn->session->handle_overrun(m_reply);
+    queue_reply(conn, m_reply);
+    conn->closing = true;
+    flush(conn);
+    return;
+  }
+  while (1) {
+    bool drained = false;
+    while (conn->out_bytes < OUT_HIGH_WATER) {
+      Frame *frame = mqueue.try_dequeue();
+      if (frame == nullptr) {
+        drained = true;
+        break;
+      }
+      // the queue's reference to the shared frame moves to the output
+      conn->push_out(frame);
+    }
+    flush(conn);
+    if (drained || conn->session == nullptr || !conn->out.empty()) {
+      return; // nothing left, closed, or handle_writable will bring us back
+    }
+  }
+}
+
+/*
+ * Writes as much pending output as the socket accepts, closing the
+ * connection on error or once a closing connection is fully flushed.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ */
+void EventLoop::flush(LoopConn *conn) {
+  if (m_ring != nullptr) {
+    send_out(conn);
+    return;
+  }
+  while (!conn->out.empty()) {
+    // gather the pending frames without copying them
+    struct iovec iov[MAX_IOV];
+    int iovcnt = 0;
+    for (size_t i = 0; i < conn->out.size() && iovcnt < MAX_IOV; i++) {
+      size_t skip = (i == 0) ? conn->out_off : 0;
+      iov[iovcnt].iov_base = const_cast<char *>(conn->out[i].data() + skip);
+      iov[iovcnt].iov_len = conn->out[i].size() - skip;
+      iovcnt++;
+    }
+
+    ssize_t n = writev(conn->fd, iov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      close_conn(conn);
+      return;
+    }
+    release_written(conn, n);
+  }
+
+  if (conn->out.empty()) {
+    if (conn->closing) {
+      close_conn(conn);
+      return;
+    }
+  }
+  update_interest(conn);
+}
+
+/*
+ * io_uring: sends pending output as a chain of linked sendmsgs, unless
+ * a batch is still in flight (handle_sent sends the rest once it is
+ * done). MSG_WAITALL makes each sendmsg complete only once all of it is
+ * written, so a chain writes its frames in order, and a send that fails
+ * cancels the rest of the chain rather than leaving a gap.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ */
+void EventLoop::send_out(LoopConn *conn) {
+  if (conn->sends_in_flight > 0) {
+    return;
+  }
+  if (conn->out.empty()) {
+    if (conn->closing) {
+      close_conn(conn);
+    }
+    return;
+  }
+
+  // gather the pending frames without copying them; the iovecs and
+  // headers stay untouched until the whole chain has completed
+  size_t frames = conn->out.size();
+  if (frames > static_cast<size_t>(MAX_IOV * MAX_LINKED_SENDS)) {
+    frames = MAX_IOV * MAX_LINKED_SENDS;
+  }
+  size_t num_msgs = (frames + MAX_IOV - 1) / MAX_IOV;
+  conn->send_iov.resize(frames);
+  conn->send_msgs.resize(num_msgs);
+  for (size_t i = 0; i < frames; i++) {
+    size_t skip = (i == 0) ? conn->out_off : 0;
+    conn->send_iov[i].iov_base = const_cast<char *>(conn->out[i].data() + skip);
+    conn->send_iov[i].iov_len = conn->out[i].size() - skip;
+  }
+  if (!m_ring->reserve(num_msgs)) {
+    close_conn(conn);
+    return;
+  }
+  for (size_t m = 0; m < num_msgs; m++) {
+    struct msghdr &msg = conn->send_msgs[m];
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &conn->send_iov[m * MAX_IOV];
+    msg.msg_iovlen = (m + 1 < num_msgs) ? MAX_IOV : frames - m * MAX_IOV;
+    m_ring->sendmsg(conn->fd, &msg, MSG_WAITALL | MSG_NOSIGNAL, m + 1 < num_msgs,
+                    reinterpret_cast<uint64_t>(conn) | OP_SEND);
+    conn->sends_in_flight++;
+    conn->ops_in_flight++;
+  }
+}
+
+/*
+ * Releases every frame that has been completely written.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ *   n - number of bytes just written from the start of its output
+ */
+void EventLoop::release_written(LoopConn *conn, size_t n) {
+  conn->out_bytes -= n;
+  uint64_t now = 0;
+  while (n > 0) {
+    OutFrame front = conn->out.front();
+    size_t left = front.size() - conn->out_off;
+    if (n < left) {
+      conn->out_off += n;
+      break;
+    }
+    n -= left;
+    conn->out_off = 0;
+    conn->out.pop_front();
+    uint64_t created = front.frame->get_created_ns();
+    if (created != 0) {
+      // a delivery (not a reply)
+      if (now == 0) {
+        now = metrics_now_ns();
+      }
+      metrics_observe(DELIVERY_LATENCY, now - created);
+      metrics_count(DELIVERIES_SENT);
+    }
+    front.frame->unref();
+  }
+}
+
+/*
+ * Registers for writability exactly while output is pending.
+ *
+ * Parameters:
+ *   conn - pointer to the connection
+ */
+void EventLoop::update_interest(LoopConn *conn) {
+  bool want_write = !conn->out.empty();
+  if (want_write == conn->want_write) {
+    return;
+  }
+  struct epoll_event ev;
+  // a closing connection ignores input, so stop polling for it
+  ev.events = (conn->closing ? 0 : EPOLLIN) | (want_write ? EPOLLOUT : 0);
+  ev.data.ptr = conn;
+  epoll_ctl(m_epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->want_write = want_write;
+}
+
+/*
+ * Closes a connection. The Session is destroyed first, which removes
+ * the user from its rooms; broadcasts already under way may still
+ * notify the connection until the user is freed, so it is only freed
+ * by free_closed after that. A null session marks the connection as
+ * closed.
+ *
+ * Parameters:
+ *   conn - pointer to the connection to close
+ */
+void EventLoop::close_conn(LoopConn *conn) {
+  delete conn->session;
+  conn->session = nullptr;
+  if (m_ring != nullptr) {
+    // makes the operations in flight complete; the socket stays open
+    // until they have, so its descriptor can't be reused meanwhile
+    shutdown(conn->fd, SHUT_RDWR);
+  } else {
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    ::close(conn->fd);
+    conn->fd = -1;
+  }
+  m_conns.erase(conn->id);
+  m_closed.push_back(conn);
+}
+
+/*
+ * Frees connections closed earlier, except those with io_uring
+ * operations still in flight or whose user has not been freed yet.
+ */
+void EventLoop::free_closed() {
+  size_t kept = 0;
+  for (size_t i = 0; i < m_closed.size(); i++) {
+    LoopConn *conn = m_closed[i];
+    if ((m_ring != nullptr && conn->ops_in_flight > 0)
+        || !conn->user_freed.load(std::memory_order_acquire)) {
+      m_closed[kept++] = conn;
+      continue;
+    }
+    if (conn->fd >= 0) {
+      ::close(conn->fd);
+    }
+    delete conn;
+  }
+  m_closed.resize(kept);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reactor implementation
+////////////////////////////////////////////////////////////////////////
+
+/*
+ * Non-Default constructor for Reactor object.
+ *
+ * Parameters:
+ *   server - pointer to the Server the clients are connected to
+ *   num_loops - number of event loop threads to run
+ *   use_uring - true to do I/O with io_uring if the kernel supports it,
+ *               and with epoll otherwise
+ *
+ * Returns:
+ *   a new Reactor whose loops have not been started yet
+ */
+Reactor::Reactor(Server *server, int num_loops, bool use_uring)
+  : m_server(server)
+  , m_uring(use_uring && Uring::is_supported())
+  , m_next_loop(0) {
+  for (int i = 0; i < num_loops; i++) {
+    m_loops.push_back(new EventLoop(server, m_uring));
+  }
+}
+
+/*
+ * Destructor for a Reactor object.
+ * Stops every loop and frees it.
+ */
+Reactor::~Reactor() {
+  for (size_t i = 0; i < m_loops.size(); i++) {
+    delete m_loops[i];
+  }
+}
+
+/*
+ * Gives every loop a listening socket of its own to accept clients on,
+ * and pins each loop to one of the CPUs the process may use, in turn.
+ *
+ * Parameters:
+ *   listen_fds - one listening socket per loop, all bound to the same
+ *                port with SO_REUSEPORT
+ */
+void Reactor::set_listeners(const std::vector<int> &listen_fds) {
+  std::vector<int> cpus = allowed_cpus();
+  for (size_t i = 0; i < m_loops.size() && i < listen_fds.size(); i++) {
+    m_loops[i]->set_listener(listen_fds[i], cpus.empty() ? -1 : cpus[i % cpus.size()]);
+  }
+}
+
+/*
+ * Starts every event loop thread.
+ *
+ * Returns:
+ *   true if all loops started
+ */
+bool Reactor::start() {
+  for (size_t i = 0; i < m_loops.size(); i++) {
+    if (!m_loops[i]->start()) {
+      return false;
+    }
+  }
+  return !m_loops.empty();
+}
+
+/*
+ * Waits for the loops, which only exit if waiting for events fails.
+ */
+void Reactor::wait() {
+  for (size_t i = 0; i < m_loops.size(); i++) {
+    m_loops[i]->wait();
+  }
+}
+
+/*
+ * Accepts incoming client connections and hands each to the next loop.
+ *
+ * Parameters:
+ *   listen_fd - the server's listening socket
+ */
+void Reactor::accept_loop(int listen_fd) {
+  if (m_uring) {
+    accept_uring(listen_fd);
+    return;
+  }
+  while (1) {
+    int clientfd = accept(listen_fd, NULL, NULL);
+    if (clientfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "Error accepting client connection" << std::endl;
+      return;
+    }
+    int flags = fcntl(clientfd, F_GETFL, 0);
+    fcntl(clientfd, F_SETFL, flags | O_NONBLOCK);
+    hand_off(clientfd);
+  }
+}
+
+/*
+ * Accepts incoming client connections with io_uring, keeping several
+ * accepts in flight so a burst of connections is taken in one call.
+ *
+ * Parameters:
+ *   listen_fd - the server's listening socket
+ */
+void Reactor::accept_uring(int listen_fd) {
+  Uring ring;
+  if (!ring.init(ACCEPT_DEPTH) || !ring.enable()) {
+    std::cerr << "io_uring setup failed" << std::endl;
+    return;
+  }
+  for (int i = 0; i < ACCEPT_DEPTH; i++) {
+    ring.accept(listen_fd, SOCK_NONBLOCK, 0);
+  }
+  while (1) {
+    int ret = ring.submit(1);
+    if (ret < 0 && ret != -EINTR) {
+      std::cerr << "io_uring_enter failed" << std::endl;
+      return;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = ring.peek_cqe()) != nullptr) {
+      int clientfd = cqe->res;
+      ring.cqe_seen();
+      if (clientfd < 0 && clientfd != -EINTR && clientfd != -ECONNABORTED) {
+        std::cerr << "Error accepting client connection" << std::endl;
+        return;
+      }
+      if (clientfd >= 0) {
+        hand_off(clientfd);
+      }
+      ring.accept(listen_fd, SOCK_NONBLOCK, 0);
+    }
+  }
+}
+
+/*
+ * Hands an accepted (non-blocking) socket to the next loop.
+ *
+ * Parameters:
+ *   clientfd - the client's socket
+ */
+void Reactor::hand_off(int clientfd) {
+  m_loops[m_next_loop]->add_client(clientfd);
+  m_next_loop = (m_next_loop + 1) % m_loops.size();
+}
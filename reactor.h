@@ -0,0 +1,65 @@
+/*
+ * Class describing an event-driven connection handler.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <vector>
+class Server;
+class EventLoop;
+
+// A Reactor runs a small fixed number of event loop threads, each
+// multiplexing many non-blocking client sockets with epoll or io_uring.
+// Accepted sockets are handed to the loops round-robin, or each loop
+// accepts on a SO_REUSEPORT listening socket of its own; from then on
+// every read, reply and delivery for that client happens on its loop
+// thread. Clients of different loops can share a room: a broadcast
+// queues each delivery and wakes the receiver's own loop.
+class Reactor {
+public:
+  // use_uring asks for io_uring, which is only used if the kernel
+  // supports it (see is_using_uring)
+  Reactor(Server *server, int num_loops, bool use_uring = false);
+  ~Reactor();
+
+  // Have each loop accept on its own listening socket (one per loop,
+  // bound with SO_REUSEPORT) rather than be handed clients by
+  // accept_loop, with its thread pinned to a CPU. Call before start.
+  void set_listeners(const std::vector<int> &listen_fds);
+
+  // Start the event loop threads. Returns false if they could not
+  // be created.
+  bool start();
+
+  // Wait for the loops to exit, which they only do if waiting for
+  // events fails (for use with set_listeners instead of accept_loop).
+  void wait();
+
+  // Accept connections on the listening socket forever, handing each
+  // to one of the event loops. Returns only if accept fails.
+  void accept_loop(int listen_fd);
+
+  // Whether the loops (and accept_loop) do I/O with io_uring.
+  bool is_using_uring() const { return m_uring; }
+
+private:
+  // prohibit value semantics
+  Reactor(const Reactor &);
+  Reactor &operator=(const Reactor &);
+
+  void accept_uring(int listen_fd);
+  void hand_off(int clientfd);
+
+  Server *m_server;
+  bool m_uring;
+  std::vector<EventLoop *> m_loops;
+  unsigned m_next_loop;
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,166 @@
+/*
+ * Implementation of a connection's input buffer, sized to its traffic.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include "read_buffer.h"
+
+/*
+ * Constructor for ReadBuffer object.
+ *
+ * Returns:
+ *   an empty buffer, with no memory allocated until the first read
+ */
+ReadBuffer::ReadBuffer()
+  : m_buf(nullptr)
+  , m_cap(0)
+  , m_pos(0)
+  , m_end(0)
+  , m_target(MIN_READ_BUFFER)
+  , m_small_reads(0)
+  , m_last_read(0) {
+}
+
+/*
+ * Destructor for ReadBuffer object.
+ */
+ReadBuffer::~ReadBuffer() {
+  free(m_buf);
+}
+
+/*
+ * Function to mark bytes at the front of the buffer as decoded.
+ *
+ * Parameters:
+ *   n - number of bytes, at most size()
+ */
+void ReadBuffer::consume(size_t n) {
+  m_pos += n;
+  if (m_pos == m_end) {
+    m_pos = m_end = 0;
+  }
+}
+
+/*
+ * Function to read from a socket into the room left in the buffer,
+ * growing it for next time if the read filled it.
+ *
+ * Parameters:
+ *   fd - the file descriptor to read from
+ *
+ * Returns:
+ *   the number of bytes read, 0 at EOF, or -1 on error
+ */
+ssize_t ReadBuffer::fill(int fd) {
+  make_room(1);
+  size_t room = m_cap - m_end;
+  ssize_t n;
+  do {
+    n = read(fd, m_buf + m_end, room);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0) {
+    m_end += n;
+    count_read(n);
+    if (static_cast<size_t>(n) == room && m_target < MAX_READ_BUFFER) {
+      m_target *= 2;
+    }
+  }
+  return n;
+}
+
+/*
+ * Function to add bytes read elsewhere to the buffer.
+ *
+ * Parameters:
+ *   p - pointer to the bytes
+ *   n - number of bytes
+ */
+void ReadBuffer::append(const char *p, size_t n) {
+  make_room(n);
+  memcpy(m_buf + m_end, p, n);
+  m_end += n;
+  count_read(n);
+}
+
+/*
+ * Function to shrink the buffer once it is empty (and isn't about to
+ * grow): it is freed if the last read used less than
+ * 1/READ_BUFFER_IDLE_FRACTION of it, and halved if the last
+ * READ_BUFFER_SHRINK_READS reads each used less than a quarter of it.
+ */
+void ReadBuffer::settle() {
+  if (!empty() || m_target > m_cap || m_cap <= MIN_READ_BUFFER) {
+    return;
+  }
+  if (m_last_read < m_cap / READ_BUFFER_IDLE_FRACTION) {
+    free(m_buf);
+    m_buf = nullptr;
+    m_cap = 0;
+    m_target = MIN_READ_BUFFER;
+    m_small_reads = 0;
+    return;
+  }
+  if (m_small_reads < READ_BUFFER_SHRINK_READS) {
+    return;
+  }
+  size_t cap = (m_cap / 2 > MIN_READ_BUFFER) ? m_cap / 2 : MIN_READ_BUFFER;
+  char *buf = static_cast<char *>(realloc(m_buf, cap));
+  if (buf != nullptr) {
+    m_buf = buf;
+    m_cap = cap;
+  }
+  m_target = m_cap;
+  m_small_reads = 0;
+}
+
+/*
+ * Helper function to note how much of the buffer a read used.
+ *
+ * Parameters:
+ *   n - number of bytes the read added
+ */
+void ReadBuffer::count_read(size_t n) {
+  m_last_read = n;
+  if (n < m_cap / 4) {
+    m_small_reads++;
+  } else {
+    m_small_reads = 0;
+  }
+}
+
+/*
+ * Helper function to move the unread bytes to the front of the buffer
+ * and make sure there is room for at least n more after them, growing
+ * the buffer to its target size (or past it, if needed).
+ *
+ * Parameters:
+ *   n - number of bytes to make room for
+ */
+void ReadBuffer::make_room(size_t n) {
+  if (m_pos > 0) {
+    memmove(m_buf, m_buf + m_pos, m_end - m_pos);
+    m_end -= m_pos;
+    m_pos = 0;
+  }
+  size_t cap = (m_target > m_cap) ? m_target : m_cap;
+  while (cap - m_end < n) {
+    cap *= 2;
+  }
+  if (cap != m_cap) {
+    char *buf = static_cast<char *>(realloc(m_buf, cap));
+    if (buf == nullptr) {
+      throw std::bad_alloc();
+    }
+    m_buf = buf;
+    m_cap = cap;
+  }
+}
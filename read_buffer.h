@@ -0,0 +1,90 @@
+/*
+ * Class describing a connection's input buffer, sized to its traffic.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef READ_BUFFER_H
+#define READ_BUFFER_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+// Smallest buffer a read is made with (the size every read used to
+// be), and the largest a buffer grows to just because reads keep
+// filling it (a single message bigger than that still grows it as far
+// as needed).
+const size_t MIN_READ_BUFFER = 4096;
+const size_t MAX_READ_BUFFER = 256 * 1024;
+
+// consecutive reads using less than a quarter of a buffer after which
+// it is halved
+const size_t READ_BUFFER_SHRINK_READS = 64;
+
+// a buffer left empty by a read using less than this fraction of it is
+// given back
+const size_t READ_BUFFER_IDLE_FRACTION = 64;
+
+// A ReadBuffer holds the bytes read from a socket that have not been
+// decoded yet. Each read asks for as much as the buffer has room for;
+// a read that fills the room means the socket probably held more, so
+// the next read is made with a buffer twice the size. The owner decodes
+// every complete message it finds and then calls settle. A buffer
+// bigger than MIN_READ_BUFFER that the last read used less than
+// 1/READ_BUFFER_IDLE_FRACTION of is freed once it is empty: the burst
+// that grew it is over, and the connection is back to trickling or has
+// gone quiet. The next read starts again from MIN_READ_BUFFER. Short of
+// that, once READ_BUFFER_SHRINK_READS reads in a row have each used
+// less than a quarter of the buffer, it is halved the next time it is
+// empty, but never below MIN_READ_BUFFER. A connection steadily sending
+// small messages keeps a MIN_READ_BUFFER buffer and does not allocate
+// on every read. A connection whose last read before going silent was
+// a large one keeps its buffer until it next sends something.
+class ReadBuffer {
+public:
+  ReadBuffer();
+  ~ReadBuffer();
+
+  // the bytes not yet consumed
+  const char *data() const { return m_buf + m_pos; }
+  size_t size() const { return m_end - m_pos; }
+  bool empty() const { return m_pos == m_end; }
+
+  size_t capacity() const { return m_cap; }
+
+  // Mark n bytes from the front as decoded. What data() pointed to
+  // stays valid until the next fill, append or settle.
+  void consume(size_t n);
+
+  // Read from fd into the room left, retrying on EINTR. Returns the
+  // bytes read, 0 at EOF, or -1 on error (with errno set).
+  ssize_t fill(int fd);
+
+  // Add n bytes read elsewhere (such as an io_uring provided buffer).
+  void append(const char *p, size_t n);
+
+  // Free the buffer if it is empty and the last read needed little of
+  // it, or halve it if the reads have long needed little of it.
+  void settle();
+
+private:
+  // prohibit value semantics
+  ReadBuffer(const ReadBuffer &);
+  ReadBuffer &operator=(const ReadBuffer &);
+
+  void make_room(size_t n);
+  void count_read(size_t n);
+
+  char *m_buf;
+  size_t m_cap;
+  size_t m_pos;       // first byte not yet consumed
+  size_t m_end;       // end of the bytes read
+  size_t m_target;    // capacity the next read should be made with
+  size_t m_small_reads; // reads in a row using less than a quarter of it
+  size_t m_last_read; // bytes the last read added
+};
+
+#endif // READ_BUFFER_H
@@ -9,13 +9,20 @@
 
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
 #include "csapp.h"
 #include "message.h"
 #include "connection.h"
 #include "client_util.h"
 #include "user.h"
+#include "room.h"
 
 /*
  * Function to handle message request (responses) from server.
@@ -52,16 +59,20 @@ bool handleResponse(Connection &connection) {
  *
  * Parameters:
  *   payload - string representing the payload of the delivery request 
- *   room_name - string representing the name of the room
+ *   rooms - reference to the names of the rooms the receiver is in;
+ *           with more than one, each message is shown with its room
  */
-void handleDelivery(std::string payload, std::string room_name) {
+void handleDelivery(std::string payload, const std::vector<std::string> &rooms) {
   size_t nextColon = payload.find(':');
   std::string deliveryRoom = payload.substr(0, nextColon);
   std::string msgContent = payload.substr(nextColon+1);
-  if (deliveryRoom == room_name) {
+  if (std::find(rooms.begin(), rooms.end(), deliveryRoom) != rooms.end()) {
     nextColon = msgContent.find(':');
     std::string sender = msgContent.substr(0, nextColon);
     std::string messageText = msgContent.substr(nextColon+1);
+    if (rooms.size() > 1) {
+      std::cout << "[" << deliveryRoom << "] ";
+    }
     std::cout << sender << ": " << messageText << std::endl;
   }
 }
@@ -71,31 +82,117 @@ void handleDelivery(std::string payload, std::string room_name) {
  *
  * Parameters:
  *   connection - Connection object representing conection between receiver and server
- *   room_name - string representing the name of the room the receiver is in
+ *   rooms - reference to the names of the rooms the receiver is in
+ *   pending - reference to the number of joins and leaves sent that
+ *             the server has not replied to yet (including joins to
+ *             the rooms given on the command line after the first)
  * 
  * Returns:
  *   true if message is sucesfully received
  */
-bool handleLoop(Connection& connection, std::string room_name) {
+bool handleLoop(Connection& connection, const std::vector<std::string> &rooms, size_t &pending) {
   Message msg;
   if(!connection.receive(msg)) {
     std::cerr << "Connection closed or error in reading message." << std::endl;
     return false;
   }
-  if (msg.tag == TAG_ERR) {
+  if ((msg.tag == TAG_OK || msg.tag == TAG_ERR) && pending > 0) {
+    // the reply to a join or leave not yet replied to
+    pending--;
+    if (msg.tag == TAG_ERR) {
+      std::cerr << msg.data << std::endl;
+    }
+  } else if (msg.tag == TAG_ERR) {
     std::cerr << msg.data << std::endl;
     connection.close();
     return false;
   } else if (msg.tag == TAG_DELIVERY) {
-    handleDelivery(msg.data, room_name);
+    handleDelivery(msg.data, rooms);
   } else {
-    std::cerr << "Unexpected message tag: " << msg.tag << std::endl;
+    std::cerr << "Unexpected message tag: " << tag_name(msg.tag) << std::endl;
     connection.close();
     return false;
   }
   return true;
 }
 
+/*
+ * Function to handle a command typed in while receiving: "/join <room>"
+ * or "/leave <room>" (or just "/leave" to leave every room).
+ *
+ * Parameters:
+ *   line - constant reference to the line typed in
+ *   connection - reference to Connection object
+ *   rooms - reference to the names of the rooms the receiver is in
+ *   pending - reference to the number of joins and leaves not yet replied to
+ *
+ * Returns:
+ *   false if the command could not be sent
+ */
+bool handleCommand(const std::string &line, Connection &connection,
+                   std::vector<std::string> &rooms, size_t &pending) {
+  std::stringstream ss(line);
+  std::string tag, room;
+  ss >> tag >> room;
+  Message msg;
+  if (tag == "/join" && !room.empty()) {
+    msg.set(TAG_JOIN, room);
+    if (std::find(rooms.begin(), rooms.end(), room) == rooms.end()) {
+      rooms.push_back(room);
+    }
+  } else if (tag == "/leave") {
+    msg.set(TAG_LEAVE, room);
+    // deliveries still on their way from the room are not shown
+    if (room.empty()) {
+      rooms.clear();
+    } else {
+      rooms.erase(std::remove(rooms.begin(), rooms.end(), room), rooms.end());
+    }
+  } else {
+    if (!tag.empty()) {
+      std::cerr << "Invalid command." << std::endl;
+    }
+    return true;
+  }
+  if (!connection.send(msg)) {
+    std::cerr << "Failed to send request" << std::endl;
+    return false;
+  }
+  pending++;
+  return true;
+}
+
+/*
+ * Function to read what has been typed in and handle each whole line.
+ *
+ * Parameters:
+ *   input - reference to the text typed in that is not yet a whole line
+ *   connection - reference to Connection object
+ *   rooms - reference to the names of the rooms the receiver is in
+ *   pending - reference to the number of joins and leaves not yet replied to
+ *
+ * Returns:
+ *   false once there is nothing more to read from stdin
+ */
+bool handleInput(std::string &input, Connection &connection,
+                 std::vector<std::string> &rooms, size_t &pending) {
+  char buf[1024];
+  ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+  if (n <= 0) {
+    return n < 0 && errno == EINTR;
+  }
+  input.append(buf, n);
+  size_t newline;
+  while ((newline = input.find('\n')) != std::string::npos) {
+    if (!handleCommand(input.substr(0, newline), connection, rooms, pending)) {
+      connection.close();
+      exit(1);
+    }
+    input.erase(0, newline + 1);
+  }
+  return true;
+}
+
 /*
  * Main Function which runs the receiver client of the server. 
  *
@@ -108,12 +205,28 @@ bool handleLoop(Connection& connection, std::string room_name) {
  *   1 if the receiver throws an error
  */
 int main(int argc, char **argv) {
-  if (argc != 5) {
-    std::cerr << "Usage: ./receiver [server_address] [port] [username] [room]\n";
+  if (argc != 5 && argc != 6) {
+    std::cerr << "Usage: ./receiver [server_address] [port] [username] [room[,room...]] [history]\n";
     return 1;
   }
 
-  std::string room_name = argv[4];
+  // the rooms to join, separated by commas
+  std::vector<std::string> rooms;
+  std::stringstream room_list(argv[4]);
+  std::string room_name;
+  while (std::getline(room_list, room_name, ',')) {
+    if (!room_name.empty() && std::find(rooms.begin(), rooms.end(), room_name) == rooms.end()) {
+      rooms.push_back(room_name);
+    }
+  }
+  if (rooms.empty()) {
+    rooms.push_back("");
+  }
+  // optionally, have the last few messages sent to each room replayed
+  std::string join_options;
+  if (argc == 6) {
+    join_options = std::string(";") + JOIN_OPTION_HISTORY + argv[5];
+  }
 
   // creating new connection object
   Connection connection;
@@ -136,23 +249,52 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  // send rjoin request
-  Message rjoin_msg(TAG_JOIN, room_name);
-  if(!connection.send(rjoin_msg)) {
-    std::cerr << "Failed to send rjoin request" << std::endl;
-    connection.close();
-    return 1;
-  }
+  // Join the first room and check the server's response. The replies
+  // to joining any others may come after the first room's deliveries
+  // (replayed or new), so they are counted and handled as they arrive.
+  size_t pending = 0;
+  for (size_t i = 0; i < rooms.size(); i++) {
+    // send rjoin request
+    Message rjoin_msg(TAG_JOIN, rooms[i] + join_options);
+    if(!connection.send(rjoin_msg)) {
+      std::cerr << "Failed to send rjoin request" << std::endl;
+      connection.close();
+      return 1;
+    }
 
-  // check the server's response
-  if (!handleResponse(connection)) {
-    connection.close();
-    return 1;
+    if (i > 0) {
+      pending++;
+    } else if (!handleResponse(connection)) {
+      // check the server's response
+      connection.close();
+      return 1;
+    }
   }
 
-  // loop waiting for messages from server
+  // loop waiting for messages from server, and for rooms to join
+  // or leave typed in
+  std::string input;
+  bool reading_input = true;
+  // run in the background, reading the terminal fails rather than
+  // stopping the receiver, and typed commands are no longer read
+  signal(SIGTTIN, SIG_IGN);
   while (1) {
-    if (!handleLoop(connection, room_name)) {
+    if (!connection.has_message()) {
+      struct pollfd pfds[2] = {
+        { connection.get_fd(), POLLIN, 0 },
+        { STDIN_FILENO, POLLIN, 0 },
+      };
+      if (poll(pfds, reading_input ? 2 : 1, -1) < 0) {
+        continue;
+      }
+      if (reading_input && pfds[1].revents != 0) {
+        reading_input = handleInput(input, connection, rooms, pending);
+      }
+      if (pfds[0].revents == 0) {
+        continue;
+      }
+    }
+    if (!handleLoop(connection, rooms, pending)) {
       return 1;
     }
   }
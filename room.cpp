@@ -7,80 +7,525 @@
  * mqing2@jhu.edu
  */
 
+#include <algorithm>
+#include <atomic>
 #include "guard.h"
 #include "message.h"
+#include "frame.h"
 #include "message_queue.h"
 #include "user.h"
+#include "metrics.h"
+#include "room_log.h"
+#include "fanout.h"
 #include "room.h"
 
+// A broadcast handed to the fan-out pool, shared by its parts. It holds
+// a reference to the frame and the members snapshot until the last part
+// is done with them.
+struct Room::Fanout {
+  Room *room;
+  Snapshot snapshot;
+  Frame *frame;
+  std::string sender_username;
+  bool text_ok;
+  uint64_t start_ns;
+  std::atomic<int> parts_left;
+};
+
+// The grace period of a snapshot: freed once the snapshot and every
+// older one have been, since each Grace holds the next one.
+struct Room::Grace {
+  std::shared_ptr<Grace> next; // the next snapshot's, once published
+  User *retired; // released when this is freed, if not nullptr
+
+  Grace() : retired(nullptr) { }
+  ~Grace();
+};
+
+namespace {
+
+/*
+ * Picks the part of a room's members a user belongs in, the same for
+ * as long as the user exists.
+ *
+ * Parameters:
+ *   user - pointer to the member
+ *   num_parts - number of parts the members are split into
+ *
+ * Returns:
+ *   the part, from 0 to num_parts - 1
+ */
+size_t part_of(const User *user, size_t num_parts) {
+  // users are allocated on 16-byte boundaries, so mix the address
+  uint64_t h = reinterpret_cast<uintptr_t>(user) * 0x9E3779B97F4A7C15ull;
+  return (h >> 32) % num_parts;
+}
+
+}
+
 /*
  * Default constructor for Room object. 
  *
+ * Parameters:
+ *   room_name - name of the room
+ *   history_limit - most deliveries to keep for replay, 0 for any number
+ *   history_bytes - most bytes of deliveries to keep, 0 for any number
+ *
  * Returns:
  *   a new instance of a Room object
- *   with the mutex initialied.
+ *   with the mutex initialied and no members.
  */
-Room::Room(const std::string &room_name)
-  : room_name(room_name) {
-  // initialize the mutex
+Room::Room(const std::string &room_name, size_t history_limit, size_t history_bytes)
+  : room_name(room_name)
+  , members(std::make_shared<const Members>())
+  , history_limit(history_limit)
+  , history_bytes(history_bytes)
+  , history_head(0)
+  , history_count(0)
+  , history_used(0)
+  , log(nullptr)
+  , fanout_pool(nullptr)
+  , fanout_min_members(0)
+  , fanouts(0) {
+  // initialize the mutexes
   pthread_mutex_init(&lock, NULL);
+  pthread_mutex_init(&history_lock, NULL);
+  pthread_mutex_init(&fanout_lock, NULL);
+  pthread_cond_init(&fanout_done, NULL);
 }
 
 /*
  * Destructor for a Room object.
- * Ensures that the mutex is destroyed
+ * Ensures that the mutexes are destroyed and the history freed
  */
 Room::~Room() {
-  // destroy the mutex
+  // let the pool finish with the room first
+  wait_for_fanouts(1);
+  while (history_count > 0) {
+    forget_oldest();
+  }
+  delete log;
+  // destroy the mutexes
+  pthread_cond_destroy(&fanout_done);
+  pthread_mutex_destroy(&fanout_lock);
+  pthread_mutex_destroy(&history_lock);
   pthread_mutex_destroy(&lock);
 }
 
+/*
+ * Constructor for a members snapshot, with a grace period of its own.
+ */
+Room::Members::Members()
+  : grace(std::make_shared<Grace>()) {
+}
+
+/*
+ * Destructor for a grace period. Frees the later ones only it was
+ * keeping alive, one at a time rather than recursively, as there may
+ * be many, and releases the member removed after its snapshot.
+ */
+Room::Grace::~Grace() {
+  std::shared_ptr<Grace> later;
+  later.swap(next);
+  while (later && later.use_count() == 1) {
+    // the only reference left, so no one else can reach it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::shared_ptr<Grace> after;
+    after.swap(later->next);
+    later.swap(after); // frees the later one, which no longer has a next
+  }
+  if (retired != nullptr) {
+    retired->unref();
+  }
+}
+
 /*
  * Function to add a user to the room
  *
  * Parameters:
  *   user - pointer to User object to be added to the room
+ *   replay - number of the latest deliveries kept in the history
+ *            to queue to the user first
+ */
+void Room::add_member(User *user, size_t replay) {
+  if (replay == 0 || !keeps_history()) {
+    insert_member(user);
+    return;
+  }
+  // no broadcast can add to the history (or fan out) in between
+  Guard guard(history_lock);
+  replay_history(user, replay);
+  insert_member(user);
+}
+
+/*
+ * Helper function to add a user to the members.
+ *
+ * Parameters:
+ *   user - pointer to User object to be added to the room
  */
-void Room::add_member(User *user) {
+void Room::insert_member(User *user) {
   // lock the room mutex before modifying
   Guard guard(lock);
-  // add User to the room
-  members.insert(user);
+  // add User to a copy of the members and publish it
+  Snapshot prev = std::atomic_load(&members);
+  const UserSet &all = prev->all;
+  UserSet::const_iterator pos = std::lower_bound(all.begin(), all.end(), user);
+  if (pos != all.end() && *pos == user) {
+    return;
+  }
+  std::shared_ptr<Members> next = std::make_shared<Members>();
+  next->all.reserve(all.size() + 1);
+  next->all.insert(next->all.end(), all.begin(), pos);
+  next->all.push_back(user);
+  next->all.insert(next->all.end(), pos, all.end());
+  publish(next, *prev, user);
 }
 
 /*
- * Function to remove a user from the room
+ * Function to remove a user from the room. Broadcasts that started
+ * before may still be delivering to the user, so the room keeps a
+ * reference to it until the last snapshot including it, and every
+ * older one, has been freed.
  *
  * Parameters:
  *   user - pointer to User object to be removed from the room
  */
 void Room::remove_member(User *user) {
   // lock the room mutex before modifying
-  Guard guard (lock);
-  // remove User from the room
-  members.erase(user);
+  Guard guard(lock);
+  Snapshot prev = std::atomic_load(&members);
+  const UserSet &all = prev->all;
+  UserSet::const_iterator pos = std::lower_bound(all.begin(), all.end(), user);
+  if (pos == all.end() || *pos != user) {
+    return;
+  }
+  // remove User from a copy of the members and publish it
+  std::shared_ptr<Members> next = std::make_shared<Members>();
+  next->all.reserve(all.size() - 1);
+  next->all.insert(next->all.end(), all.begin(), pos);
+  next->all.insert(next->all.end(), pos + 1, all.end());
+  publish(next, *prev, user);
+  // the previous snapshot is the last to include the user
+  user->ref();
+  prev->grace->retired = user;
+}
+
+/*
+ * Helper function to make a new set of members current, first
+ * splitting it into parts if the pool should fan out to it.
+ *
+ * Parameters:
+ *   next - reference to the new members (with all filled in)
+ *   prev - reference to the members it replaces
+ *   user - pointer to the User added or removed
+ */
+void Room::publish(const std::shared_ptr<Members> &next, const Members &prev, User *user) {
+  if (fanout_pool != nullptr && next->all.size() >= fanout_min_members) {
+    size_t num_parts = fanout_pool->get_num_threads();
+    if (!prev.parts.empty()) {
+      // only the user's part changes
+      next->parts = prev.parts;
+      UserSet &part = next->parts[part_of(user, num_parts)];
+      if (next->all.size() > prev.all.size()) {
+        part.push_back(user);
+      } else {
+        part.erase(std::find(part.begin(), part.end(), user));
+      }
+    } else {
+      next->parts.resize(num_parts);
+      for (UserSet::const_iterator u_it = next->all.begin(); u_it != next->all.end(); u_it++) {
+        next->parts[part_of(*u_it, num_parts)].push_back(*u_it);
+      }
+    }
+  }
+  prev.grace->next = next->grace;
+  std::atomic_store(&members, Snapshot(next));
+}
+
+/*
+ * Function to have a pool fan out the broadcasts to the room while it
+ * is large.
+ *
+ * Parameters:
+ *   pool - pointer to the FanoutPool
+ *   min_members - fewest members for which the pool fans out
+ */
+void Room::set_fanout(FanoutPool *pool, size_t min_members) {
+  fanout_pool = pool;
+  fanout_min_members = min_members;
 }
 
 /*
- * Function to broadcast a message from the sender to the room
+ * Function to broadcast a message from the sender to the room.
+ * The delivery is encoded once and the same Frame is shared by
+ * every receiver's queue. The room's lock is not taken: the
+ * fan-out goes to the members snapshot current when it started.
+ * With a log, the message is appended to it first (the delivery
+ * does not wait for it to reach the disk). If the snapshot is split
+ * into parts, the pool's threads queue the deliveries, and this
+ * returns once the parts are handed over.
  *
  * Parameters:
  *   sender_username - string representing the username of the sender
  *   message_text - string representing the message to be broadcasted to the room
  */
 void Room::broadcast_message(const std::string &sender_username, const std::string &message_text) {
-  // lock the room mutex for duration of broadcasting this msg
-  Guard guard(lock);
+  uint64_t start = metrics_now_ns();
+  if (log != nullptr) {
+    // only copied into memory here; written and synced by the log's writer
+    log->append(sender_username, message_text);
+  }
 
   // get the message to be delivered from server to receivers
-  std::string room_name = get_room_name();
-  std::string msg_data = room_name + ":" + sender_username + ":" + message_text;
-  
-  std::set<User *>::iterator u_it;
-  for (u_it = members.begin(); u_it != members.end(); u_it++) {
-    if ((*u_it)->username != sender_username) {
-      Message* msg = new Message(TAG_DELIVERY, msg_data);
-      (*u_it)->mqueue.enqueue(msg);
+  Frame *frame = Frame::create_delivery(room_name, sender_username, message_text);
+
+  {
+    // holding the snapshot keeps its members from being freed
+    Snapshot snapshot;
+    if (keeps_history()) {
+      // a receiver joining with a replay is either in the snapshot
+      // or joins after the frame is in the history, not both
+      Guard guard(history_lock);
+      remember(frame);
+      snapshot = std::atomic_load(&members);
+    } else {
+      snapshot = std::atomic_load(&members);
     }
+
+    // receivers using text framing can only be sent what fits on a line
+    bool text_ok = frame->size(FRAMING_TEXT) > 0;
+
+    if (!snapshot->parts.empty()) {
+      wait_for_fanouts(MAX_ROOM_FANOUTS);
+      // the fan-out takes over the reference from create_delivery
+      Fanout *fanout = new Fanout();
+      fanout->room = this;
+      fanout->snapshot = snapshot;
+      fanout->frame = frame;
+      fanout->sender_username = sender_username;
+      fanout->text_ok = text_ok;
+      fanout->start_ns = start;
+      fanout->parts_left.store(snapshot->parts.size(), std::memory_order_relaxed);
+      {
+        Guard guard(fanout_lock);
+        fanouts.fetch_add(1, std::memory_order_relaxed);
+      }
+      for (size_t i = 0; i < snapshot->parts.size(); i++) {
+        fanout_pool->submit(i, fan_out_part, fanout);
+      }
+      metrics_count_room_message(this);
+      return;
+    }
+
+    // the room has shrunk since the pool last fanned out to it
+    wait_for_fanouts(1);
+    metrics_count(DELIVERIES_QUEUED, deliver(snapshot->all, frame, sender_username, text_ok));
+    metrics_observe(fanout_latency(snapshot->all.size()), metrics_now_ns() - start);
   }
-}
\ No newline at end of file
+  metrics_count_room_message(this);
+
+  // drop the reference from create_delivery
+  frame->unref();
+}
+
+/*
+ * Helper function to queue a delivery to some of the members.
+ *
+ * Parameters:
+ *   users - reference to the members
+ *   frame - pointer to the delivery (each queue gets its own reference)
+ *   sender_username - reference to the username of the sender, who
+ *                     gets no copy
+ *   text_ok - false if the delivery cannot go to text receivers
+ *
+ * Returns:
+ *   the number of deliveries queued
+ */
+size_t Room::deliver(const UserSet &users, Frame *frame, const std::string &sender_username,
+                     bool text_ok) {
+  size_t queued = 0;
+  UserSet::const_iterator u_it;
+  for (u_it = users.begin(); u_it != users.end(); u_it++) {
+    if ((*u_it)->username != sender_username
+        && (text_ok || (*u_it)->framing == FRAMING_BINARY)) {
+      // each queue gets its own reference to the shared frame
+      frame->ref();
+      (*u_it)->mqueue.enqueue(frame);
+      queued++;
+    }
+  }
+  return queued;
+}
+
+/*
+ * Function run on a pool thread to queue a broadcast to the members
+ * in its part; the last part to finish frees the broadcast.
+ *
+ * Parameters:
+ *   arg - pointer to the Fanout
+ *   part - the part of the members to queue to
+ */
+void Room::fan_out_part(void *arg, int part) {
+  Fanout *fanout = static_cast<Fanout *>(arg);
+  metrics_count(DELIVERIES_QUEUED, deliver(fanout->snapshot->parts[part], fanout->frame,
+                                           fanout->sender_username, fanout->text_ok));
+  if (fanout->parts_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    metrics_observe(fanout_latency(fanout->snapshot->all.size()), metrics_now_ns() - fanout->start_ns);
+    Room *room = fanout->room;
+    fanout->frame->unref();
+    delete fanout;
+    Guard guard(room->fanout_lock);
+    room->fanouts.fetch_sub(1, std::memory_order_release);
+    pthread_cond_broadcast(&room->fanout_done);
+  }
+}
+
+/*
+ * Helper function to wait until the pool has fewer than limit
+ * broadcasts to the room left to fan out, parking rather than
+ * spinning so the thread's CPU goes to the pool meanwhile.
+ *
+ * Parameters:
+ *   limit - number of unfinished fan-outs to wait to drop below
+ */
+void Room::wait_for_fanouts(size_t limit) {
+  if (fanouts.load(std::memory_order_acquire) < limit) {
+    return;
+  }
+  Guard guard(fanout_lock);
+  while (fanouts.load(std::memory_order_relaxed) >= limit) {
+    pthread_cond_wait(&fanout_done, &fanout_lock);
+  }
+}
+
+/*
+ * Function to visit every current member of the room.
+ *
+ * Parameters:
+ *   fn - function to call with each member
+ *   arg - passed on to fn
+ */
+void Room::for_each_member(MemberFn fn, void *arg) const {
+  // holding the snapshot keeps its members from being freed
+  Snapshot snapshot = std::atomic_load(&members);
+  for (UserSet::const_iterator u_it = snapshot->all.begin(); u_it != snapshot->all.end(); u_it++) {
+    fn(*u_it, arg);
+  }
+}
+
+/*
+ * Function to count the room's current members.
+ *
+ * Returns:
+ *   the number of members
+ */
+size_t Room::get_member_count() const {
+  return std::atomic_load(&members)->all.size();
+}
+
+/*
+ * Function to add a message recovered from the room's log to its
+ * history, without delivering it to anyone.
+ *
+ * Parameters:
+ *   sender_username - string representing the username of the sender
+ *   message_text - string representing the message
+ */
+void Room::restore(const std::string &sender_username, const std::string &message_text) {
+  if (!keeps_history()) {
+    return;
+  }
+  Frame *frame = Frame::create_delivery(room_name, sender_username, message_text);
+  {
+    Guard guard(history_lock);
+    remember(frame);
+  }
+  frame->unref();
+}
+
+/*
+ * Function to find how much the room's history holds.
+ *
+ * Parameters:
+ *   count - reference to store the number of deliveries in
+ *   bytes - reference to store the bytes they take up in
+ */
+void Room::get_history_usage(size_t &count, size_t &bytes) const {
+  Guard guard(history_lock);
+  count = history_count;
+  bytes = history_used;
+}
+
+/*
+ * Helper function to add a delivery to the history, dropping the
+ * oldest ones to stay within its bounds. history_lock must be held.
+ *
+ * Parameters:
+ *   frame - pointer to the delivery (the history takes its own reference)
+ */
+void Room::remember(Frame *frame) {
+  size_t size = frame->footprint();
+  if (history_bytes > 0 && size > history_bytes) {
+    return; // would not fit even alone
+  }
+  while (history_count > 0
+         && ((history_limit > 0 && history_count >= history_limit)
+             || (history_bytes > 0 && history_used + size > history_bytes))) {
+    forget_oldest();
+  }
+  if (history_count == history.size()) {
+    // grow the ring (never past history_limit), oldest first
+    size_t cap = history.empty() ? 16 : history.size() * 2;
+    if (history_limit > 0 && cap > history_limit) {
+      cap = history_limit;
+    }
+    std::vector<Frame *> next(cap);
+    for (size_t i = 0; i < history_count; i++) {
+      next[i] = history[(history_head + i) % history.size()];
+    }
+    history.swap(next);
+    history_head = 0;
+  }
+  frame->ref();
+  history[(history_head + history_count) % history.size()] = frame;
+  history_count++;
+  history_used += size;
+}
+
+/*
+ * Helper function to drop the oldest delivery in the history.
+ * history_lock must be held (or the room be being destroyed).
+ */
+void Room::forget_oldest() {
+  Frame *frame = history[history_head];
+  history[history_head] = nullptr;
+  history_head = (history_head + 1) % history.size();
+  history_count--;
+  history_used -= frame->footprint();
+  frame->unref();
+}
+
+/*
+ * Helper function to queue the latest deliveries in the history to a
+ * user, oldest first, so they go out together ahead of any new ones.
+ * history_lock must be held.
+ *
+ * Parameters:
+ *   user - pointer to the User to queue them to
+ *   replay - the most deliveries to queue
+ */
+void Room::replay_history(User *user, size_t replay) const {
+  size_t count = (replay < history_count) ? replay : history_count;
+  size_t queued = 0;
+  for (size_t i = history_count - count; i < history_count; i++) {
+    Frame *frame = history[(history_head + i) % history.size()];
+    // as in broadcast_message, text receivers only get what fits on a line
+    if (frame->size(FRAMING_TEXT) > 0 || user->framing == FRAMING_BINARY) {
+      frame->ref();
+      user->mqueue.enqueue(frame);
+      queued++;
+    }
+  }
+  metrics_count(DELIVERIES_QUEUED, queued);
+}
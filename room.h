@@ -11,32 +11,151 @@
 #define ROOM_H
 
 #include <string>
-#include <set>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <pthread.h>
 
 struct User;
+class Frame;
+class RoomLog;
+class FanoutPool;
+
+// Join option asking for the last N deliveries kept by the room
+// (e.g. "join:lobby;history=20"), and the most that may be asked for
+#define JOIN_OPTION_HISTORY "history="
+const size_t MAX_REPLAY = 1000000;
 
 // A Room object is a representation of a chat room.
 // At a minimum, it should keep track of the User objects representing
 // receivers who have joined the room.
+//
+// A room may also keep a history of its most recent deliveries, bounded
+// by a number of messages, a number of bytes, or both, which a receiver
+// can have replayed when it joins. The history is a ring of the frames
+// already encoded for broadcast; it only allocates while it grows to
+// its bound.
+//
+// Broadcasts to a room with enough members may be fanned out by a
+// FanoutPool: the members are split into one part per pool thread, and
+// the sender's thread only hands the parts over.
 class Room {
 public:
-  Room(const std::string &room_name);
+  // A room keeping up to history_limit deliveries (0 for any number)
+  // in up to history_bytes bytes (0 for any size); with neither, the
+  // room keeps no history.
+  Room(const std::string &room_name, size_t history_limit = 0, size_t history_bytes = 0);
   ~Room();
 
   std::string get_room_name() const { return room_name; }
 
-  void add_member(User *user);
+  // Add user to the room, first queueing to it up to replay of the
+  // deliveries in the history, so that it gets every message broadcast
+  // since the oldest of them exactly once.
+  void add_member(User *user, size_t replay = 0);
+  // Remove user from the room without waiting for broadcasts still
+  // delivering to it: the room holds a reference to the user until
+  // none can be.
   void remove_member(User *user);
 
   void broadcast_message(const std::string &sender_username, const std::string &message_text);
 
+  // Function called on each member by for_each_member
+  typedef void (*MemberFn)(const User *user, void *arg);
+
+  // Call fn on every current member. Members that leave meanwhile are
+  // not freed until fn has returned.
+  void for_each_member(MemberFn fn, void *arg) const;
+  size_t get_member_count() const;
+
+  // the deliveries currently in the history, and the bytes they take
+  void get_history_usage(size_t &count, size_t &bytes) const;
+
+  // Append every message broadcast from now on to log, which the room
+  // then owns. Must be called before the room is visible to other threads.
+  void set_log(RoomLog *log) { this->log = log; }
+
+  // Have pool's threads fan out every broadcast made while the room has
+  // at least min_members members. Must be called before the room is
+  // visible to other threads.
+  void set_fanout(FanoutPool *pool, size_t min_members);
+
+  // Put a message read back from the log into the history, without
+  // broadcasting it.
+  void restore(const std::string &sender_username, const std::string &message_text);
+
 private:
+  // sorted by address, a vector being much cheaper to copy than a set
+  typedef std::vector<User *> UserSet;
+
+  // Marks when a snapshot, and every older one, has been freed.
+  struct Grace;
+
+  // Every member, and, in a room fanned out by a pool, the same members
+  // split into a part for each of its threads (a member always landing
+  // in the same part).
+  struct Members {
+    UserSet all;
+    std::vector<UserSet> parts;
+    std::shared_ptr<Grace> grace;
+
+    Members();
+  };
+  typedef std::shared_ptr<const Members> Snapshot;
+
+  // one broadcast being fanned out by the pool
+  struct Fanout;
+
+  void insert_member(User *user);
+  void publish(const std::shared_ptr<Members> &next, const Members &prev, User *user);
+  static size_t deliver(const UserSet &users, Frame *frame, const std::string &sender_username,
+                        bool text_ok);
+  static void fan_out_part(void *arg, int part);
+  void wait_for_fanouts(size_t limit);
+  bool keeps_history() const { return history_limit > 0 || history_bytes > 0; }
+  void remember(Frame *frame);
+  void forget_oldest();
+  void replay_history(User *user, size_t replay) const;
+
   std::string room_name;
-  pthread_mutex_t lock;
+  pthread_mutex_t lock; // serializes add_member and remove_member
+
+  // The current members. A snapshot is never modified once published:
+  // add_member and remove_member publish a modified copy, so
+  // broadcast_message can fan out to a snapshot without taking lock.
+  // Only access through std::atomic_load/std::atomic_store.
+  //
+  // Each snapshot has a Grace, which holds the Grace of the snapshot
+  // published after it, so a Grace is freed only once its snapshot and
+  // every older one are. A removed member is released by the Grace of
+  // the last snapshot including it. A reader holding an old snapshot
+  // keeps only the Graces after it alive, not their member lists.
+  Snapshot members;
+
+  // The history: history_count frames, the oldest at history_head of
+  // the ring, each holding a reference. history_lock is held while
+  // broadcast_message adds to it and takes the members snapshot, and
+  // while a replaying add_member copies from it and publishes the new
+  // member, so each delivery is either replayed or fanned out to them.
+  size_t history_limit;
+  size_t history_bytes;
+  mutable pthread_mutex_t history_lock;
+  std::vector<Frame *> history;
+  size_t history_head;
+  size_t history_count;
+  size_t history_used; // bytes taken by the frames in the history
+
+  RoomLog *log; // nullptr if broadcasts are not logged
 
-  typedef std::set<User *> UserSet;
-  UserSet members;
+  FanoutPool *fanout_pool; // nullptr if the sender always fans out
+  size_t fanout_min_members;
+  // Broadcasts the pool has not finished fanning out, only changed
+  // with fanout_lock held. A broadcast the sender fans out itself waits
+  // for them, so it overtakes none, and one for the pool waits while
+  // there are MAX_ROOM_FANOUTS, both parking on fanout_done.
+  std::atomic<size_t> fanouts;
+  pthread_mutex_t fanout_lock;
+  pthread_cond_t fanout_done; // broadcast whenever fanouts drops
 };
 
 #endif // ROOM_H
@@ -0,0 +1,593 @@
+/*
+ * Implementation of classes describing the append-only log of the
+ * messages broadcast to a room.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "guard.h"
+#include "metrics.h"
+#include "room_log.h"
+
+namespace {
+
+// suffix of the file name of every log
+const char LOG_SUFFIX[] = ".log";
+
+/*
+ * Stores a 32-bit value big-endian.
+ *
+ * Parameters:
+ *   p - pointer to the 4 bytes to store it in
+ *   value - the value
+ */
+void put_u32(char *p, uint32_t value) {
+  p[0] = static_cast<char>(value >> 24);
+  p[1] = static_cast<char>(value >> 16);
+  p[2] = static_cast<char>(value >> 8);
+  p[3] = static_cast<char>(value);
+}
+
+/*
+ * Loads a 32-bit big-endian value.
+ *
+ * Parameters:
+ *   p - pointer to the 4 bytes holding it
+ *
+ * Returns:
+ *   the value
+ */
+uint32_t get_u32(const char *p) {
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+  return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | u[3];
+}
+
+/*
+ * Continues a 32-bit FNV-1a checksum over more bytes.
+ *
+ * Parameters:
+ *   hash - the checksum of the bytes before these
+ *   p - pointer to the bytes
+ *   n - number of bytes
+ *
+ * Returns:
+ *   the checksum of all the bytes so far
+ */
+uint32_t fnv1a(uint32_t hash, const char *p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    hash ^= static_cast<unsigned char>(p[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// checksum of no bytes
+const uint32_t FNV_BASIS = 2166136261u;
+
+/*
+ * Checks whether a byte may appear as is in the file name of a log.
+ *
+ * Parameters:
+ *   c - the byte
+ *
+ * Returns:
+ *   true for letters, digits, '-', '_' and '.'
+ */
+bool plain_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+    || c == '-' || c == '_' || c == '.';
+}
+
+/*
+ * Finds the value of a hexadecimal digit.
+ *
+ * Parameters:
+ *   c - the digit
+ *
+ * Returns:
+ *   its value, or -1 if c is not one
+ */
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+}
+
+/*
+ * Function to build the path of a room's log.
+ *
+ * Parameters:
+ *   dir - the log directory
+ *   room_name - the name of the room
+ *
+ * Returns:
+ *   the path of the room's log in dir
+ */
+std::string room_log_path(const std::string &dir, const std::string &room_name) {
+  static const char HEX[] = "0123456789ABCDEF";
+  std::string path = dir + "/";
+  for (size_t i = 0; i < room_name.size(); i++) {
+    char c = room_name[i];
+    // a name of only dots would not be a file of its own
+    if (plain_name_char(c) && !(c == '.' && i == 0)) {
+      path += c;
+    } else {
+      path += '%';
+      path += HEX[static_cast<unsigned char>(c) >> 4];
+      path += HEX[static_cast<unsigned char>(c) & 15];
+    }
+  }
+  return path + LOG_SUFFIX;
+}
+
+/*
+ * Function to find the room a file in the log directory is the log of.
+ *
+ * Parameters:
+ *   file_name - name of the file (without the directory)
+ *   room_name - reference to store the name of the room in
+ *
+ * Returns:
+ *   true if the file is a log
+ */
+bool room_log_room_name(const std::string &file_name, std::string &room_name) {
+  size_t suffix_len = sizeof(LOG_SUFFIX) - 1;
+  if (file_name.size() <= suffix_len
+      || file_name.compare(file_name.size() - suffix_len, suffix_len, LOG_SUFFIX) != 0) {
+    return false;
+  }
+  room_name.clear();
+  size_t end = file_name.size() - suffix_len;
+  for (size_t i = 0; i < end; i++) {
+    if (file_name[i] != '%') {
+      room_name += file_name[i];
+      continue;
+    }
+    if (i + 2 >= end || hex_value(file_name[i + 1]) < 0 || hex_value(file_name[i + 2]) < 0) {
+      return false;
+    }
+    room_name += static_cast<char>(hex_value(file_name[i + 1]) * 16 + hex_value(file_name[i + 2]));
+    i += 2;
+  }
+  return true;
+}
+
+/*
+ * Constructor for LogReader object.
+ *
+ * Returns:
+ *   a reader with no log open
+ */
+LogReader::LogReader()
+  : m_data(nullptr)
+  , m_size(0)
+  , m_pos(0) {
+}
+
+/*
+ * Destructor for LogReader object.
+ */
+LogReader::~LogReader() {
+  close();
+}
+
+/*
+ * Function to map a log into memory to read its records.
+ *
+ * Parameters:
+ *   path - the path of the log
+ *
+ * Returns:
+ *   true if the log was opened (an empty log has no records)
+ */
+bool LogReader::open(const std::string &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  m_size = st.st_size;
+  if (m_size > 0) {
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      m_size = 0;
+      return false;
+    }
+    // records are read front to back, once
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(data);
+  }
+  // the mapping stays valid without the descriptor
+  ::close(fd);
+  return true;
+}
+
+/*
+ * Function to unmap the log, if one is open.
+ */
+void LogReader::close() {
+  if (m_data != nullptr) {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+  m_data = nullptr;
+  m_size = 0;
+  m_pos = 0;
+}
+
+/*
+ * Function to read the next record of the log.
+ *
+ * Parameters:
+ *   sender - reference to a view to point at the sender's username
+ *   text - reference to a view to point at the message text
+ *
+ * Returns:
+ *   true if there was another complete record
+ */
+bool LogReader::next(std::string_view &sender, std::string_view &text) {
+  if (m_size - m_pos < LOG_RECORD_HEADER_LEN) {
+    return false;
+  }
+  const char *rec = m_data + m_pos;
+  uint32_t len = get_u32(rec);
+  if (len < LOG_RECORD_HEADER_LEN - 8 || len > m_size - m_pos - 8) {
+    return false;
+  }
+  if (fnv1a(FNV_BASIS, rec + 8, len) != get_u32(rec + 4)) {
+    return false;
+  }
+  size_t sender_len = (static_cast<unsigned char>(rec[8]) << 8) | static_cast<unsigned char>(rec[9]);
+  size_t body_len = len - (LOG_RECORD_HEADER_LEN - 8);
+  if (sender_len > body_len) {
+    return false;
+  }
+  sender = std::string_view(rec + LOG_RECORD_HEADER_LEN, sender_len);
+  text = std::string_view(rec + LOG_RECORD_HEADER_LEN + sender_len, body_len - sender_len);
+  m_pos += 8 + len;
+  return true;
+}
+
+/*
+ * Constructor for RoomLog object.
+ *
+ * Parameters:
+ *   writer - pointer to the LogWriter that writes the log
+ *   path - the path of the log
+ *   fd - the log, open for appending
+ */
+RoomLog::RoomLog(LogWriter *writer, const std::string &path, int fd)
+  : m_writer(writer)
+  , m_path(path)
+  , m_fd(fd)
+  , m_queued(false) {
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+/*
+ * Destructor for RoomLog object. The LogWriter must be done with it.
+ */
+RoomLog::~RoomLog() {
+  close(m_fd);
+  pthread_mutex_destroy(&m_lock);
+}
+
+/*
+ * Function to open the log of a room.
+ *
+ * Parameters:
+ *   writer - pointer to the LogWriter to write the log
+ *   dir - the log directory
+ *   room_name - the name of the room
+ *
+ * Returns:
+ *   the new RoomLog, or nullptr if the file could not be opened
+ */
+RoomLog *RoomLog::open(LogWriter *writer, const std::string &dir, const std::string &room_name) {
+  std::string path = room_log_path(dir, room_name);
+  int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  return new RoomLog(writer, path, fd);
+}
+
+/*
+ * Function to replay the records already in the log, and cut off a
+ * record left incomplete at its end.
+ *
+ * Parameters:
+ *   keep - number of records, from the end, to call fn on
+ *   fn - function to call with each of them, oldest first
+ *   arg - passed on to fn
+ *
+ * Returns:
+ *   the number of complete records in the log
+ */
+size_t RoomLog::recover(size_t keep, RecordFn fn, void *arg) {
+  LogReader reader;
+  if (!reader.open(m_path)) {
+    return 0;
+  }
+  // count them first, so only the ones kept are handed over
+  std::string_view sender, text;
+  size_t count = 0;
+  while (reader.next(sender, text)) {
+    count++;
+  }
+  if (reader.get_offset() < reader.get_size()) {
+    std::cerr << "Truncating torn record at offset " << reader.get_offset()
+              << " of " << m_path << std::endl;
+    if (ftruncate(m_fd, reader.get_offset()) != 0) {
+      std::cerr << "Error truncating " << m_path << ": " << strerror(errno) << std::endl;
+    }
+  }
+
+  size_t skip = (keep < count) ? count - keep : 0;
+  reader.open(m_path);
+  for (size_t i = 0; i < count && reader.next(sender, text); i++) {
+    if (i >= skip) {
+      fn(sender, text, arg);
+    }
+  }
+  return count;
+}
+
+/*
+ * Function to append a record of a broadcast to the log. The record
+ * is only put in memory; the LogWriter writes it out.
+ *
+ * Parameters:
+ *   sender - the username of the sender
+ *   text - the message text
+ */
+void RoomLog::append(const std::string &sender, const std::string &text) {
+  size_t sender_len = (sender.size() < MAX_LOG_SENDER) ? sender.size() : MAX_LOG_SENDER;
+  char hdr[LOG_RECORD_HEADER_LEN];
+  put_u32(hdr, (LOG_RECORD_HEADER_LEN - 8) + sender_len + text.size());
+  hdr[8] = static_cast<char>(sender_len >> 8);
+  hdr[9] = static_cast<char>(sender_len);
+  uint32_t sum = fnv1a(FNV_BASIS, hdr + 8, 2);
+  sum = fnv1a(sum, sender.data(), sender_len);
+  sum = fnv1a(sum, text.data(), text.size());
+  put_u32(hdr + 4, sum);
+
+  bool schedule, now;
+  {
+    Guard guard(m_lock);
+    // m_pending keeps its capacity, so this stops allocating once warm
+    m_pending.append(hdr, sizeof(hdr));
+    m_pending.append(sender.data(), sender_len);
+    m_pending.append(text);
+    now = m_pending.size() >= LOG_WAKE_BYTES;
+    schedule = !m_queued || now;
+    m_queued = true;
+  }
+  if (schedule) {
+    m_writer->schedule(this, now);
+  }
+  metrics_count(LOG_RECORDS);
+}
+
+/*
+ * Helper function for the LogWriter's thread: writes out the records
+ * appended since the last call.
+ *
+ * Returns:
+ *   the number of bytes written
+ */
+size_t RoomLog::write_pending() {
+  {
+    Guard guard(m_lock);
+    m_writing.swap(m_pending);
+    m_queued = false;
+  }
+  size_t done = 0;
+  while (done < m_writing.size()) {
+    ssize_t n = write(m_fd, m_writing.data() + done, m_writing.size() - done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Error writing " << m_path << ": " << strerror(errno) << std::endl;
+      break;
+    }
+    done += n;
+  }
+  m_writing.clear();
+  return done;
+}
+
+/*
+ * Helper function for the LogWriter's thread: makes what has been
+ * written to the log durable.
+ *
+ * Returns:
+ *   true if the log was synced
+ */
+bool RoomLog::sync() {
+  if (fdatasync(m_fd) != 0) {
+    std::cerr << "Error syncing " << m_path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Constructor for LogWriter object.
+ *
+ * Returns:
+ *   a writer whose thread has not been started yet
+ */
+LogWriter::LogWriter()
+  : m_sleeping(false)
+  , m_hurry(false)
+  , m_busy(false)
+  , m_stop(false)
+  , m_started(false) {
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_work, NULL);
+  pthread_cond_init(&m_idle, NULL);
+}
+
+/*
+ * Destructor for LogWriter object. Writes out whatever is still
+ * pending, then stops the thread.
+ */
+LogWriter::~LogWriter() {
+  if (m_started) {
+    {
+      Guard guard(m_lock);
+      m_stop = true;
+      pthread_cond_signal(&m_work);
+    }
+    pthread_join(m_thread, NULL);
+  }
+  pthread_cond_destroy(&m_idle);
+  pthread_cond_destroy(&m_work);
+  pthread_mutex_destroy(&m_lock);
+}
+
+/*
+ * Function to start the writer's thread.
+ *
+ * Returns:
+ *   true if the thread was started
+ */
+bool LogWriter::start() {
+  if (pthread_create(&m_thread, NULL, run, this) != 0) {
+    return false;
+  }
+  m_started = true;
+  return true;
+}
+
+/*
+ * Function to hand the thread a log with records to write.
+ *
+ * Parameters:
+ *   log - pointer to the RoomLog (which may already be scheduled, if now)
+ *   now - true if the records should not wait for the commit window
+ */
+void LogWriter::schedule(RoomLog *log, bool now) {
+  Guard guard(m_lock);
+  if (!now || std::find(m_dirty.begin(), m_dirty.end(), log) == m_dirty.end()) {
+    m_dirty.push_back(log);
+  }
+  if (now) {
+    m_hurry = true;
+  }
+  // a thread in its commit window wakes up on its own
+  if (m_sleeping || now) {
+    pthread_cond_signal(&m_work);
+  }
+}
+
+/*
+ * Function to wait until every record appended so far has been
+ * written and synced.
+ */
+void LogWriter::drain() {
+  Guard guard(m_lock);
+  if (!m_dirty.empty()) {
+    m_hurry = true;
+    pthread_cond_signal(&m_work);
+  }
+  while (!m_dirty.empty() || m_busy) {
+    pthread_cond_wait(&m_idle, &m_lock);
+  }
+}
+
+/*
+ * Thread entry point for the writer.
+ *
+ * Parameters:
+ *   arg - pointer to the LogWriter
+ */
+void *LogWriter::run(void *arg) {
+  // the thread's wakeups should not preempt the threads serving clients
+  struct sched_param param = { 0 };
+  pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+  static_cast<LogWriter *>(arg)->write_batches();
+  return nullptr;
+}
+
+/*
+ * Writer loop: each pass writes every log scheduled since the last
+ * one, then syncs them, until stopped with nothing left to write.
+ */
+void LogWriter::write_batches() {
+  while (1) {
+    {
+      Guard guard(m_lock);
+      while (m_dirty.empty() && !m_stop) {
+        m_sleeping = true;
+        pthread_cond_wait(&m_work, &m_lock);
+        m_sleeping = false;
+      }
+      if (m_dirty.empty()) {
+        return; // stopped, and everything is written
+      }
+      // let more appends come in before writing, unless in a hurry
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      uint64_t ns = deadline.tv_nsec + LOG_COMMIT_WINDOW_NS;
+      deadline.tv_sec += ns / 1000000000;
+      deadline.tv_nsec = ns % 1000000000;
+      while (!m_hurry && !m_stop) {
+        if (pthread_cond_timedwait(&m_work, &m_lock, &deadline) == ETIMEDOUT) {
+          break;
+        }
+      }
+      m_hurry = false;
+      // both vectors keep their capacity from pass to pass
+      m_batch.swap(m_dirty);
+      m_busy = true;
+    }
+
+    // write everything before syncing anything, so logs appended to
+    // while one is synced wait for the next pass rather than a sync each
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < m_batch.size(); i++) {
+      bytes += m_batch[i]->write_pending();
+    }
+    metrics_count(LOG_BYTES_WRITTEN, bytes);
+    for (size_t i = 0; i < m_batch.size(); i++) {
+      uint64_t start = metrics_now_ns();
+      if (m_batch[i]->sync()) {
+        metrics_count(LOG_SYNCS);
+        metrics_observe(LOG_SYNC_LATENCY, metrics_now_ns() - start);
+      }
+    }
+    m_batch.clear();
+
+    Guard guard(m_lock);
+    m_busy = false;
+    pthread_cond_broadcast(&m_idle);
+  }
+}
@@ -0,0 +1,172 @@
+/*
+ * Classes describing the append-only log of the messages broadcast to a room.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef ROOM_LOG_H
+#define ROOM_LOG_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+class LogWriter;
+
+// Each room with a log has a file of its own in the log directory,
+// named after the room (with any byte other than a letter, digit, '-',
+// '_' or '.' written as %XX) plus ".log". The file is a sequence of
+// records, one per broadcast:
+//
+//   4 bytes   length of the rest of the record, big-endian
+//   4 bytes   checksum of the rest of the record (32-bit FNV-1a)
+//   2 bytes   length of the sender's username, big-endian
+//             the sender's username
+//             the message text, up to the end of the record
+//
+// A record that is cut short or fails its checksum (a write the server
+// did not finish before it stopped) ends the log, and is truncated away
+// when the log is opened again.
+
+// bytes before the sender's username in a record
+const size_t LOG_RECORD_HEADER_LEN = 10;
+
+// longest username that is logged (longer ones are cut short)
+const size_t MAX_LOG_SENDER = 65535;
+
+// How long the writer gathers appends before a pass, once one comes in
+// while it is idle, and how many bytes pending in one log cut that short
+const uint64_t LOG_COMMIT_WINDOW_NS = 5000000;
+const size_t LOG_WAKE_BYTES = 256 * 1024;
+
+// The path of the log of a room in dir, and the room a file in the log
+// directory is the log of (false if it is not a log).
+std::string room_log_path(const std::string &dir, const std::string &room_name);
+bool room_log_room_name(const std::string &file_name, std::string &room_name);
+
+// A LogReader maps a log file into memory and walks its records, so
+// replaying a log copies nothing but what the caller keeps. It sees the
+// file as it was when opened.
+class LogReader {
+public:
+  LogReader();
+  ~LogReader();
+
+  bool open(const std::string &path);
+  void close();
+
+  // Read the next record, returning false at the end of the log (or at
+  // a torn record). The views point into the mapping, and stay valid
+  // until the reader is closed.
+  bool next(std::string_view &sender, std::string_view &text);
+
+  // offset just past the last record read, and the size of the file
+  size_t get_offset() const { return m_pos; }
+  size_t get_size() const { return m_size; }
+
+private:
+  // prohibit value semantics
+  LogReader(const LogReader &);
+  LogReader &operator=(const LogReader &);
+
+  const char *m_data;
+  size_t m_size;
+  size_t m_pos;
+};
+
+// A RoomLog appends the messages broadcast to one room to its file.
+// append only encodes the record into a buffer in memory; the
+// LogWriter's thread writes it out and syncs it to disk, along with
+// everything else appended to any log meanwhile (group commit), so a
+// broadcast never waits for the disk.
+class RoomLog {
+public:
+  // Called with each record replayed by recover
+  typedef void (*RecordFn)(std::string_view sender, std::string_view text, void *arg);
+
+  // Open (creating if needed) the log of a room in dir, to be written
+  // by writer. Returns nullptr if the file could not be opened.
+  static RoomLog *open(LogWriter *writer, const std::string &dir, const std::string &room_name);
+  ~RoomLog();
+
+  // Read back the records already in the log, calling fn on the last
+  // keep of them, and truncate any torn record at its end. Must be
+  // called before anything is appended. Returns the number of records.
+  size_t recover(size_t keep, RecordFn fn, void *arg);
+
+  // Add a record to the log; never blocks on I/O.
+  void append(const std::string &sender, const std::string &text);
+
+private:
+  friend class LogWriter;
+
+  RoomLog(LogWriter *writer, const std::string &path, int fd);
+
+  // prohibit value semantics
+  RoomLog(const RoomLog &);
+  RoomLog &operator=(const RoomLog &);
+
+  size_t write_pending();
+  bool sync();
+
+  LogWriter *m_writer;
+  std::string m_path;
+  int m_fd;
+  pthread_mutex_t m_lock; // must be held while accessing m_pending and m_queued
+  std::string m_pending;  // records appended and not yet written
+  std::string m_writing;  // records being written by the writer thread
+  bool m_queued;          // the writer has this log to write
+};
+
+// A LogWriter runs the thread that writes and syncs every RoomLog
+// given to it. Each pass takes every log with records pending, writes
+// them all, and then syncs each to disk, so however many broadcasts
+// came in since the previous pass share the cost of one sync per log.
+// Only an append to an idle writer wakes the thread; it then waits
+// LOG_COMMIT_WINDOW_NS for more before its pass, so under load a
+// broadcast rarely pays for a wakeup.
+class LogWriter {
+public:
+  LogWriter();
+  // Stops the thread once everything appended has been written.
+  // Every RoomLog given to it must still exist.
+  ~LogWriter();
+
+  // Start the thread, returning false if it could not be created.
+  bool start();
+
+  // Have the thread write log's pending records (called by append),
+  // in its next pass or, with now, as soon as it can.
+  void schedule(RoomLog *log, bool now);
+
+  // Wait until every record appended so far is on disk.
+  void drain();
+
+private:
+  // prohibit value semantics
+  LogWriter(const LogWriter &);
+  LogWriter &operator=(const LogWriter &);
+
+  static void *run(void *arg);
+  void write_batches();
+
+  pthread_mutex_t m_lock; // must be held while accessing the members below
+  pthread_cond_t m_work;  // signalled to wake the thread (see m_sleeping)
+  pthread_cond_t m_idle;  // broadcast after each pass
+  std::vector<RoomLog *> m_dirty; // logs with records waiting for a pass
+  std::vector<RoomLog *> m_batch; // the logs of the current pass (thread only)
+  bool m_sleeping;                // the thread waits for a log to be scheduled
+  bool m_hurry;                   // the next pass should not wait out the window
+  bool m_busy;                    // a pass is under way
+  bool m_stop;
+  bool m_started;
+  pthread_t m_thread;
+};
+
+#endif // ROOM_LOG_H
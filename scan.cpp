@@ -0,0 +1,169 @@
+/*
+ * Implementation of functions for finding the delimiters of text protocol lines.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cstdint>
+#include "scan.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/*
+ * Records what one block of a line holds, given bit masks of where in
+ * it the '\n', ':' and '\r' bytes are (bit i for the byte at base + i).
+ *
+ * Parameters:
+ *   base - offset of the block in the line
+ *   nl - mask of the block's '\n' bytes
+ *   colon - mask of the block's ':' bytes
+ *   cr - mask of the block's '\r' bytes
+ *   scan - reference to the LineScan to update
+ *
+ * Returns:
+ *   true if the block holds the line's first '\n'
+ */
+inline bool take_masks(size_t base, uint32_t nl, uint32_t colon, uint32_t cr, LineScan &scan) {
+  if (nl != 0) {
+    // only what comes before the newline is part of the line
+    uint32_t before = (nl & (0u - nl)) - 1;
+    colon &= before;
+    cr &= before;
+  }
+  if (colon != 0 && scan.colon == NO_POS) {
+    scan.colon = base + __builtin_ctz(colon);
+  }
+  if (cr != 0 && scan.cr == NO_POS) {
+    scan.cr = base + __builtin_ctz(cr);
+  }
+  if (nl != 0) {
+    scan.end = base + __builtin_ctz(nl) + 1;
+    scan.scanned = scan.end;
+    return true;
+  }
+  return false;
+}
+
+#ifdef __SSE2__
+/*
+ * Scans a line 32 bytes at a time, while at least 32 are left.
+ *
+ * Parameters:
+ *   line - pointer to the line
+ *   len - number of bytes of it to scan
+ *   scan - reference to the LineScan to update
+ *
+ * Returns:
+ *   true if the first '\n' was found
+ */
+__attribute__((target("avx2")))
+bool scan_avx2(const char *line, size_t len, LineScan &scan) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  size_t i = scan.scanned;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line + i));
+    uint32_t nl_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    uint32_t colon_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon));
+    uint32_t cr_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+    if (take_masks(i, nl_mask, colon_mask, cr_mask, scan)) {
+      return true;
+    }
+  }
+  scan.scanned = i;
+  return false;
+}
+
+/*
+ * Scans a line 16 bytes at a time, while at least 16 are left.
+ *
+ * Parameters:
+ *   line - pointer to the line
+ *   len - number of bytes of it to scan
+ *   scan - reference to the LineScan to update
+ *
+ * Returns:
+ *   true if the first '\n' was found
+ */
+bool scan_sse2(const char *line, size_t len, LineScan &scan) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i cr = _mm_set1_epi8('\r');
+  size_t i = scan.scanned;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + i));
+    uint32_t nl_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    uint32_t colon_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, colon));
+    uint32_t cr_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+    if (take_masks(i, nl_mask, colon_mask, cr_mask, scan)) {
+      return true;
+    }
+  }
+  scan.scanned = i;
+  return false;
+}
+
+/*
+ * Checks whether the CPU has AVX2. This may run before libgcc's own
+ * static constructors, so it sets up the CPU model itself.
+ *
+ * Returns:
+ *   true if AVX2 instructions can be used
+ */
+bool has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+// checked once, at startup
+const bool HAS_AVX2 = has_avx2();
+#endif
+
+}
+
+/*
+ * Function to find the first '\n' of a line, and the first ':' and
+ * '\r' before it.
+ *
+ * Parameters:
+ *   line - pointer to the line
+ *   len - number of bytes of it that can be scanned
+ *   scan - reference to the LineScan holding what earlier calls found
+ *
+ * Returns:
+ *   true if the line's first '\n' has been found
+ */
+bool scan_line(const char *line, size_t len, LineScan &scan) {
+  if (scan.end != NO_POS) {
+    return true;
+  }
+#ifdef __SSE2__
+  if (HAS_AVX2 && scan_avx2(line, len, scan)) {
+    return true;
+  }
+  if (scan_sse2(line, len, scan)) {
+    return true;
+  }
+#endif
+  // the bytes left over (all of them without SSE2)
+  for (size_t i = scan.scanned; i < len; i++) {
+    char c = line[i];
+    if (c == '\n') {
+      scan.end = scan.scanned = i + 1;
+      return true;
+    } else if (c == ':' && scan.colon == NO_POS) {
+      scan.colon = i;
+    } else if (c == '\r' && scan.cr == NO_POS) {
+      scan.cr = i;
+    }
+  }
+  scan.scanned = len;
+  return false;
+}
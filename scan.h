@@ -0,0 +1,41 @@
+/*
+ * Functions for finding the delimiters of text protocol lines.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+
+// A line of the text protocol is valid only if it ends in its first
+// '\n', has no '\r' but (maybe) the one right before it, and has a ':'
+// separating the tag from the payload. scan_line finds all three in one
+// pass, comparing 32 bytes at a time with AVX2 where the CPU has it,
+// 16 at a time with SSE2 otherwise, or a byte at a time on other
+// architectures.
+
+// offset meaning "not found"
+const size_t NO_POS = static_cast<size_t>(-1);
+
+// What scan_line has found in a line; offsets are from its start.
+struct LineScan {
+  size_t scanned; // bytes scanned so far
+  size_t end;     // offset just past the first '\n', or NO_POS
+  size_t colon;   // offset of the first ':' before the first '\n', or NO_POS
+  size_t cr;      // offset of the first '\r' before the first '\n', or NO_POS
+
+  LineScan() : scanned(0), end(NO_POS), colon(NO_POS), cr(NO_POS) { }
+};
+
+// Scan the first len bytes of line for its delimiters, picking up where
+// an earlier call with the same LineScan left off (line must not have
+// changed, though it may have moved or grown since). Returns true once
+// the first '\n' has been found.
+bool scan_line(const char *line, size_t len, LineScan &scan);
+
+#endif // SCAN_H
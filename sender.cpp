@@ -11,6 +11,9 @@
 #include <string>
 #include <sstream>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
 #include "csapp.h"
 #include "message.h"
 #include "connection.h"
@@ -21,12 +24,12 @@
  *
  * Parameters:
  *   connection - Connection object representing conection between receiver and server
+ *   response - reference to the Message to store the response in
  * 
  * Returns:
  *   true if response from server is OK (no errors)
  */
-bool handleResponse(Connection &connection) {
-  Message response;
+bool handleResponse(Connection &connection, Message &response) {
   if (!connection.receive(response)) {
     if (connection.get_last_result() == Connection::INVALID_MSG) {
       std::cerr << "Invalid message" << std::endl;
@@ -46,6 +49,78 @@ bool handleResponse(Connection &connection) {
   return true;
 }
 
+/*
+ * Function to handle message responses from server.
+ *
+ * Parameters:
+ *   connection - Connection object representing conection between receiver and server
+ * 
+ * Returns:
+ *   true if response from server is OK (no errors)
+ */
+bool handleResponse(Connection &connection) {
+  Message response;
+  return handleResponse(connection, response);
+}
+
+/*
+ * Function to handle the next acknowledgement the server sends a
+ * pipelined sender, printing the error if a command failed.
+ *
+ * Parameters:
+ *   connection - reference to Connection object
+ *   acked - reference to the number of the last command acknowledged,
+ *           updated from the acknowledgement
+ *
+ * Returns:
+ *   true if the acknowledgement was received
+ */
+bool handleAck(Connection &connection, uint64_t &acked) {
+  Message response;
+  if (!connection.receive(response)) {
+    std::cerr << "Failed to receive response from the server" << std::endl;
+    return false;
+  }
+  const char *data = response.data.c_str();
+  char *end;
+  if (response.tag == TAG_ERR) {
+    // err:N:reason
+    uint64_t seq = strtoull(data, &end, 10);
+    if (end == data || *end != ':') {
+      std::cerr << response.data << std::endl;
+      return false;
+    }
+    std::cerr << "command " << seq << ": " << end + 1 << std::endl;
+    acked = seq;
+    return true;
+  }
+  size_t prefix_len = strlen(PIPELINE_ACK_PREFIX);
+  if (response.tag != TAG_OK || response.data.compare(0, prefix_len, PIPELINE_ACK_PREFIX) != 0) {
+    std::cerr << "Failed to receive OK from server" << std::endl;
+    return false;
+  }
+  acked = strtoull(data + prefix_len, nullptr, 10);
+  return true;
+}
+
+/*
+ * Function to check whether a reply from the server can be received
+ * without waiting.
+ *
+ * Parameters:
+ *   connection - reference to Connection object
+ *
+ * Returns:
+ *   true if receive won't block
+ */
+bool replyWaiting(Connection &connection) {
+  if (connection.has_message()) {
+    return true;
+  }
+  struct pollfd pfd = { connection.get_fd(), POLLIN, 0 };
+  return poll(&pfd, 1, 0) > 0;
+}
+
 /*
 * Function to handle a sender joining a room and associated errors.
 *
@@ -137,6 +212,80 @@ void handleMessage(const std::string& message, Connection& connection) {
   }
 }
 
+/*
+* Function to run a pipelined sender: commands are sent as soon as they
+* are read, with up to window of them waiting for the server's
+* acknowledgement, until the sender quits (or its input ends).
+*
+* Parameters:
+*   connection - reference to Connection object of the logged in sender
+*   window - the most commands that may be unacknowledged at once
+*
+* Returns:
+*   0 once every command has been acknowledged
+*   1 if the server stopped replying
+*/
+int runPipelined(Connection &connection, uint64_t window) {
+  std::string room = "";
+  uint64_t sent = 0;  // commands sent so far (the last one's number)
+  uint64_t acked = 0; // the last of them the server acknowledged
+  bool quit = false;
+  while (!quit) {
+    std::string message;
+    std::string tag;
+    if (!std::getline(std::cin, message)) {
+      // end of input: quit once everything sent has been handled
+      tag = "/quit";
+    }
+    std::stringstream ss(message);
+    if (tag.empty()) {
+      ss >> tag;
+    }
+    if (tag.empty()) {
+      continue;
+    }
+    bool command = tag[0] == '/';
+    if (command && tag != "/join" && tag != "/leave" && tag != "/quit") {
+      std::cerr << "Invalid command." << std::endl;
+      continue;
+    }
+
+    // wait for room in the window
+    while (sent - acked >= window) {
+      if (!handleAck(connection, acked)) {
+        connection.close();
+        return 1;
+      }
+    }
+    if (tag == "/quit") {
+      handleQuit(connection);
+      quit = true;
+    } else if (command) {
+      handleCommand(tag, room, connection, ss);
+    } else {
+      handleMessage(message, connection);
+    }
+    sent++;
+
+    // take in whatever acknowledgements have already arrived
+    while (acked < sent && replyWaiting(connection)) {
+      if (!handleAck(connection, acked)) {
+        connection.close();
+        return 1;
+      }
+    }
+  }
+
+  // the reply to the quit acknowledges everything
+  while (acked < sent) {
+    if (!handleAck(connection, acked)) {
+      connection.close();
+      return 1;
+    }
+  }
+  connection.close();
+  return 0;
+}
 
 /*
 * Main Function which runs the sender client of the server.
@@ -150,11 +299,23 @@ void handleMessage(const std::string& message, Connection& connection) {
 *   1 if the sender throws an error
 */
 int main(int argc, char **argv) {
-  if (argc != 4) {
-    std::cerr << "Usage: ./sender [server_address] [port] [username]\n";
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: ./sender [server_address] [port] [username] [pipeline depth]\n";
     return 1;
   }
 
+  // optionally, keep up to this many commands in flight
+  uint64_t window = 0;
+  std::string login_payload = argv[3];
+  if (argc == 5) {
+    window = strtoull(argv[4], nullptr, 10);
+    if (window == 0) {
+      std::cerr << "Pipeline depth must be a positive number" << std::endl;
+      return 1;
+    }
+    login_payload += ";" LOGIN_OPTION_PIPELINE;
+  }
+
   std::string room = "";
 
   Connection connection;
@@ -164,7 +325,7 @@ int main(int argc, char **argv) {
   }
 
   // handling sender login
-  Message slogin_msg(TAG_SLOGIN, argv[3]);
+  Message slogin_msg(TAG_SLOGIN, login_payload);
   if(!connection.send(slogin_msg)) {
     std::cerr << "Failed to send slogin request" << std::endl;
     connection.close();
@@ -172,10 +333,17 @@ int main(int argc, char **argv) {
   }
 
   // check the server's response
-  if (!handleResponse(connection)) {
+  Message login_response;
+  if (!handleResponse(connection, login_response)) {
     connection.close();
     return 1;
   }
+  if (window > 0) {
+    if (login_response.data.find(";" LOGIN_OPTION_PIPELINE) != std::string::npos) {
+      return runPipelined(connection, window);
+    }
+    std::cerr << "Server does not support pipelining, sending one command at a time" << std::endl;
+  }
 
   // only proceeds here if okay signal sent!
 
@@ -8,18 +8,36 @@
  */
 
 #include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <unistd.h>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <set>
 #include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <cctype>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
 #include "message.h"
+#include "frame.h"
 #include "connection.h"
 #include "user.h"
 #include "room.h"
+#include "room_log.h"
 #include "guard.h"
+#include "session.h"
+#include "reactor.h"
+#include "worker_pool.h"
+#include "metrics.h"
+#include "slab.h"
 #include "server.h"
 
 ////////////////////////////////////////////////////////////////////////
@@ -30,51 +48,94 @@
 typedef struct ConnInfo {
   Connection *conn;
   Server *server;
+  Message incoming_msg; // reused for every message, so its storage is too
+  Message reply;
+  std::vector<Frame *> replies; // replies to pipelined messages, sent together
+  Message ack; // a pipelined sender's acknowledgement of them
 } ConnInfo;
 
 /*
-* Helper function to send error message to clients.
+* Helper function to send a Session's reply to the client.
 *
 * Parameters:
-*   payload - string holding the error message to send
+*   reply - reference to the Message to send (nothing is sent if its tag is empty)
 *   conn - pointer to the Connection object to send the message through
 *
 * Returns:
-*   true if the error message is succesfully sent
+*   true if the reply is succesfully sent (or there was nothing to send)
 */
-bool sendError(std::string payload, Connection *conn) {
-  Message error(TAG_ERR, payload);
-  return conn->send(error); 
-};
+bool sendReply(Message &reply, Connection *conn) {
+  if (reply.tag == TAG_NONE) {
+    return true;
+  }
+  return conn->send(reply);
+}
 
 /*
-* Helper function to send OK message to clients.
+* Helper function to receive one message from the client and let the
+* Session process it (or the failure to receive it) into info->reply.
 *
 * Parameters:
-*   payload - string holding the OK message to send
-*   conn - pointer to the Connection object to send the message through
+*   info - pointer to the ConnInfo struct
+*   session - reference to the client's Session
 *
 * Returns:
-*   true if the OK message is succesfully sent
+*   true if the connection should stay open
 */
-bool sendOK(std::string payload, Connection *conn) {
-  Message okay(TAG_OK, payload);
-  return conn->send(okay); 
+bool handleNext(ConnInfo *info, Session &session) {
+  if (!(info->conn->receive(info->incoming_msg))) {
+    return session.handle_error(info->conn->get_last_result(), info->reply);
+  }
+  return session.handle(info->incoming_msg, info->reply);
 }
 
 /*
-* Helper function to help tear down the client (remove it cleanly from the server)
+* Helper function to receive one message from the client, along with
+* any others it pipelined that were read with it, let the Session
+* process them, and send the replies.
 *
 * Parameters:
-*   user - pointer to the user (client) which is being removed
 *   info - pointer to the ConnInfo struct
+*   session - reference to the client's Session
+*
+* Returns:
+*   true if the connection should stay open
 */
-void tear_down_client(User* user, ConnInfo* info) {
-  // remove the user from the room
-  if (!user->room.empty()) {
-    Room* room = info->server->find_or_create_room(user->room);
-    room->remove_member(user);
+bool receiveAndHandle(ConnInfo *info, Session &session) {
+  Connection *conn = info->conn;
+  Session::State state = session.get_state();
+  bool keep_open = handleNext(info, session);
+  // handle everything else already buffered before replying to any of
+  // it (stopping at a login, join or change of framing, which the
+  // caller has to see first)
+  while (keep_open && session.get_state() == state &&
+         session.get_framing() == conn->get_framing() && conn->has_message()) {
+    if (info->reply.tag != TAG_NONE) {
+      info->replies.push_back(Frame::create(info->reply));
+    }
+    keep_open = handleNext(info, session);
   }
+  bool acked = session.take_ack(info->ack);
+  if (info->replies.empty() && !acked) {
+    if (!sendReply(info->reply, conn)) {
+      return false;
+    }
+  } else {
+    if (info->reply.tag != TAG_NONE) {
+      info->replies.push_back(Frame::create(info->reply));
+    }
+    if (acked) {
+      info->replies.push_back(Frame::create(info->ack));
+    }
+    if (!conn->send_batch(info->replies)) {
+      return false;
+    }
+  }
+  // binary framing starts after the reply to the login that asked for it
+  if (session.get_framing() != info->conn->get_framing()) {
+    conn->set_framing(session.get_framing(), info->server->get_options().max_payload);
+  }
+  return keep_open;
 }
 
 /*
@@ -93,252 +154,330 @@ void cleanup(ConnInfo* info) {
   }
 }
 
+////////////////////////////////////////////////////////////////////////
+// Client thread functions
+////////////////////////////////////////////////////////////////////////
+
 /*
-* Helper function to handle possible sender commands when the sender is in a room
+* Client thread function to handle server-sender relationship
 *
 * Parameters:
 *   info - pointer to the ConnInfo struct
-*   user - pointer to User object
-*   incoming_msg - Message holding the message from the sender
-*   room - reference to pointer to the room the sender is in
-* 
-* Returns:
-*   true if the command is succesfully processed
+*   session - reference to the Session of this logged in sender
 */
-bool handleRoomExists(ConnInfo *info, User *user, Message incoming_msg, Room*& room) {
-  if (incoming_msg.tag == TAG_JOIN) {
-    room->remove_member(user);
-    room = info->server->find_or_create_room(incoming_msg.data);
-    room->add_member(user);
-    if (!sendOK("joining room", info->conn)) {
-      room->remove_member(user);
-      return false;
+void chat_with_sender(ConnInfo *info, Session &session) {
+  // infinite loop unless error or quit
+  while (receiveAndHandle(info, session)) {
+  }
+}
+
+/*
+* Client thread function to handle server-receiver relationship
+*
+* Parameters:
+*   info - pointer to the ConnInfo struct
+*   session - reference to the Session of this logged in receiver
+*/
+void chat_with_receiver(ConnInfo *info, Session &session) {
+  // NEED TO JOIN ROOM BEFORE ALL OTHER OPERATIONS
+  if (!receiveAndHandle(info, session)) {
+    return;
+  }
+
+  User *user = session.get_user();
+  std::vector<Frame *> batch;
+  std::vector<uint64_t> created;
+  while (1) {
+    if (user->mqueue.is_overrun()) {
+      // fell too far behind: say why, and disconnect
+      session.handle_overrun(info->reply);
+      sendReply(info->reply, info->conn);
+      return;
     }
-  } else if (incoming_msg.tag == TAG_SENDALL) {
-    room->broadcast_message(user->username, incoming_msg.data);
-    if (!sendOK("broadcasting message", info->conn)) {
-      return false;
-    }  
-  } else if (incoming_msg.tag == TAG_LEAVE) {
-    room->remove_member(user);
-    room = nullptr;
-    if (!sendOK("leaving the room", info->conn)) {
-      return false;
+
+    // sleep until a message is queued or the receiver's socket
+    // becomes readable (a join or leave, or the client hanging up),
+    // unless what the client sent is already buffered
+    Frame *frame = info->conn->has_message() ? nullptr : user->mqueue.dequeue(info->conn->get_fd());
+    if (frame == nullptr) {
+      if (!receiveAndHandle(info, session)) {
+        return;
+      }
+      continue;
     }
-  } else {
-    if (!sendError("invalid message", info->conn)) {
-      return false;
+    // send it along with everything else that queued up meanwhile
+    batch.push_back(frame);
+    user->mqueue.dequeue_all(batch);
+    // note when each was broadcast, as send_batch frees them
+    created.clear();
+    for (size_t i = 0; i < batch.size(); i++) {
+      created.push_back(batch[i]->get_created_ns());
     }
+    if (!info->conn->send_batch(batch)) {
+      // ERROR SENDING MESSAGE
+      return;
+    }
+    uint64_t now = metrics_now_ns();
+    for (size_t i = 0; i < created.size(); i++) {
+      metrics_observe(DELIVERY_LATENCY, now - created[i]);
+    }
+    metrics_count(DELIVERIES_SENT, created.size());
   }
-  return true;
 }
 
+namespace {
+
 /*
-* Helper function to handle possible sender commands when the sender is not in a room
+* Serves one client from its login until it disconnects, then frees it
 *
 * Parameters:
 *   info - pointer to the ConnInfo struct
-*   user - pointer to User object
-*   incoming_msg - Message holding the message from the sender
-*   room - reference to pointer to the room the sender is in
-* 
-* Returns:
-*   true if the command is succesfully processed
 */
-bool handleRoomDoesNotExist(ConnInfo *info, User *user, Message incoming_msg, Room*& room) {
-  if (incoming_msg.tag == TAG_JOIN) {
-    room = info->server->find_or_create_room(incoming_msg.data);
-    room->add_member(user);
-    if (!sendOK("joining room", info->conn)) {
-      room->remove_member(user);
-      return false;
+void serve(ConnInfo *info) {
+  // the session's destructor removes the user from its room
+  // before the user is freed
+  {
+    Session session(info->server);
+
+    // First message must be a login
+    if (receiveAndHandle(info, session)) {
+      // start functions for sender and receiver clients
+      if (session.get_state() == Session::SENDER) {
+        chat_with_sender(info, session);
+      } else if (session.get_state() == Session::RECEIVER_AWAIT_JOIN) {
+        chat_with_receiver(info, session);
+      }
     }
-  } else {
-    sendError("You must join a room first", info->conn);
   }
-  return true;
+
+  cleanup(info);
 }
 
 /*
-* Helper function to handle an error receiving a message from a sender client
+* Main function run by every client thread
 *
 * Parameters:
-*   info - pointer to the ConnInfo struct
-* 
+*   arg - generic pointer to any data to be passed to thread
+*/
+void *worker(void *arg) {
+  pthread_detach(pthread_self());
+
+  serve(static_cast<ConnInfo*>(arg));
+  return nullptr;
+}
+
+/*
+* Opens a listening socket with SO_REUSEPORT set, so several can be
+* bound to one port and the kernel spreads connections over them
+* (otherwise like open_listenfd)
+*
+* Parameters:
+*   port - port number to listen on
+*
 * Returns:
-*   true if the error is succesfully processed and the server can continue
+*   the listening socket, or -1 on failure
 */
-bool handleErrorSender(ConnInfo *info) {
-  if (info->conn->get_last_result() == Connection::EOF_OR_ERROR) {
-    sendError("There is an error", info->conn);
-    return false;
-  } else if (info->conn->get_last_result() == Connection::INVALID_MSG) {
-    sendError("The message is invalid.", info->conn);
-    return false;
+int open_reuseport_listenfd(int port) {
+  struct addrinfo hints, *listp;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+  std::string portString = std::to_string(port);
+  if (getaddrinfo(NULL, portString.c_str(), &hints, &listp) != 0) {
+    return -1;
   }
-  sendError("Server failed to receive message", info->conn);
-  return true;
+  int listenfd = -1;
+  for (struct addrinfo *p = listp; p != nullptr; p = p->ai_next) {
+    listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (listenfd < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
+      break;
+    }
+    close(listenfd);
+    listenfd = -1;
+  }
+  freeaddrinfo(listp);
+  if (listenfd >= 0 && ::listen(listenfd, LISTENQ) < 0) {
+    close(listenfd);
+    listenfd = -1;
+  }
+  return listenfd;
+}
+
+/*
+* Function run by a worker pool thread for each client it takes
+*
+* Parameters:
+*   server - pointer to the Server the client connected to
+*   clientfd - the client's socket
+*/
+void serve_pooled(Server *server, int clientfd) {
+  ConnInfo *info = new ConnInfo;
+  info->conn = new Connection(clientfd);
+  info->server = server;
+  serve(info);
+}
+
+/*
+* Function called with each message replayed from a room's log
+*
+* Parameters:
+*   sender - the username of the sender
+*   text - the message text
+*   arg - pointer to the Room the log belongs to
+*/
+void restore_record(std::string_view sender, std::string_view text, void *arg) {
+  static_cast<Room *>(arg)->restore(std::string(sender), std::string(text));
 }
 
 ////////////////////////////////////////////////////////////////////////
-// Client thread functions
+// Metrics page helpers
 ////////////////////////////////////////////////////////////////////////
 
+// upper bounds of the receiver queue depth buckets
+const size_t DEPTH_BOUNDS[] = { 0, 1, 10, 100, 1000, 10000, 100000 };
+const int NUM_DEPTH_BOUNDS = sizeof(DEPTH_BOUNDS) / sizeof(DEPTH_BOUNDS[0]);
+
+// What the metrics page reports about the receivers.
+struct ReceiverStats {
+  std::set<const User *> seen; // receivers already counted
+  size_t by_depth[NUM_DEPTH_BOUNDS + 1];
+  size_t max_depth;
+  std::vector<std::pair<std::string, size_t> > drops; // receivers that dropped any
+
+  ReceiverStats() : max_depth(0) {
+    std::fill(by_depth, by_depth + NUM_DEPTH_BOUNDS + 1, 0);
+  }
+};
+
 /*
-* Client thread function to handle server-sender relationship
+* Room::for_each_member callback counting one receiver into ReceiverStats
 *
 * Parameters:
-*   info - pointer to the ConnInfo struct
-*   user - pointer to the User object for this client
+*   user - pointer to the receiver
+*   arg - pointer to the ReceiverStats
 */
-void chat_with_sender(ConnInfo *info, User *user) {
-  Room* room = nullptr;
-  Message incoming_msg;
-  // infinite loop unless error
-  while (1) {
-    // IF ERROR RECEIVING MESSAGE
-    if (!(info->conn->receive(incoming_msg))) {
-      if (!handleErrorSender(info)) {
-        cleanup(info);
-        return;
-      }
-    } else {
-      // NO ERROR RECEIVING MESSAGE
-      if (incoming_msg.tag == TAG_QUIT) {
-        sendOK("quitting", info->conn);
-        if (room != nullptr) {
-          room->remove_member(user);
-          room = nullptr;
-        }
-        cleanup(info);
-        return;
-      } else if (incoming_msg.tag == TAG_ERR) {
-          sendError(incoming_msg.data, info->conn);
-          cleanup(info);
-          return;
-      } else if (room != nullptr) {
-        if (!handleRoomExists(info, user, incoming_msg, room)) {
-          cleanup(info);
-          return;
-        }
-      } else {
-        //SENDER IS NOT IN A ROOM
-        if (!handleRoomDoesNotExist(info, user, incoming_msg, room)) {
-          cleanup(info);
-          return;
-        }
-      }
-    }
+void count_receiver(const User *user, void *arg) {
+  ReceiverStats *stats = static_cast<ReceiverStats *>(arg);
+  if (!stats->seen.insert(user).second) {
+    return;
+  }
+  size_t depth = user->mqueue.get_depth();
+  int b = 0;
+  while (b < NUM_DEPTH_BOUNDS && depth > DEPTH_BOUNDS[b]) {
+    b++;
+  }
+  stats->by_depth[b]++;
+  stats->max_depth = std::max(stats->max_depth, depth);
+  if (user->mqueue.get_drops() > 0) {
+    stats->drops.push_back(std::make_pair(user->username, user->mqueue.get_drops()));
   }
 }
 
 /*
-* Client thread function to handle server-receiver relationship
+* Helper function to quote a label value for the metrics page
 *
 * Parameters:
-*   info - pointer to the ConnInfo struct
-*   user - pointer to the User object for this client
+*   value - reference to the string to quote
+*
+* Returns:
+*   the value with backslashes, quotes and newlines escaped
 */
-void chat_with_receiver(ConnInfo *info, User *user) {
-  Message msg;
-  // IF ERROR RECEIVING MESSAGE
-  if (!(info->conn->receive(msg))) {
-    sendError("failed to join room", info->conn);
-    tear_down_client(user, info);
-    user = nullptr;
-    cleanup(info);
-    return;
-  } else if (msg.tag != TAG_JOIN) {
-    // NEED TO JOIN ROOM BEFORE ALL OTHER OPERATIONS
-    sendError("Need to join room first", info->conn);
-    tear_down_client(user,info);
-    user = nullptr;
-    cleanup(info);
-    return;
-  } else {
-      // join command is called:
-      user->room = msg.data;
-      // finding pointer to room that this receiver is in
-      Room* room = info->server->find_or_create_room(msg.data);
-      // adding user to the room
-      room->add_member(user);
-
-      if (!sendOK("succesfully joined room.", info->conn)) {
-        tear_down_client(user,info);
-        user = nullptr;
-        cleanup(info);
-        return;
-      };
-
-      while(1) {
-      // take a message off the message queue
-      Message *msg = user->mqueue.dequeue(); 
-      // if a message exists
-      if (msg != nullptr) {
-        // send message
-        if (!info->conn->send(*msg)) {
-          // ERROR SENDING MESSAGE
-          tear_down_client(user, info);
-          user = nullptr;
-          cleanup(info);
-          return;
-        }
-        delete msg;
-      }
+std::string escape_label(const std::string &value) {
+  std::string escaped;
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '\\' || value[i] == '"') {
+      escaped += '\\';
+      escaped += value[i];
+    } else if (value[i] == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += value[i];
     }
   }
-};
-
-namespace {
+  return escaped;
+}
 
 /*
-* Main function run by every client thread
+* Helper function to append the HELP and TYPE lines of a metric
 *
 * Parameters:
-*   arg - generic pointer to any data to be passed to thread
+*   out - reference to the page
+*   name - the metric's name
+*   type - the metric's type
+*   help - the metric's description
 */
-void *worker(void *arg) {
-  pthread_detach(pthread_self());
+void append_header(std::string &out, const char *name, const char *type, const char *help) {
+  out += std::string("# HELP ") + name + " " + help + "\n";
+  out += std::string("# TYPE ") + name + " " + type + "\n";
+}
 
-  ConnInfo* info = static_cast<ConnInfo*>(arg);
+/*
+* Helper function to append a metric with a single value
+*
+* Parameters:
+*   out - reference to the page
+*   name - the metric's name
+*   type - the metric's type
+*   help - the metric's description
+*   value - the metric's value
+*/
+void append_value(std::string &out, const char *name, const char *type, const char *help,
+                  uint64_t value) {
+  append_header(out, name, type, help);
+  out += std::string(name) + " " + std::to_string(value) + "\n";
+}
 
-  Message msg;
-  
-  if (!(info->conn->receive(msg))) {
-    sendError("failed to login", info->conn);
-    cleanup(info);
-    return nullptr;
-  }
-  // First message must be a login
-  if (msg.tag == TAG_SLOGIN || msg.tag == TAG_RLOGIN) {
-    if(!sendOK("logged in", info->conn)) {
-      cleanup(info);
-      return nullptr;
+/*
+* Helper function to append the series of a latency histogram, in seconds
+*
+* Parameters:
+*   out - reference to the page
+*   name - the metric's name
+*   labels - the series' labels (e.g. size="10"), or empty for none
+*   totals - reference to the collected counts
+*   latency - which latency to append
+*/
+void append_latency_series(std::string &out, const std::string &name, const std::string &labels,
+                           const MetricsTotals &totals, Latency latency) {
+  std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t count = 0;
+  char le[32];
+  for (int b = 0; b <= NUM_LATENCY_BOUNDS; b++) {
+    count += totals.latency_buckets[latency][b];
+    if (b < NUM_LATENCY_BOUNDS) {
+      snprintf(le, sizeof(le), "%g", LATENCY_BOUNDS_NS[b] / 1e9);
+    } else {
+      snprintf(le, sizeof(le), "+Inf");
     }
-  } else {
-    sendError("Must login first", info->conn);
-    cleanup(info);
-    return nullptr;
-  }
-
-  User* user = new User(msg.data);
-
-  // start functions for sender and receiver clients 
-  if (msg.tag == TAG_SLOGIN) {
-    chat_with_sender(info, user);
-    info = nullptr;
-  } else if (msg.tag == TAG_RLOGIN) {
-    chat_with_receiver(info, user);
-    info = nullptr;
+    out += name + "_bucket{" + prefix + "le=\"" + le + "\"} " + std::to_string(count) + "\n";
   }
+  std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+  char sum[32];
+  snprintf(sum, sizeof(sum), "%.9f", totals.latency_sum_ns[latency] / 1e9);
+  out += name + "_sum" + suffix + " " + sum + "\n";
+  out += name + "_count" + suffix + " " + std::to_string(count) + "\n";
+}
 
-  if (user != nullptr) {
-    delete user;
-  }
-  if (info != nullptr) {
-    cleanup(info);
-  }
-  return nullptr;
+/*
+* Helper function to append a latency histogram, in seconds
+*
+* Parameters:
+*   out - reference to the page
+*   name - the metric's name
+*   help - the metric's description
+*   totals - reference to the collected counts
+*   latency - which latency to append
+*/
+void append_latency(std::string &out, const char *name, const char *help,
+                    const MetricsTotals &totals, Latency latency) {
+  append_header(out, name, "histogram", help);
+  append_latency_series(out, name, "", totals, latency);
 }
 
 }
@@ -352,33 +491,61 @@ void *worker(void *arg) {
  *
  * Parameters:
  *  port - port number that server will run on
+ *  options - reference to the options controlling connection handling
  *
  * Returns:
  *   a new instance of a Server object
  *   which runs on specified port and with the
  *   mutex initialized.
  */
-Server::Server(int port)
+Server::Server(int port, const ServerOptions &options)
   : m_port(port)
-  , m_ssock(-1) {
-  pthread_mutex_init(&m_lock, NULL);
+  , m_options(options)
+  , m_ssock(-1)
+  , m_admin_sock(-1)
+  , m_log_writer(nullptr)
+  , m_fanout(nullptr) {
+  for (size_t i = 0; i < ROOM_SHARDS; i++) {
+    pthread_rwlock_init(&m_shards[i].lock, NULL);
+  }
 }
 
 /*
  * Destructor for a Server object.
- * Insures that the mutex is destroyed too.
+ * Insures that the room registry locks are destroyed too, and that
+ * everything appended to the room logs is written out.
  */
 Server::~Server() {
-  pthread_mutex_destroy(&m_lock);
+  delete m_log_writer;
+  delete m_fanout;
+  for (size_t i = 0; i < ROOM_SHARDS; i++) {
+    pthread_rwlock_destroy(&m_shards[i].lock);
+  }
 }
 
 /*
- * Opens a listening socket on  server's specified port.
+ * Opens a listening socket on  server's specified port, or one per
+ * event loop if they each accept their own clients.
  *
  * Returns:
  *   true if the listening socket was successfully opened.
  */
 bool Server::listen() {
+  if (m_options.reuse_port && m_options.event_loops > 0) {
+    for (int i = 0; i < m_options.event_loops; i++) {
+      int fd = open_reuseport_listenfd(m_port);
+      if (fd < 0) {
+        for (size_t j = 0; j < m_listen_socks.size(); j++) {
+          close(m_listen_socks[j]);
+        }
+        m_listen_socks.clear();
+        return false;
+      }
+      m_listen_socks.push_back(fd);
+    }
+    m_ssock = m_listen_socks[0];
+    return true;
+  }
   std::string portString = std::to_string(m_port);
   m_ssock = open_listenfd(portString.c_str());
   if (m_ssock < 0) {
@@ -388,9 +555,64 @@ bool Server::listen() {
 }
 
 /*
- * Accepts incoming client connections and creates a thread for each new one.
+ * Opens a listening socket on the server's admin port, if it has one.
+ *
+ * Returns:
+ *   true if there is no admin port or its socket was successfully opened.
+ */
+bool Server::listen_admin() {
+  if (m_options.admin_port == 0) {
+    return true;
+  }
+  std::string portString = std::to_string(m_options.admin_port);
+  m_admin_sock = open_listenfd(portString.c_str());
+  return m_admin_sock >= 0;
+}
+
+/*
+ * Accepts incoming client connections and creates a thread for each new one,
+ * or hands them to a fixed set of event loops or worker threads if either
+ * is enabled.
  */
 void Server::handle_client_requests() {  
+  if (m_admin_sock >= 0) {
+    pthread_t thr_id;
+    if (pthread_create(&thr_id, NULL, run_admin, this) != 0) {
+      std::cerr << "admin thread creation failed" << std::endl;
+      return;
+    }
+  }
+
+  if (m_options.event_loops > 0) {
+    Reactor reactor(this, m_options.event_loops, m_options.io_uring);
+    if (m_options.io_uring && !reactor.is_using_uring()) {
+      std::cerr << "io_uring is not available, using epoll" << std::endl;
+    }
+    if (!m_listen_socks.empty()) {
+      reactor.set_listeners(m_listen_socks);
+    }
+    if (!reactor.start()) {
+      std::cerr << "event loop creation failed" << std::endl;
+      return;
+    }
+    if (!m_listen_socks.empty()) {
+      reactor.wait();
+      return;
+    }
+    reactor.accept_loop(m_ssock);
+    return;
+  }
+
+  if (m_options.worker_threads > 0) {
+    WorkerPool pool(this, m_options.worker_threads, serve_pooled);
+    if (!pool.start()) {
+      std::cerr << "thread creation failed" << std::endl;
+      return;
+    }
+    pool.accept_loop(m_ssock);
+    return;
+  }
+
   while (1){
     // call accept, returns a fd of a TCP socket that the server can use to communicate w client
     int clientfd = accept(m_ssock, NULL, NULL);
@@ -425,15 +647,307 @@ void Server::handle_client_requests() {
  *    a pointer to the room which was found / created with the specified room_name
  */
 Room *Server::find_or_create_room(const std::string &room_name) {
-  // lock the server mutex before modifying
-  Guard guard(m_lock);
-
-  // search for the indicated chat room
-  std::map<std::string, Room*>::iterator room_it = m_rooms.find(room_name);
-  if (room_it != m_rooms.end()) {
-    return room_it->second; // if the Room exists, return the pointer to it
-  } else { // else create a new Room with this name
-    m_rooms[room_name] = new Room(room_name);
-    return m_rooms[room_name];
-  }
-}
\ No newline at end of file
+  RoomShard &shard = shard_for(room_name);
+
+  // almost every join is of a room that already exists,
+  // which only needs the shard's read lock
+  {
+    ReadGuard guard(shard.lock);
+    RoomMap::iterator room_it = shard.rooms.find(room_name);
+    if (room_it != shard.rooms.end()) {
+      return room_it->second;
+    }
+  }
+
+  // else create a new Room with this name, unless another
+  // thread created it since the read lock was released
+  WriteGuard guard(shard.lock);
+  Room *&room = shard.rooms[room_name];
+  if (room == nullptr) {
+    room = new Room(room_name, m_options.history_limit, m_options.history_bytes);
+    if (m_fanout != nullptr) {
+      room->set_fanout(m_fanout, m_options.fanout_min_members);
+    }
+    if (m_log_writer != nullptr) {
+      open_room_log(room);
+    }
+  }
+  return room;
+}
+
+/*
+ * Opens the log directory (creating it if needed), starts the thread
+ * writing the logs, and recreates every room that has a log in it.
+ *
+ * Returns:
+ *   true if there is no log directory, or it was opened
+ */
+bool Server::open_log() {
+  if (m_options.log_dir.empty()) {
+    return true;
+  }
+  if (mkdir(m_options.log_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    return false;
+  }
+  DIR *dir = opendir(m_options.log_dir.c_str());
+  if (dir == nullptr) {
+    return false;
+  }
+  std::vector<std::string> room_names;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string room_name;
+    if (room_log_room_name(entry->d_name, room_name)) {
+      room_names.push_back(room_name);
+    }
+  }
+  closedir(dir);
+
+  m_log_writer = new LogWriter();
+  if (!m_log_writer->start()) {
+    delete m_log_writer;
+    m_log_writer = nullptr;
+    return false;
+  }
+  for (size_t i = 0; i < room_names.size(); i++) {
+    find_or_create_room(room_names[i]);
+  }
+  return true;
+}
+
+/*
+ * Starts the threads fanning out broadcasts to large rooms.
+ *
+ * Returns:
+ *   true if none were asked for, or they all started
+ */
+bool Server::start_fanout() {
+  if (m_options.fanout_threads == 0) {
+    return true;
+  }
+  m_fanout = new FanoutPool(m_options.fanout_threads);
+  if (!m_fanout->start()) {
+    delete m_fanout;
+    m_fanout = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Helper function to open the log of a new room, first replaying what
+ * it already holds into the room's history.
+ *
+ * Parameters:
+ *    room - pointer to the room, not yet visible to other threads
+ */
+void Server::open_room_log(Room *room) {
+  RoomLog *log = RoomLog::open(m_log_writer, m_options.log_dir, room->get_room_name());
+  if (log == nullptr) {
+    std::cerr << "Could not open the log of room " << room->get_room_name()
+              << ": " << strerror(errno) << std::endl;
+    return;
+  }
+  // only as many as the history can hold are worth restoring
+  size_t keep = 0;
+  if (m_options.history_limit > 0) {
+    keep = m_options.history_limit;
+  } else if (m_options.history_bytes > 0) {
+    keep = SIZE_MAX;
+  }
+  log->recover(keep, restore_record, room);
+  room->set_log(log);
+}
+
+/*
+ * Helper function to find which shard of the room registry a room belongs to.
+ *
+ * Parameters:
+ *    room_name - string holding name of the room
+ *
+ * Returns:
+ *    a reference to the shard holding the room (if it exists)
+ */
+Server::RoomShard &Server::shard_for(const std::string &room_name) {
+  size_t hash = std::hash<std::string>()(room_name);
+  return m_shards[hash & (ROOM_SHARDS - 1)];
+}
+
+/*
+ * Appends the metrics page: what every thread has counted, added up,
+ * along with the rooms and the receivers' queues as they are now.
+ *
+ * Parameters:
+ *    out - reference to the string to append the page to
+ */
+void Server::write_metrics(std::string &out) {
+  MetricsTotals totals;
+  metrics_collect(totals);
+
+  append_value(out, "chat_connections_opened_total", "counter",
+               "Client connections opened.", totals.counters[CONNECTIONS_OPENED]);
+  append_value(out, "chat_connections_closed_total", "counter",
+               "Client connections closed.", totals.counters[CONNECTIONS_CLOSED]);
+  append_value(out, "chat_connections_open", "gauge", "Client connections open now.",
+               totals.counters[CONNECTIONS_OPENED] - totals.counters[CONNECTIONS_CLOSED]);
+  append_value(out, "chat_messages_received_total", "counter",
+               "Valid messages received from clients.", totals.counters[MESSAGES_RECEIVED]);
+  append_value(out, "chat_deliveries_queued_total", "counter",
+               "Deliveries handed to receiver queues.", totals.counters[DELIVERIES_QUEUED]);
+  append_value(out, "chat_deliveries_sent_total", "counter",
+               "Deliveries written to receivers.", totals.counters[DELIVERIES_SENT]);
+  append_value(out, "chat_deliveries_dropped_total", "counter",
+               "Deliveries dropped by full receiver queues.", totals.counters[DELIVERIES_DROPPED]);
+
+  // rooms are never freed, so they can be used after the shard lock is released
+  std::vector<std::pair<std::string, Room *> > rooms;
+  for (size_t i = 0; i < ROOM_SHARDS; i++) {
+    ReadGuard guard(m_shards[i].lock);
+    rooms.insert(rooms.end(), m_shards[i].rooms.begin(), m_shards[i].rooms.end());
+  }
+  std::sort(rooms.begin(), rooms.end());
+
+  append_value(out, "chat_rooms", "gauge", "Rooms created.", rooms.size());
+  append_header(out, "chat_room_members", "gauge", "Receivers in each room.");
+  ReceiverStats stats;
+  for (size_t i = 0; i < rooms.size(); i++) {
+    out += "chat_room_members{room=\"" + escape_label(rooms[i].first) + "\"} "
+      + std::to_string(rooms[i].second->get_member_count()) + "\n";
+    rooms[i].second->for_each_member(count_receiver, &stats);
+  }
+  append_header(out, "chat_room_messages_total", "counter", "Messages broadcast to each room.");
+  for (size_t i = 0; i < rooms.size(); i++) {
+    out += "chat_room_messages_total{room=\"" + escape_label(rooms[i].first) + "\"} "
+      + std::to_string(totals.room_messages[rooms[i].second]) + "\n";
+  }
+  if (m_options.history_limit > 0 || m_options.history_bytes > 0) {
+    std::vector<size_t> counts(rooms.size()), bytes(rooms.size());
+    for (size_t i = 0; i < rooms.size(); i++) {
+      rooms[i].second->get_history_usage(counts[i], bytes[i]);
+    }
+    append_header(out, "chat_room_history_messages", "gauge", "Deliveries kept for replay in each room.");
+    for (size_t i = 0; i < rooms.size(); i++) {
+      out += "chat_room_history_messages{room=\"" + escape_label(rooms[i].first) + "\"} "
+        + std::to_string(counts[i]) + "\n";
+    }
+    append_header(out, "chat_room_history_bytes", "gauge", "Bytes of deliveries kept for replay in each room.");
+    for (size_t i = 0; i < rooms.size(); i++) {
+      out += "chat_room_history_bytes{room=\"" + escape_label(rooms[i].first) + "\"} "
+        + std::to_string(bytes[i]) + "\n";
+    }
+  }
+
+  append_header(out, "chat_receivers_by_queue_depth", "gauge",
+                "Receivers with at most le deliveries waiting.");
+  size_t receivers = 0;
+  for (int b = 0; b <= NUM_DEPTH_BOUNDS; b++) {
+    receivers += stats.by_depth[b];
+    std::string le = (b < NUM_DEPTH_BOUNDS) ? std::to_string(DEPTH_BOUNDS[b]) : "+Inf";
+    out += "chat_receivers_by_queue_depth{le=\"" + le + "\"} " + std::to_string(receivers) + "\n";
+  }
+  append_value(out, "chat_receiver_queue_depth_max", "gauge",
+               "Most deliveries waiting for any one receiver.", stats.max_depth);
+  append_header(out, "chat_receiver_dropped_total", "counter",
+                "Deliveries dropped for each connected receiver that has dropped any.");
+  for (size_t i = 0; i < stats.drops.size(); i++) {
+    out += "chat_receiver_dropped_total{user=\"" + escape_label(stats.drops[i].first) + "\"} "
+      + std::to_string(stats.drops[i].second) + "\n";
+  }
+
+  append_latency(out, "chat_request_duration_seconds",
+                 "Time to handle a message received from a client.", totals, REQUEST_LATENCY);
+  append_latency(out, "chat_delivery_latency_seconds",
+                 "Time from a broadcast to its delivery being written to a receiver.",
+                 totals, DELIVERY_LATENCY);
+  append_header(out, "chat_fanout_duration_seconds", "histogram",
+                "Time from a broadcast to its last delivery being queued, by the most members "
+                "of the rooms counted.");
+  for (int s = 0; s <= NUM_FANOUT_SIZE_BOUNDS; s++) {
+    std::string members = (s < NUM_FANOUT_SIZE_BOUNDS) ? std::to_string(FANOUT_SIZE_BOUNDS[s]) : "+Inf";
+    append_latency_series(out, "chat_fanout_duration_seconds", "members=\"" + members + "\"",
+                          totals, static_cast<Latency>(FANOUT_LATENCY + s));
+  }
+
+  if (m_log_writer != nullptr) {
+    append_value(out, "chat_log_records_total", "counter",
+                 "Messages appended to room logs.", totals.counters[LOG_RECORDS]);
+    append_value(out, "chat_log_written_bytes_total", "counter",
+                 "Bytes written to room logs.", totals.counters[LOG_BYTES_WRITTEN]);
+    append_value(out, "chat_log_syncs_total", "counter",
+                 "Room logs synced to disk.", totals.counters[LOG_SYNCS]);
+    append_latency(out, "chat_log_sync_duration_seconds",
+                   "Time to sync one room log to disk.", totals, LOG_SYNC_LATENCY);
+  }
+
+  SlabStats slabs;
+  slab_collect(slabs);
+  append_value(out, "chat_frame_allocs_total", "counter",
+               "Frames allocated from the slab allocator.", slabs.allocs);
+  append_value(out, "chat_frame_remote_frees_total", "counter",
+               "Frames freed by a thread other than the one that allocated them.",
+               slabs.remote_frees);
+  append_value(out, "chat_frames_live", "gauge", "Frames allocated and not yet freed.",
+               slabs.get_live());
+  append_value(out, "chat_frame_live_bytes", "gauge",
+               "Bytes in frames allocated and not yet freed.", slabs.live_bytes);
+  append_value(out, "chat_frame_slab_bytes", "gauge",
+               "Bytes in slabs reserved for frames.", slabs.reserved_bytes);
+}
+
+/*
+ * Thread entry point for the admin port.
+ *
+ * Parameters:
+ *    arg - pointer to the Server
+ */
+void *Server::run_admin(void *arg) {
+  pthread_detach(pthread_self());
+  static_cast<Server *>(arg)->serve_admin();
+  return nullptr;
+}
+
+/*
+ * Serves the metrics page to one HTTP client on the admin port at a
+ * time, forever.
+ */
+void Server::serve_admin() {
+  while (1) {
+    int fd = accept(m_admin_sock, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "Error accepting admin connection" << std::endl;
+      return;
+    }
+    // a client that never finishes its request must not hold up the next
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // only the request line matters; read until the end of the headers
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      request.append(buf, n);
+    }
+
+    std::string body, status;
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+      status = "200 OK";
+      write_metrics(body);
+    } else {
+      status = "404 Not Found";
+      body = "not found; try /metrics\n";
+    }
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+      + "Content-Type: text/plain; version=0.0.4\r\n"
+      + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+      + "Connection: close\r\n\r\n" + body;
+    rio_writen(fd, response.data(), response.size());
+    close(fd);
+  }
+}
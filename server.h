@@ -10,35 +10,126 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <pthread.h>
+#include "framing.h"
+#include "message_queue.h"
+#include "fanout.h"
 class Room;
+class LogWriter;
+
+// Options controlling how the server handles client connections
+struct ServerOptions {
+  // number of epoll event loop threads serving all clients;
+  // 0 means one thread per connection
+  int event_loops;
+
+  // whether the event loops use io_uring rather than epoll (if the
+  // kernel supports it)
+  bool io_uring;
+
+  // whether each event loop accepts on a SO_REUSEPORT listening socket
+  // of its own, with its thread pinned to a CPU
+  bool reuse_port;
+
+  // number of pre-spawned threads serving one client at a time each;
+  // 0 means one thread per connection (ignored with event loops)
+  int worker_threads;
+
+  // largest payload accepted in a binary frame
+  size_t max_payload;
+
+  // most deliveries waiting for each receiver (0 for no limit), and
+  // what happens to deliveries to a receiver that is that far behind
+  size_t queue_limit;
+  MessageQueue::Policy queue_policy;
+
+  // most deliveries each room keeps for receivers joining with a replay
+  // (0 for any number), and the most bytes they may take up (0 for any
+  // number); with neither, rooms keep no history
+  size_t history_limit;
+  size_t history_bytes;
+
+  // directory holding a log of every room's messages, replayed into the
+  // rooms (and their histories) at startup; empty for none
+  std::string log_dir;
+
+  // number of threads fanning out the broadcasts to rooms of at least
+  // fanout_min_members members (0 for none: senders always fan out)
+  int fanout_threads;
+  size_t fanout_min_members;
+
+  // port serving metrics over HTTP; 0 for none
+  int admin_port;
+
+  ServerOptions()
+    : event_loops(0), io_uring(false), reuse_port(false), worker_threads(0), max_payload(DEFAULT_MAX_PAYLOAD)
+    , queue_limit(0), queue_policy(MessageQueue::DROP_OLDEST), history_limit(0), history_bytes(0)
+    , fanout_threads(0), fanout_min_members(DEFAULT_FANOUT_MIN_MEMBERS), admin_port(0) { }
+};
 
 class Server {
 public:
-  Server(int port);
+  Server(int port, const ServerOptions &options = ServerOptions());
   ~Server();
 
   bool listen();
 
+  // Open the admin port, if one was given. handle_client_requests
+  // then serves the metrics page on it from a thread of its own.
+  bool listen_admin();
+
+  // Open the log directory, if one was given, and recreate the rooms
+  // logged in it. Returns false if it cannot be used.
+  bool open_log();
+
+  // Start the threads fanning out broadcasts to large rooms, if any
+  // were asked for. Must be called before any room is created.
+  // Returns false if they could not be started.
+  bool start_fanout();
+
   void handle_client_requests();
 
   Room *find_or_create_room(const std::string &room_name);
 
+  const ServerOptions &get_options() const { return m_options; }
+
+  // Append the metrics page (in the Prometheus text format) to out.
+  void write_metrics(std::string &out);
+
 private:
   // prohibit value semantics
   Server(const Server &);
   Server &operator=(const Server &);
 
-  typedef std::map<std::string, Room *> RoomMap;
+  typedef std::unordered_map<std::string, Room *> RoomMap;
+
+  // The rooms are split by name hash across ROOM_SHARDS maps, each with
+  // its own lock, so joins of different rooms rarely contend and joins
+  // of a room that already exists only share a read lock.
+  static const size_t ROOM_SHARDS = 64; // must be a power of two
+
+  struct RoomShard {
+    pthread_rwlock_t lock;
+    RoomMap rooms;
+  };
+
+  RoomShard &shard_for(const std::string &room_name);
+
+  static void *run_admin(void *arg);
+  void serve_admin();
+  void open_room_log(Room *room);
 
-  // These member variables are sufficient for implementing
-  // the server operations
   int m_port;
+  ServerOptions m_options;
   int m_ssock;
-  RoomMap m_rooms;
-  pthread_mutex_t m_lock;
+  std::vector<int> m_listen_socks; // one per event loop with reuse_port
+  int m_admin_sock;
+  RoomShard m_shards[ROOM_SHARDS];
+  LogWriter *m_log_writer; // nullptr without a log directory
+  FanoutPool *m_fanout;     // nullptr without fan-out threads
 };
 
 #endif // SERVER_H
\ No newline at end of file
@@ -9,30 +9,120 @@
 
 #include <iostream>
 #include <csignal>
+#include <string>
 #include "server.h"
 
 // If you implement the Server class as described by its
 // TODO comments, you should not need to make any changes
 // to this main function.
 
+/*
+ * Prints the usage message for the server.
+ */
+void usage() {
+  std::cerr << "Usage: server_main [--epoll <loops> | --uring <loops> | --threads <workers>]\n"
+            << "                   [--reuseport] [--max-frame <bytes>]\n"
+            << "                   [--queue-cap <frames>] [--queue-policy drop-oldest|drop-newest|disconnect]\n"
+            << "                   [--history <messages>] [--history-bytes <bytes>] [--log-dir <dir>]\n"
+            << "                   [--fanout-threads <threads>] [--fanout-min-members <members>]\n"
+            << "                   [--admin-port <port>]\n"
+            << "                   <port>\n"
+            << "--threads <workers> serves at most <workers> receivers at once (each keeps its\n"
+            << "worker while connected) and refuses clients beyond that: use it only for\n"
+            << "sender-heavy loads, and --epoll or --uring for many receivers.\n";
+}
+
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Usage: server_main <port>\n";
+  ServerOptions options;
+  int argi = 1;
+  while (argi < argc - 1 && argv[argi][0] == '-') {
+    std::string opt = argv[argi];
+    if (opt == "--epoll" && argi + 1 < argc - 1) {
+      options.event_loops = std::stoi(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--uring" && argi + 1 < argc - 1) {
+      options.event_loops = std::stoi(argv[argi + 1]);
+      options.io_uring = true;
+      argi += 2;
+    } else if (opt == "--reuseport") {
+      options.reuse_port = true;
+      argi++;
+    } else if (opt == "--threads" && argi + 1 < argc - 1) {
+      options.worker_threads = std::stoi(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--max-frame" && argi + 1 < argc - 1) {
+      options.max_payload = std::stoul(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--queue-cap" && argi + 1 < argc - 1) {
+      options.queue_limit = std::stoul(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--history" && argi + 1 < argc - 1) {
+      options.history_limit = std::stoul(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--history-bytes" && argi + 1 < argc - 1) {
+      options.history_bytes = std::stoul(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--log-dir" && argi + 1 < argc - 1) {
+      options.log_dir = argv[argi + 1];
+      argi += 2;
+    } else if (opt == "--fanout-threads" && argi + 1 < argc - 1) {
+      options.fanout_threads = std::stoi(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--fanout-min-members" && argi + 1 < argc - 1) {
+      options.fanout_min_members = std::stoul(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--admin-port" && argi + 1 < argc - 1) {
+      options.admin_port = std::stoi(argv[argi + 1]);
+      argi += 2;
+    } else if (opt == "--queue-policy" && argi + 1 < argc - 1) {
+      std::string policy = argv[argi + 1];
+      if (policy == "drop-oldest") {
+        options.queue_policy = MessageQueue::DROP_OLDEST;
+      } else if (policy == "drop-newest") {
+        options.queue_policy = MessageQueue::DROP_NEWEST;
+      } else if (policy == "disconnect") {
+        options.queue_policy = MessageQueue::DISCONNECT;
+      } else {
+        usage();
+        return 1;
+      }
+      argi += 2;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (argi != argc - 1 || options.event_loops < 0 || options.worker_threads < 0
+      || (options.event_loops > 0 && options.worker_threads > 0) || options.fanout_threads < 0
+      || (options.reuse_port && options.event_loops == 0)) {
+    usage();
     return 1;
   }
 
-  int port = std::stoi(argv[1]);
+  int port = std::stoi(argv[argi]);
 
   // ignore SIGPIPE: when the server sends data to the receive client,
   // it may find that the connection has been terminated (e.g., if the
   // receive client exited)
   signal(SIGPIPE, SIG_IGN);
 
-  Server server(port);
+  Server server(port, options);
+  if (!server.start_fanout()) {
+    std::cerr << "Could not start fan-out threads\n";
+    return 1;
+  }
+  if (!server.open_log()) {
+    std::cerr << "Could not open log directory " << options.log_dir << "\n";
+    return 1;
+  }
   if (!server.listen()) {
     std::cerr << "Could not listen on port " << port << "\n";
     return 1;
   }
+  if (!server.listen_admin()) {
+    std::cerr << "Could not listen on admin port " << options.admin_port << "\n";
+    return 1;
+  }
 
   server.handle_client_requests();
 }
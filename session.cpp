@@ -0,0 +1,479 @@
+/*
+ * Implementation of class describing the protocol state of one connected client.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <cctype>
+#include <algorithm>
+#include "message.h"
+#include "user.h"
+#include "room.h"
+#include "server.h"
+#include "metrics.h"
+#include "session.h"
+
+/*
+ * Non-Default constructor for Session object.
+ *
+ * Parameters:
+ *   server - pointer to the Server the client is connected to
+ *
+ * Returns:
+ *   a new Session waiting for the client to log in.
+ */
+Session::Session(Server *server)
+  : m_server(server)
+  , m_state(AWAIT_LOGIN)
+  , m_user(nullptr)
+  , m_pipelined(false)
+  , m_seq(0)
+  , m_acked(0) {
+  metrics_count(CONNECTIONS_OPENED);
+}
+
+/*
+ * Destructor for a Session object.
+ * Removes the user from its rooms and drops the session's reference
+ * to it; the User is freed once no broadcast can still be delivering
+ * to it, which may be after the session is gone.
+ */
+Session::~Session() {
+  leave_room();
+  if (m_user != nullptr) {
+    m_user->unref();
+  }
+  metrics_count(CONNECTIONS_CLOSED);
+}
+
+/*
+ * Process one message from the client.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the client
+ *   reply - reference to the Message to store the reply in; the reply
+ *           tag is left empty if nothing should be sent back
+ *
+ * Returns:
+ *   false if the connection should be closed after sending the reply
+ */
+bool Session::handle(const Message &msg, Message &reply) {
+  uint64_t start = metrics_now_ns();
+  metrics_count(MESSAGES_RECEIVED);
+  bool pipelined = m_pipelined && m_state == SENDER;
+  bool keep_open = dispatch(msg, reply);
+  if (pipelined) {
+    number_reply(reply);
+  }
+  metrics_observe(REQUEST_LATENCY, metrics_now_ns() - start);
+  return keep_open;
+}
+
+/*
+ * Helper function to process one message according to the session's state.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the client
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   false if the connection should be closed after sending the reply
+ */
+bool Session::dispatch(const Message &msg, Message &reply) {
+  reply.clear();
+  switch (m_state) {
+  case AWAIT_LOGIN:
+    return handle_login(msg, reply);
+  case SENDER:
+    return handle_sender(msg, reply);
+  case RECEIVER_AWAIT_JOIN:
+    return handle_receiver_join(msg, reply);
+  case RECEIVER:
+    return handle_receiver(msg, reply);
+  default:
+    return false;
+  }
+}
+
+/*
+ * Process a failure to receive a message from the client.
+ *
+ * Parameters:
+ *   result - the reason the receive failed
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   false if the connection should be closed after sending the reply
+ */
+bool Session::handle_error(Connection::Result result, Message &reply) {
+  bool sender = m_state == SENDER;
+  bool keep_open = false;
+  switch (m_state) {
+  case AWAIT_LOGIN:
+    reply.set(TAG_ERR, "failed to login");
+    break;
+  case RECEIVER_AWAIT_JOIN:
+    reply.set(TAG_ERR, "failed to join room");
+    break;
+  case SENDER:
+    if (result == Connection::EOF_OR_ERROR) {
+      reply.set(TAG_ERR, "There is an error");
+    } else if (result == Connection::INVALID_MSG) {
+      reply.set(TAG_ERR, "The message is invalid.");
+    } else {
+      reply.set(TAG_ERR, "Server failed to receive message");
+      keep_open = true;
+    }
+    break;
+  default:
+    reply.clear();
+    break;
+  }
+  if (!keep_open) {
+    m_state = CLOSED;
+  }
+  if (sender && m_pipelined) {
+    // the line that could not be received still used up a number
+    number_reply(reply);
+  }
+  return keep_open;
+}
+
+/*
+ * Process the receiver's queue having overflowed under the DISCONNECT
+ * policy: the receiver is told why and disconnected.
+ *
+ * Parameters:
+ *   reply - reference to the Message to store the reply in
+ */
+void Session::handle_overrun(Message &reply) {
+  reply.set(TAG_ERR, "too many messages waiting, disconnecting");
+  m_state = CLOSED;
+}
+
+/*
+ * Helper function to handle the first message, which must be a login.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the client
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   true if the client logged in successfully
+ */
+bool Session::handle_login(const Message &msg, Message &reply) {
+  if (msg.tag != TAG_SLOGIN && msg.tag != TAG_RLOGIN) {
+    reply.set(TAG_ERR, "Must login first");
+    m_state = CLOSED;
+    return false;
+  }
+  // the payload is the username, optionally followed by ;options, so
+  // a username cannot contain ';' (everything after one is an option)
+  size_t semi = msg.data.find(';');
+  m_user = new User(msg.data.substr(0, semi));
+  m_state = (msg.tag == TAG_SLOGIN) ? SENDER : RECEIVER_AWAIT_JOIN;
+  if (m_state == RECEIVER_AWAIT_JOIN) {
+    const ServerOptions &options = m_server->get_options();
+    m_user->mqueue.set_limit(options.queue_limit, options.queue_policy);
+  }
+  reply.set(TAG_OK, "logged in");
+  if (semi != std::string::npos) {
+    apply_login_options(msg.data.substr(semi + 1), reply);
+  }
+  return true;
+}
+
+/*
+ * Helper function to apply the options a client gave after its
+ * username at login. Unknown options are ignored; the ones accepted
+ * are echoed back at the end of the reply.
+ *
+ * Parameters:
+ *   options - reference to the ';' separated options
+ *   reply - reference to the login's reply
+ */
+void Session::apply_login_options(const std::string &options, Message &reply) {
+  size_t start = 0;
+  while (start <= options.size()) {
+    size_t end = options.find(';', start);
+    if (end == std::string::npos) {
+      end = options.size();
+    }
+    std::string option = options.substr(start, end - start);
+    if (option == FRAMING_OPTION_BINARY) {
+      m_user->framing = FRAMING_BINARY;
+      reply.data += ";" FRAMING_OPTION_BINARY;
+    } else if (option == LOGIN_OPTION_PIPELINE && m_state == SENDER) {
+      m_pipelined = true;
+      reply.data += ";" LOGIN_OPTION_PIPELINE;
+    }
+    start = end + 1;
+  }
+}
+
+/*
+ * Helper function to turn the reply to a pipelined sender's command
+ * into what that sender expects: errors carry the command's number,
+ * the reply to a quit acknowledges everything, and other replies are
+ * left for take_ack.
+ *
+ * Parameters:
+ *   reply - reference to the reply to the command just handled
+ */
+void Session::number_reply(Message &reply) {
+  m_seq++;
+  if (reply.tag == TAG_ERR) {
+    reply.data = std::to_string(m_seq) + ":" + reply.data;
+    m_acked = m_seq;
+  } else if (m_state == CLOSED) {
+    take_ack(reply);
+  } else {
+    reply.clear();
+  }
+}
+
+/*
+ * Acknowledges every command a pipelined sender sent that has been
+ * handled since the last acknowledgement.
+ *
+ * Parameters:
+ *   ack - reference to the Message to store the acknowledgement in
+ *
+ * Returns:
+ *   false if there is nothing to acknowledge
+ */
+bool Session::take_ack(Message &ack) {
+  if (m_acked == m_seq) {
+    return false;
+  }
+  m_acked = m_seq;
+  ack.set(TAG_OK, PIPELINE_ACK_PREFIX + std::to_string(m_seq));
+  return true;
+}
+
+/*
+ * Gets the framing the client asked for at login.
+ *
+ * Returns:
+ *   the framing to use once the login reply has been sent
+ */
+Framing Session::get_framing() const {
+  return m_user != nullptr ? m_user->framing : FRAMING_TEXT;
+}
+
+/*
+ * Helper function to handle possible sender commands.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the sender
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   false if the connection should be closed after sending the reply
+ */
+bool Session::handle_sender(const Message &msg, Message &reply) {
+  switch (msg.tag) {
+  case TAG_QUIT:
+    leave_room();
+    reply.set(TAG_OK, "quitting");
+    m_state = CLOSED;
+    return false;
+  case TAG_ERR:
+    reply.set(TAG_ERR, msg.data);
+    m_state = CLOSED;
+    return false;
+  case TAG_JOIN:
+    // a sender is in one room at a time
+    leave_room();
+    join_room(msg.data);
+    reply.set(TAG_OK, "joining room");
+    break;
+  case TAG_SENDALL:
+    if (m_rooms.empty()) {
+      // SENDER IS NOT IN A ROOM
+      reply.set(TAG_ERR, "You must join a room first");
+    } else {
+      m_rooms[0]->broadcast_message(m_user->username, msg.data);
+      reply.set(TAG_OK, "broadcasting message");
+    }
+    break;
+  case TAG_LEAVE:
+    if (m_rooms.empty()) {
+      reply.set(TAG_ERR, "You must join a room first");
+    } else {
+      leave_room();
+      reply.set(TAG_OK, "leaving the room");
+    }
+    break;
+  default:
+    reply.set(TAG_ERR, m_rooms.empty() ? "You must join a room first" : "invalid message");
+    break;
+  }
+  return true;
+}
+
+/*
+ * Helper function to handle the message a receiver sends after logging in,
+ * which must be a join.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the receiver
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   true if the receiver joined a room
+ */
+bool Session::handle_receiver_join(const Message &msg, Message &reply) {
+  if (msg.tag != TAG_JOIN) {
+    // NEED TO JOIN ROOM BEFORE ALL OTHER OPERATIONS
+    reply.set(TAG_ERR, "Need to join room first");
+    m_state = CLOSED;
+    return false;
+  }
+  join_room(msg.data);
+  m_state = RECEIVER;
+  reply.set(TAG_OK, "succesfully joined room.");
+  return true;
+}
+
+/*
+ * Helper function to handle what a receiver sends once it is in a
+ * room: it may join more rooms, leave one (or, with no room named,
+ * all of them) and quit. Anything else is ignored.
+ *
+ * Parameters:
+ *   msg - reference to the Message received from the receiver
+ *   reply - reference to the Message to store the reply in
+ *
+ * Returns:
+ *   false if the connection should be closed after sending the reply
+ */
+bool Session::handle_receiver(const Message &msg, Message &reply) {
+  switch (msg.tag) {
+  case TAG_JOIN:
+    if (join_room(msg.data)) {
+      reply.set(TAG_OK, "succesfully joined room.");
+    } else {
+      reply.set(TAG_OK, "already in the room");
+    }
+    break;
+  case TAG_LEAVE:
+    if (msg.data.empty()) {
+      leave_room();
+      reply.set(TAG_OK, "leaving every room");
+    } else if (leave_one_room(msg.data)) {
+      reply.set(TAG_OK, "leaving the room");
+    } else {
+      reply.set(TAG_ERR, "You are not in that room");
+    }
+    break;
+  case TAG_QUIT:
+    leave_room();
+    reply.set(TAG_OK, "quitting");
+    m_state = CLOSED;
+    return false;
+  default:
+    break;
+  }
+  return true;
+}
+
+/*
+ * Helper function to add the user to a room (creating it if needed).
+ *
+ * Parameters:
+ *   payload - reference to string holding the name of the room,
+ *             optionally followed by ;options (so a room name
+ *             cannot contain ';')
+ *
+ * Returns:
+ *   false if the user was already in the room
+ */
+bool Session::join_room(const std::string &payload) {
+  size_t semi = payload.find(';');
+  std::string room_name = payload.substr(0, semi);
+  Room *room = m_server->find_or_create_room(room_name);
+  if (std::find(m_rooms.begin(), m_rooms.end(), room) != m_rooms.end()) {
+    return false;
+  }
+  size_t replay = 0;
+  if (semi != std::string::npos) {
+    replay = parse_replay(payload.substr(semi + 1));
+  }
+  m_rooms.push_back(room);
+  // only receivers get deliveries; nothing would ever drain a sender's queue
+  if (m_state != SENDER) {
+    room->add_member(m_user, replay);
+  }
+  return true;
+}
+
+/*
+ * Helper function to find how many of a room's past deliveries a
+ * receiver asked to have replayed when joining it.
+ *
+ * Parameters:
+ *   options - reference to string holding the join options, separated by ';'
+ *
+ * Returns:
+ *   the number given with history=, or 0 if there is none (or it is not a number)
+ */
+size_t Session::parse_replay(const std::string &options) {
+  const std::string prefix = JOIN_OPTION_HISTORY;
+  size_t replay = 0;
+  size_t start = 0;
+  while (start <= options.size()) {
+    size_t end = options.find(';', start);
+    if (end == std::string::npos) {
+      end = options.size();
+    }
+    if (options.compare(start, prefix.size(), prefix) == 0 && end > start + prefix.size()) {
+      size_t n = 0;
+      size_t i = start + prefix.size();
+      for (; i < end && isdigit(static_cast<unsigned char>(options[i])); i++) {
+        n = n * 10 + (options[i] - '0');
+        if (n > MAX_REPLAY) {
+          n = MAX_REPLAY;
+        }
+      }
+      if (i == end) {
+        replay = n;
+      }
+    }
+    start = end + 1;
+  }
+  return replay;
+}
+
+/*
+ * Helper function to remove the user from every room it is in.
+ */
+void Session::leave_room() {
+  for (size_t i = 0; i < m_rooms.size(); i++) {
+    m_rooms[i]->remove_member(m_user);
+  }
+  m_rooms.clear();
+}
+
+/*
+ * Helper function to remove the user from one of its rooms.
+ *
+ * Parameters:
+ *   room_name - reference to the name of the room to leave
+ *
+ * Returns:
+ *   false if the user was not in the room
+ */
+bool Session::leave_one_room(const std::string &room_name) {
+  for (size_t i = 0; i < m_rooms.size(); i++) {
+    if (m_rooms[i]->get_room_name() == room_name) {
+      m_rooms[i]->remove_member(m_user);
+      m_rooms.erase(m_rooms.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
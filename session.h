@@ -0,0 +1,94 @@
+/*
+ * Class describing the protocol state of one connected client.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "framing.h"
+#include "connection.h"
+class Server;
+class Room;
+struct User;
+struct Message;
+
+// A Session is the per-connection protocol state machine. It consumes
+// decoded Messages and produces the reply for each one, but never touches
+// the socket itself, so the same logic can be driven either by a blocking
+// client thread or by an event loop.
+class Session {
+public:
+  enum State {
+    AWAIT_LOGIN,        // nothing received yet, expecting slogin/rlogin
+    SENDER,             // logged in as a sender
+    RECEIVER_AWAIT_JOIN,// logged in as a receiver, expecting join
+    RECEIVER,           // receiver that has joined a room (and may join and leave more)
+    CLOSED,             // connection should be closed once reply is sent
+  };
+
+  Session(Server *server);
+  ~Session();
+
+  // Process one message from the client. The reply to send back is
+  // stored in reply. Returns false if the connection should be closed
+  // after the reply has been sent.
+  bool handle(const Message &msg, Message &reply);
+
+  // Process a failure to receive a message from the client. Returns
+  // false if the connection should be closed after the reply has been sent.
+  bool handle_error(Connection::Result result, Message &reply);
+
+  // Process the receiver's queue overflowing under the DISCONNECT
+  // policy. The connection should be closed after the reply is sent.
+  void handle_overrun(Message &reply);
+
+  // For a pipelined sender, store the acknowledgement of every command
+  // handled since the last one in ack. Called once everything read so
+  // far has been handled; returns false if there is nothing to send.
+  bool take_ack(Message &ack);
+
+  State get_state() const { return m_state; }
+  User *get_user() const { return m_user; }
+
+  // Framing to use for everything after the reply to the login; the
+  // transport switches to it once that reply has been sent.
+  Framing get_framing() const;
+
+private:
+  // prohibit value semantics
+  Session(const Session &);
+  Session &operator=(const Session &);
+
+  bool dispatch(const Message &msg, Message &reply);
+  bool handle_login(const Message &msg, Message &reply);
+  bool handle_sender(const Message &msg, Message &reply);
+  bool handle_receiver_join(const Message &msg, Message &reply);
+  bool handle_receiver(const Message &msg, Message &reply);
+  void apply_login_options(const std::string &options, Message &reply);
+  void number_reply(Message &reply);
+
+  bool join_room(const std::string &payload);
+  static size_t parse_replay(const std::string &options);
+  void leave_room();
+  bool leave_one_room(const std::string &room_name);
+
+  Server *m_server;
+  State m_state;
+  User *m_user;
+  // the room a sender is in, or every room a receiver has joined;
+  // all a receiver's rooms queue to its one MessageQueue
+  std::vector<Room *> m_rooms;
+  bool m_pipelined; // sender asked for cumulative acknowledgements
+  uint64_t m_seq;   // pipelined commands handled so far
+  uint64_t m_acked; // the last of them acknowledged
+};
+
+#endif // SESSION_H
@@ -0,0 +1,420 @@
+/*
+ * Implementation of functions for allocating frames from per-thread slabs.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <atomic>
+#include <new>
+#include <vector>
+#include <pthread.h>
+#include "guard.h"
+#include "slab.h"
+
+namespace {
+
+// bytes carved into blocks of one size class at a time
+const size_t SLAB_SIZE = 64 * 1024;
+
+// block sizes of the size classes, header included
+const size_t CLASS_SIZES[] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+const uint32_t NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+// size class of blocks from operator new
+const uint32_t LARGE = NUM_CLASSES;
+
+// owners a thread holds blocks back for at once, until it has a
+// batch for one of them
+const size_t REMOTE_SLOTS = 8;
+
+struct Heap;
+
+// Precedes every block, and keeps what follows it aligned for any type.
+// It is written when the block is first carved and never changes.
+struct alignas(16) Header {
+  Heap *owner;   // null for LARGE blocks
+  uint32_t cls;  // size class
+  uint32_t size; // bytes in the block, header included
+};
+
+// A free block links to the next one through its first bytes.
+Header *&next_of(Header *block) {
+  return *reinterpret_cast<Header **>(block + 1);
+}
+
+// A count only ever changed by one thread, as in metrics.cpp, but with
+// the atomic builtins, which unlike std::atomic's members are inlined
+// even in an unoptimized build: they are on every allocation.
+struct OwnedCounter {
+  uint64_t value;
+
+  OwnedCounter() : value(0) { }
+
+  void add(uint64_t n) { __atomic_store_n(&value, value + n, __ATOMIC_RELAXED); }
+  uint64_t get() const { return __atomic_load_n(&value, __ATOMIC_RELAXED); }
+};
+
+// What one thread has counted.
+struct Counts {
+  OwnedCounter allocs;
+  OwnedCounter frees;
+  OwnedCounter remote_frees;
+  OwnedCounter alloc_bytes;
+  OwnedCounter free_bytes;
+  OwnedCounter reserved_bytes;
+};
+
+// Blocks a thread has freed for another heap and not handed back yet,
+// linked from head to tail.
+struct Pending {
+  Heap *owner;
+  Header *head;
+  Header *tail;
+  int count;
+};
+
+// The slabs and free lists of one thread. Everything but remote is
+// only touched by the owning thread.
+struct Heap {
+  Header *free_lists[NUM_CLASSES];
+  char *carve[NUM_CLASSES];     // next unused byte of each class's current slab
+  char *carve_end[NUM_CLASSES];
+  std::atomic<Header *> remote; // blocks handed back by other threads
+  Pending pending[REMOTE_SLOTS];
+  Counts counts;
+  Heap *next_idle;
+
+  Heap() : remote(nullptr), next_idle(nullptr) {
+    for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+      free_lists[i] = nullptr;
+      carve[i] = carve_end[i] = nullptr;
+    }
+    for (size_t i = 0; i < REMOTE_SLOTS; i++) {
+      pending[i].owner = nullptr;
+      pending[i].head = pending[i].tail = nullptr;
+      pending[i].count = 0;
+    }
+  }
+};
+
+// Every heap ever made (none is freed, as their blocks may be anywhere),
+// those without a thread, and what threads counted while exiting, after
+// giving up their heap. Never freed either, as threads may still exit
+// while the process does.
+struct Registry {
+  pthread_mutex_t lock;
+  std::vector<Heap *> heaps;
+  Heap *idle;
+  Counts exiting;
+
+  Registry() : idle(nullptr) { pthread_mutex_init(&lock, NULL); }
+};
+
+Registry *registry() {
+  static Registry *reg = new Registry;
+  return reg;
+}
+
+/*
+ * Hands a list of blocks back to the heap that owns them.
+ *
+ * Parameters:
+ *   owner - pointer to the owning Heap
+ *   head - pointer to the first block of the list
+ *   tail - pointer to the last block of the list
+ */
+void push_remote(Heap *owner, Header *head, Header *tail) {
+  Header *old = owner->remote.load(std::memory_order_relaxed);
+  do {
+    next_of(tail) = old;
+  } while (!owner->remote.compare_exchange_weak(old, head, std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+/*
+ * Hands back every block a heap's thread has been holding for others.
+ *
+ * Parameters:
+ *   heap - pointer to the Heap
+ */
+void flush_pending(Heap *heap) {
+  for (size_t i = 0; i < REMOTE_SLOTS; i++) {
+    Pending &p = heap->pending[i];
+    if (p.count > 0) {
+      push_remote(p.owner, p.head, p.tail);
+    }
+    p.owner = nullptr;
+    p.head = p.tail = nullptr;
+    p.count = 0;
+  }
+}
+
+/*
+ * Moves the blocks other threads have handed back to the free lists.
+ *
+ * Parameters:
+ *   heap - pointer to this thread's Heap
+ */
+void reclaim_remote(Heap *heap) {
+  Header *block = heap->remote.exchange(nullptr, std::memory_order_acquire);
+  while (block != nullptr) {
+    Header *next = next_of(block);
+    next_of(block) = heap->free_lists[block->cls];
+    heap->free_lists[block->cls] = block;
+    block = next;
+  }
+}
+
+// Owns a thread's Heap, and hands it to the registry's idle heaps when
+// the thread exits.
+struct HeapSlot {
+  Heap *heap;
+
+  HeapSlot() : heap(nullptr) { }
+  ~HeapSlot();
+};
+
+thread_local HeapSlot t_slot;
+thread_local Heap *t_heap = nullptr; // t_slot.heap, without t_slot's guard
+thread_local bool t_exited = false;  // t_slot is gone
+
+HeapSlot::~HeapSlot() {
+  t_exited = true;
+  t_heap = nullptr;
+  if (heap == nullptr) {
+    return;
+  }
+  flush_pending(heap);
+  Registry *reg = registry();
+  Guard guard(reg->lock);
+  heap->next_idle = reg->idle;
+  reg->idle = heap;
+}
+
+/*
+ * Gives this thread a Heap the first time it needs one, taking over an
+ * idle one or making one.
+ *
+ * Returns:
+ *   a pointer to this thread's Heap, or nullptr if the thread is exiting
+ */
+Heap *start_heap() {
+  if (t_exited) {
+    return nullptr;
+  }
+  Registry *reg = registry();
+  Guard guard(reg->lock);
+  if (reg->idle != nullptr) {
+    t_slot.heap = reg->idle;
+    reg->idle = reg->idle->next_idle;
+  } else {
+    t_slot.heap = new Heap;
+    reg->heaps.push_back(t_slot.heap);
+  }
+  t_heap = t_slot.heap;
+  return t_heap;
+}
+
+/*
+ * Finds this thread's Heap.
+ *
+ * Returns:
+ *   a pointer to this thread's Heap, or nullptr if the thread is exiting
+ */
+inline Heap *this_heap() {
+  return (t_heap != nullptr) ? t_heap : start_heap();
+}
+
+/*
+ * Counts into the registry's counts, for a thread that is exiting.
+ *
+ * Parameters:
+ *   counter - pointer to the member of Counts to add to
+ *   n - the number to add
+ */
+void count_exiting(OwnedCounter Counts::*counter, uint64_t n) {
+  Registry *reg = registry();
+  Guard guard(reg->lock);
+  (reg->exiting.*counter).add(n);
+}
+
+/*
+ * Finds the smallest size class with blocks of the given size.
+ *
+ * Parameters:
+ *   size - bytes needed, header included
+ *
+ * Returns:
+ *   the size class, or LARGE if there is none
+ */
+inline uint32_t class_for(size_t size) {
+  if (size <= CLASS_SIZES[0]) {
+    return 0;
+  }
+  // the classes go up in powers of 2 from 64
+  uint32_t cls = 64 - __builtin_clzl(size - 1) - 6;
+  return (cls < NUM_CLASSES) ? cls : LARGE;
+}
+
+/*
+ * Takes a block of a size class from a heap: from its free list, from
+ * the blocks handed back to it, or from its slab for the class.
+ *
+ * Parameters:
+ *   heap - pointer to this thread's Heap
+ *   cls - the size class
+ *
+ * Returns:
+ *   a pointer to the block's header
+ */
+Header *take_block(Heap *heap, uint32_t cls) {
+  if (heap->free_lists[cls] == nullptr) {
+    reclaim_remote(heap);
+  }
+  Header *block = heap->free_lists[cls];
+  if (block != nullptr) {
+    heap->free_lists[cls] = next_of(block);
+    return block;
+  }
+  size_t size = CLASS_SIZES[cls];
+  if (heap->carve[cls] == nullptr || heap->carve[cls] + size > heap->carve_end[cls]) {
+    heap->carve[cls] = static_cast<char *>(::operator new(SLAB_SIZE));
+    heap->carve_end[cls] = heap->carve[cls] + SLAB_SIZE;
+    heap->counts.reserved_bytes.add(SLAB_SIZE);
+  }
+  block = reinterpret_cast<Header *>(heap->carve[cls]);
+  heap->carve[cls] += size;
+  block->owner = heap;
+  block->cls = cls;
+  block->size = static_cast<uint32_t>(size);
+  return block;
+}
+
+}
+
+/*
+ * Constructor for SlabStats object.
+ *
+ * Returns:
+ *   stats with every count zero
+ */
+SlabStats::SlabStats()
+  : allocs(0), frees(0), remote_frees(0), live_bytes(0), reserved_bytes(0) {
+}
+
+/*
+ * Function to allocate a block.
+ *
+ * Parameters:
+ *   size - number of bytes needed
+ *
+ * Returns:
+ *   a pointer to the block, aligned for any type
+ */
+void *slab_alloc(size_t size) {
+  Heap *heap = this_heap();
+  uint32_t cls = class_for(size + sizeof(Header));
+  Header *block;
+  if (cls == LARGE || heap == nullptr) {
+    block = static_cast<Header *>(::operator new(size + sizeof(Header)));
+    block->owner = nullptr;
+    block->cls = LARGE;
+    block->size = static_cast<uint32_t>(size + sizeof(Header));
+  } else {
+    block = take_block(heap, cls);
+  }
+  if (heap != nullptr) {
+    heap->counts.allocs.add(1);
+    heap->counts.alloc_bytes.add(block->size);
+  } else {
+    count_exiting(&Counts::allocs, 1);
+    count_exiting(&Counts::alloc_bytes, block->size);
+  }
+  return block + 1;
+}
+
+/*
+ * Function to free a block, keeping it for this thread if it owns it
+ * and handing it back to its owner otherwise.
+ *
+ * Parameters:
+ *   ptr - pointer returned by slab_alloc, or nullptr
+ */
+void slab_free(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  Header *block = static_cast<Header *>(ptr) - 1;
+  Heap *heap = this_heap();
+  if (heap == nullptr) {
+    count_exiting(&Counts::frees, 1);
+    count_exiting(&Counts::free_bytes, block->size);
+    if (block->cls == LARGE) {
+      ::operator delete(block);
+    } else {
+      count_exiting(&Counts::remote_frees, 1);
+      push_remote(block->owner, block, block);
+    }
+    return;
+  }
+
+  heap->counts.frees.add(1);
+  heap->counts.free_bytes.add(block->size);
+  if (block->cls == LARGE) {
+    ::operator delete(block);
+    return;
+  }
+  if (block->owner == heap) {
+    next_of(block) = heap->free_lists[block->cls];
+    heap->free_lists[block->cls] = block;
+    return;
+  }
+
+  heap->counts.remote_frees.add(1);
+  // hold the block back until there is a batch for its owner
+  Pending &p = heap->pending[(reinterpret_cast<uintptr_t>(block->owner) >> 6) % REMOTE_SLOTS];
+  if (p.owner != block->owner) {
+    if (p.count > 0) {
+      push_remote(p.owner, p.head, p.tail);
+    }
+    p.owner = block->owner;
+    p.head = p.tail = nullptr;
+    p.count = 0;
+  }
+  next_of(block) = p.head;
+  p.head = block;
+  if (p.tail == nullptr) {
+    p.tail = block;
+  }
+  if (++p.count == REMOTE_BATCH) {
+    push_remote(p.owner, p.head, p.tail);
+    p.head = p.tail = nullptr;
+    p.count = 0;
+  }
+}
+
+/*
+ * Function to add up what every thread has counted.
+ *
+ * Parameters:
+ *   stats - reference to the SlabStats to add the counts to
+ */
+void slab_collect(SlabStats &stats) {
+  Registry *reg = registry();
+  Guard guard(reg->lock);
+  uint64_t alloc_bytes = 0, free_bytes = 0;
+  for (size_t i = 0; i <= reg->heaps.size(); i++) {
+    Counts &counts = (i < reg->heaps.size()) ? reg->heaps[i]->counts : reg->exiting;
+    stats.allocs += counts.allocs.get();
+    stats.frees += counts.frees.get();
+    stats.remote_frees += counts.remote_frees.get();
+    stats.reserved_bytes += counts.reserved_bytes.get();
+    alloc_bytes += counts.alloc_bytes.get();
+    free_bytes += counts.free_bytes.get();
+  }
+  // each count may be read a little after the other
+  stats.live_bytes += (alloc_bytes > free_bytes) ? alloc_bytes - free_bytes : 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Functions for allocating frames from per-thread slabs.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Frames are created by the thread that handles a sender and usually
+// freed by another, the one that wrote the last copy to a receiver.
+// Rather than have malloc pass every block between threads, each thread
+// allocates blocks of a few size classes from slabs of its own, keeps
+// the blocks it frees on its own free lists, and hands blocks owned by
+// another thread back to that thread in batches of REMOTE_BATCH with a
+// single atomic exchange. The owner takes them back when its free list
+// for a size runs out. Blocks above the largest size class come from
+// operator new.
+//
+// A thread's slabs outlive it: when it exits, the next thread to start
+// allocating takes them over, so a server whose threads come and go
+// reuses the same slabs.
+
+// Number of blocks freed for another thread before they are handed back.
+const int REMOTE_BATCH = 32;
+
+// Totals over every thread, as taken by slab_collect.
+struct SlabStats {
+  uint64_t allocs;          // blocks allocated
+  uint64_t frees;           // blocks freed
+  uint64_t remote_frees;    // blocks freed by a thread other than their owner
+  uint64_t live_bytes;      // bytes in blocks allocated and not yet freed
+  uint64_t reserved_bytes;  // bytes in slabs
+
+  SlabStats();
+
+  uint64_t get_live() const { return allocs - frees; }
+};
+
+// Allocate at least size bytes, aligned for any type.
+void *slab_alloc(size_t size);
+
+// Free a block from slab_alloc. Any thread may free any block.
+void slab_free(void *ptr);
+
+// Add up the counts of every thread.
+void slab_collect(SlabStats &stats);
+
+#endif // SLAB_H
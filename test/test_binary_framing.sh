@@ -0,0 +1,252 @@
+#!/bin/bash
+
+# Usage: ./test_binary_framing.sh [port] [out_stem]
+#
+# Logs a sender and a receiver in with ";framing=binary" over raw
+# connections, next to a receiver using text lines, on a server with
+# --max-frame 64. Checks the text login replies, the binary frames the
+# server sends back and delivers, including a payload with a line break
+# (which only the binary receiver gets) and one exactly --max-frame
+# long, and that a frame over the limit and one with an unknown tag id
+# are each answered with an error frame and the connection closed.
+# Every line and frame received goes in ${OUT_STEM}.out, frames as
+# tag:payload.
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+USER1=alice
+USER2=zed
+RECV_USER=eve
+TEXT_RECV_USER=bob
+ROOM="partytime"
+MAX_FRAME=64
+SERVER_ARGS="--max-frame ${MAX_FRAME}"
+
+# tag ids and names, as in message.h
+TAG_NAMES=(none err ok slogin rlogin join leave sendall senduser quit delivery empty)
+TAG_JOIN=5
+TAG_SENDALL=7
+TAG_QUIT=9
+TAG_UNKNOWN=77
+
+# a payload with spaces around it, which are kept
+SPACED=" spaces kept "
+
+# a payload exactly as long as the limit allows
+LONGEST=$(printf 'x%.0s' $(seq ${MAX_FRAME}))
+
+SERVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    local FD=0
+    for ((FD = 3; FD < 7; FD++)); do
+        eval "exec ${FD}<&-" 2> /dev/null
+    done
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+    fi
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+# connect to the server on a descriptor, log in with the given message
+# and add the (text) reply to the output
+connect_login() {
+    local FD=$1
+    local LOGIN=$2
+    eval "exec ${FD}<>/dev/tcp/localhost/${PORT}"
+    echo "${LOGIN}" >&${FD}
+    receive_line ${FD}
+}
+
+# read a text line from a descriptor into the output
+receive_line() {
+    local FD=$1
+    local LINE
+    if ! IFS= read -r -t 2 -u ${FD} LINE; then
+        error_cleanup "No line on ${FD}"
+    fi
+    echo "${LINE}" >> "${OUT_STEM}.out"
+}
+
+# send a binary frame with the given tag id and payload on a descriptor
+send_frame() {
+    local FD=$1
+    local TAG=$2
+    local PAYLOAD=$3
+    local LEN=$((${#PAYLOAD} + 1))
+    local HDR=$(printf '\\x%02x\\x%02x\\x%02x\\x%02x\\x%02x' \
+        $((LEN >> 24 & 255)) $((LEN >> 16 & 255)) $((LEN >> 8 & 255)) $((LEN & 255)) ${TAG})
+    printf "${HDR}%s" "${PAYLOAD}" >&${FD}
+}
+
+# read a binary frame from a descriptor into the output as tag:payload,
+# or "closed" if the server closed the connection instead
+receive_frame() {
+    local FD=$1
+    if ! timeout 2 head -c 5 <&${FD} > temp/header; then
+        error_cleanup "No frame on ${FD}"
+    fi
+    local HDR=($(od -An -tu1 temp/header))
+    if [[ ${#HDR[@]} -eq 0 ]]; then
+        echo "closed" >> "${OUT_STEM}.out"
+        return
+    fi
+    if [[ ${#HDR[@]} -ne 5 ]]; then
+        error_cleanup "Short frame header on ${FD}"
+    fi
+    local LEN=$(((HDR[0] << 24) | (HDR[1] << 16) | (HDR[2] << 8) | HDR[3]))
+    printf '%s:' "${TAG_NAMES[${HDR[4]}]}" >> "${OUT_STEM}.out"
+    if [[ ${LEN} -gt 1 ]]; then
+        if ! timeout 2 head -c $((LEN - 1)) <&${FD} >> "${OUT_STEM}.out"; then
+            error_cleanup "Frame on ${FD} cut short"
+        fi
+    fi
+    echo >> "${OUT_STEM}.out"
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# byte counts, not characters
+export LC_ALL=C
+
+# setup
+rm -rf temp/
+mkdir temp/
+rm -f "${OUT_STEM}.out"
+
+cat > temp/out.exp << EOF
+ok:logged in;framing=binary
+ok:succesfully joined room.
+ok:logged in
+ok:succesfully joined room.
+ok:logged in;framing=binary
+ok:joining room
+ok:broadcasting message
+ok:broadcasting message
+ok:broadcasting message
+ok:quitting
+closed
+delivery:${ROOM}:${USER1}:${SPACED}
+delivery:${ROOM}:${USER1}:two
+lines
+delivery:${ROOM}:${USER1}:${LONGEST}
+delivery:${ROOM}:${USER1}:${SPACED}
+delivery:${ROOM}:${USER1}:${LONGEST}
+ok:logged in;framing=binary
+err:The message is invalid.
+closed
+ok:logged in;framing=binary
+err:The message is invalid.
+closed
+EOF
+
+# start server
+echo "spawning server"
+if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+    valgrind --leak-check=full --track-origins=yes ./server ${SERVER_ARGS} ${PORT} &
+    SERVER_PID=$!
+else
+    ./server ${SERVER_ARGS} ${PORT} &
+    SERVER_PID=$!
+fi
+
+# wait for server to come up
+sleep 0.5
+
+# the login reply is a text line, and the join's reply a frame
+echo "joining a binary and a text receiver"
+connect_login 3 "rlogin:${RECV_USER};framing=binary"
+send_frame 3 ${TAG_JOIN} "${ROOM}"
+receive_frame 3
+connect_login 4 "rlogin:${TEXT_RECV_USER}"
+echo "join:${ROOM}" >&4
+receive_line 4
+
+# payloads are sent as is: neither trimmed nor split at line breaks
+echo "sending frames"
+connect_login 5 "slogin:${USER1};framing=binary"
+send_frame 5 ${TAG_JOIN} "${ROOM}"
+receive_frame 5
+send_frame 5 ${TAG_SENDALL} "${SPACED}"
+receive_frame 5
+send_frame 5 ${TAG_SENDALL} "two
+lines"
+receive_frame 5
+send_frame 5 ${TAG_SENDALL} "${LONGEST}"
+receive_frame 5
+send_frame 5 ${TAG_QUIT} ""
+receive_frame 5
+receive_frame 5
+
+# the message with a line break can't be a text line, so only the
+# binary receiver gets it
+echo "receiving deliveries"
+for ((N = 0; N < 3; N++)); do
+    receive_frame 3
+done
+receive_line 4
+receive_line 4
+
+echo "sending a frame over --max-frame"
+connect_login 6 "slogin:${USER2};framing=binary"
+send_frame 6 ${TAG_SENDALL} "${LONGEST}y"
+receive_frame 6
+receive_frame 6
+exec 6<&-
+
+echo "sending a frame with an unknown tag"
+connect_login 6 "slogin:${USER2};framing=binary"
+send_frame 6 ${TAG_UNKNOWN} "${ROOM}"
+receive_frame 6
+receive_frame 6
+exec 6<&-
+
+# nothing more should come to either receiver
+if IFS= read -r -t 0.5 -u 4 LINE; then
+    error_cleanup "Text receiver got an extra line: ${LINE}"
+fi
+if [[ -n "$(timeout 0.5 head -c 1 <&3)" ]]; then
+    error_cleanup "Binary receiver got extra bytes"
+fi
+
+# check that server is still up
+kill -0 ${SERVER_PID}
+if [[ $? -ne 0 ]]; then
+    echo "Server died when it was not supposed to!"
+    exit 1
+fi
+
+if ! diff temp/out.exp "${OUT_STEM}.out"; then
+    error_cleanup "Output differs from the expected one"
+fi
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
@@ -0,0 +1,151 @@
+#!/bin/bash
+
+# Usage: ./test_history.sh [port] [out_stem]
+#
+# Has a server keeping the last 3 messages of each room get 5, then
+# has receivers join with "join:<room>;history=N" asking for fewer,
+# more than MAX_REPLAY, or none of them, and sends one more message.
+# Checks the exact lines each receiver is sent (in ${OUT_STEM}.<n>.out):
+# the replayed messages, then the new one, each exactly once.
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+REF_SENDER="reference/ref-sender"
+
+USER1=alice
+ROOM="partytime"
+SERVER_ARGS="--history 3"
+
+# each receiver's join options, and the messages it should get
+JOIN_OPTIONS=(";history=2" ";history=99999999999999999999999" "" ";history=x")
+EXPECTED=("m4 m5 m6" "m3 m4 m5 m6" "m6" "m6")
+
+SERVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    local FD=0
+    for ((FD = 3; FD < 3 + ${#JOIN_OPTIONS[@]}; FD++)); do
+        eval "exec ${FD}<&-" 2> /dev/null
+    done
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+    fi
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+# read the given number of lines the server sends on a descriptor
+# into a file
+receive_lines() {
+    local FD=$1
+    local COUNT=$2
+    local OUTFILE=$3
+    local LINE
+    for ((i = 0; i < COUNT; i++)); do
+        if ! IFS= read -r -t 2 -u ${FD} LINE; then
+            error_cleanup "Receiver on ${FD} got only ${i} of ${COUNT} lines"
+        fi
+        echo "${LINE}" >> "${OUTFILE}"
+    done
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# setup
+rm -rf temp/
+mkdir temp/
+
+printf '/join %s\nm1\nm2\nm3\nm4\nm5\n/quit\n' ${ROOM} > temp/1.in
+printf '/join %s\nm6\n/quit\n' ${ROOM} > temp/2.in
+
+for ((N = 0; N < ${#JOIN_OPTIONS[@]}; N++)); do
+    rm -f "${OUT_STEM}.${N}.out"
+    printf 'ok:logged in\nok:succesfully joined room.\n' > temp/${N}.exp
+    for MSG in ${EXPECTED[$N]}; do
+        echo "delivery:${ROOM}:${USER1}:${MSG}" >> temp/${N}.exp
+    done
+done
+
+# start server
+echo "spawning server"
+if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+    valgrind --leak-check=full --track-origins=yes ./server ${SERVER_ARGS} ${PORT} &
+    SERVER_PID=$!
+else
+    ./server ${SERVER_ARGS} ${PORT} &
+    SERVER_PID=$!
+fi
+
+# wait for server to come up
+sleep 0.5
+
+echo "sending five messages"
+${REF_SENDER} localhost ${PORT} ${USER1} < temp/1.in > /dev/null
+
+# each receiver gets the login and join replies, then its replay
+echo "joining with replays"
+for ((N = 0; N < ${#JOIN_OPTIONS[@]}; N++)); do
+    FD=$((N + 3))
+    eval "exec ${FD}<>/dev/tcp/localhost/${PORT}"
+    echo "rlogin:eve${N}" >&${FD}
+    echo "join:${ROOM}${JOIN_OPTIONS[$N]}" >&${FD}
+    COUNT=$(wc -l < temp/${N}.exp)
+    receive_lines ${FD} $((COUNT - 1)) "${OUT_STEM}.${N}.out"
+done
+
+echo "sending one more"
+${REF_SENDER} localhost ${PORT} ${USER1} < temp/2.in > /dev/null
+for ((N = 0; N < ${#JOIN_OPTIONS[@]}; N++)); do
+    receive_lines $((N + 3)) 1 "${OUT_STEM}.${N}.out"
+done
+
+# nothing more should come: no delivery is both replayed and sent live
+sleep 0.5
+for ((N = 0; N < ${#JOIN_OPTIONS[@]}; N++)); do
+    if IFS= read -r -t 0.1 -u $((N + 3)) LINE; then
+        error_cleanup "Receiver ${N} got an extra line: ${LINE}"
+    fi
+done
+
+# check that server is still up
+kill -0 ${SERVER_PID}
+if [[ $? -ne 0 ]]; then
+    echo "Server died when it was not supposed to!"
+    exit 1
+fi
+
+for ((N = 0; N < ${#JOIN_OPTIONS[@]}; N++)); do
+    if ! diff temp/${N}.exp "${OUT_STEM}.${N}.out"; then
+        error_cleanup "Receiver ${N} (join:${ROOM}${JOIN_OPTIONS[$N]}) got unexpected lines"
+    fi
+done
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
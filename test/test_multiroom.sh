@@ -0,0 +1,175 @@
+#!/bin/bash
+
+# Usage: ./test_multiroom.sh [port] [out_stem]
+#
+# Has a receiver join two rooms over one connection (and one of them
+# again), while a sender sends to those rooms and to a third in turn,
+# then has it leave one room, leave a room it is no longer in, leave
+# every room and join one again, with the sender sending after each
+# step. Checks the exact lines the receiver is sent (in ${OUT_STEM}.out):
+# each reply, and the deliveries from the rooms it is in at the time,
+# in the order they were sent.
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+REF_SENDER="reference/ref-sender"
+
+USER1=alice
+RECV_USER=eve
+ROOM1="partytime"
+ROOM2="studyhall"
+ROOM3="elsewhere"
+
+SERVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    exec 3<&- 2> /dev/null
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+    fi
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+# read the given number of lines the server sends on fd 3 into the output
+receive_lines() {
+    local COUNT=$1
+    local LINE
+    for ((i = 0; i < COUNT; i++)); do
+        if ! IFS= read -r -t 2 LINE <&3; then
+            error_cleanup "Receiver got only ${i} of ${COUNT} lines"
+        fi
+        echo "${LINE}" >> "${OUT_STEM}.out"
+    done
+}
+
+# send a message from the receiver and add its reply to the output
+receiver_send() {
+    echo "$1" >&3
+    receive_lines 1
+}
+
+# send each "room message" pair given, in turn, as the sender
+sender_send() {
+    local INFILE=temp/sender.in
+    rm -f ${INFILE}
+    while [[ "$#" -ge 2 ]]; do
+        printf '/join %s\n%s\n' "$1" "$2" >> ${INFILE}
+        shift 2
+    done
+    echo "/quit" >> ${INFILE}
+    ${REF_SENDER} localhost ${PORT} ${USER1} < ${INFILE} > /dev/null
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# setup
+rm -rf temp/
+mkdir temp/
+rm -f "${OUT_STEM}.out"
+
+cat > temp/out.exp << EOF
+ok:logged in
+ok:succesfully joined room.
+ok:succesfully joined room.
+ok:already in the room
+delivery:${ROOM1}:${USER1}:a1
+delivery:${ROOM2}:${USER1}:b1
+delivery:${ROOM1}:${USER1}:a2
+delivery:${ROOM2}:${USER1}:b2
+ok:leaving the room
+err:You are not in that room
+delivery:${ROOM2}:${USER1}:b3
+ok:leaving every room
+ok:succesfully joined room.
+delivery:${ROOM1}:${USER1}:a5
+ok:quitting
+EOF
+
+# start server
+echo "spawning server"
+if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+    valgrind --leak-check=full --track-origins=yes ./server ${PORT} &
+    SERVER_PID=$!
+else
+    ./server ${PORT} &
+    SERVER_PID=$!
+fi
+
+# wait for server to come up
+sleep 0.5
+
+echo "joining two rooms"
+exec 3<>/dev/tcp/localhost/${PORT}
+receiver_send "rlogin:${RECV_USER}"
+receiver_send "join:${ROOM1}"
+receiver_send "join:${ROOM2}"
+receiver_send "join:${ROOM1}"
+
+# deliveries from both rooms come in the order they were sent, and
+# none from the room the receiver is not in
+echo "sending to three rooms"
+sender_send ${ROOM1} a1 ${ROOM2} b1 ${ROOM3} c1 ${ROOM1} a2 ${ROOM2} b2
+receive_lines 4
+
+echo "leaving one room"
+receiver_send "leave:${ROOM1}"
+receiver_send "leave:${ROOM1}"
+sender_send ${ROOM1} a3 ${ROOM2} b3
+receive_lines 1
+
+echo "leaving every room"
+receiver_send "leave:"
+sender_send ${ROOM1} a4 ${ROOM2} b4
+
+echo "joining again"
+receiver_send "join:${ROOM1}"
+sender_send ${ROOM2} b5 ${ROOM1} a5
+receive_lines 1
+receiver_send "quit:"
+
+# nothing more should come: the receiver was in no room for a4 and b4
+if IFS= read -r -t 0.5 LINE <&3; then
+    error_cleanup "Receiver got an extra line: ${LINE}"
+fi
+
+# check that server is still up
+kill -0 ${SERVER_PID}
+if [[ $? -ne 0 ]]; then
+    echo "Server died when it was not supposed to!"
+    exit 1
+fi
+
+if ! diff temp/out.exp "${OUT_STEM}.out"; then
+    error_cleanup "Receiver output differs from the expected one"
+fi
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
@@ -0,0 +1,193 @@
+#!/bin/bash
+
+# Usage: ./test_pipeline.sh [port] [out_stem]
+#
+# Logs senders in with ";pipeline" over a raw connection, sends each
+# batch of commands in a single write, and checks the exact replies
+# the server sends back (in ${OUT_STEM}.replies) and what a receiver
+# in the room got (in ${OUT_STEM}.out).
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+REF_RECEIVER="reference/ref-receiver"
+
+USER1=alice
+USER2=bob
+RECV_USER=eve
+ROOM="partytime"
+
+SERVER_PID=0
+RECEIVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    exec 3<&- 2> /dev/null
+    if [[ ${RECEIVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${RECEIVER_PID} > /dev/null 2>&1
+        wait ${RECEIVER_PID} 2> /dev/null
+    fi
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+    fi
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+# connect to the server on fd 3, log in with the given message and
+# add the reply to the reply stream
+connect_login() {
+    local LOGIN=$1
+    local LINE
+    exec 3<>/dev/tcp/localhost/${PORT}
+    echo "${LOGIN}" >&3
+    if ! IFS= read -r -t 2 LINE <&3; then
+        error_cleanup "No reply to ${LOGIN}"
+    fi
+    echo "${LINE}" >> "${OUT_STEM}.replies"
+}
+
+# send a file of commands in one write, so the server handles them as
+# one batch, and add every reply to the reply stream until the server
+# closes the connection
+send_batch() {
+    local INFILE=$1
+    local LINE
+    cat ${INFILE} >&3
+    while true; do
+        if IFS= read -r -t 2 LINE <&3; then
+            echo "${LINE}" >> "${OUT_STEM}.replies"
+        elif [[ $? -gt 128 ]]; then
+            error_cleanup "Server did not close the connection after ${INFILE}"
+        else
+            break
+        fi
+    done
+    exec 3<&-
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# setup
+rm -rf temp/
+mkdir temp/
+rm -f "${OUT_STEM}.replies"
+
+# the first sender's commands: two messages, one sent after leaving
+# the room (command 5, the only one to fail), one more after joining
+# again, then quit, which acknowledges all 8
+cat > temp/1.in << EOF
+join:${ROOM}
+sendall:hello
+sendall:world
+leave:
+sendall:not seen
+join:${ROOM}
+sendall:again
+quit:
+EOF
+
+# the second sender's: an invalid message ends the connection,
+# so nothing after it is handled
+cat > temp/2.in << EOF
+join:${ROOM}
+bogus
+sendall:not seen either
+EOF
+
+cat > temp/replies.exp << EOF
+ok:logged in;pipeline
+err:5:You must join a room first
+ok:through 8
+ok:logged in
+ok:logged in;pipeline
+err:2:The message is invalid.
+EOF
+
+cat > temp/out.exp << EOF
+${USER1}: hello
+${USER1}: world
+${USER1}: again
+EOF
+
+# start server
+echo "spawning server"
+if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+    valgrind --leak-check=full --track-origins=yes ./server ${PORT} &
+    SERVER_PID=$!
+else
+    ./server ${PORT} &
+    SERVER_PID=$!
+fi
+
+# wait for server to come up
+sleep 0.5
+
+# spawn receiver
+echo "spawning receiver"
+stdbuf -oL -eL \
+    ${REF_RECEIVER} localhost ${PORT} ${RECV_USER} ${ROOM} \
+        1> "${OUT_STEM}.out" \
+        2> "${OUT_STEM}.err" &
+RECEIVER_PID=$!
+
+# wait for receiver to come up
+sleep 0.5
+
+echo "pipelining first sender"
+connect_login "slogin:${USER1};pipeline"
+send_batch temp/1.in
+
+# only senders can pipeline, so a receiver asking to is not told it may
+echo "asking to pipeline as a receiver"
+connect_login "rlogin:${RECV_USER}2;pipeline"
+exec 3<&-
+
+echo "pipelining second sender"
+connect_login "slogin:${USER2};pipeline"
+send_batch temp/2.in
+
+echo "waiting for transmission to settle"
+sleep 0.5
+
+# check that server is still up
+kill -0 ${SERVER_PID}
+if [[ $? -ne 0 ]]; then
+    echo "Server died when it was not supposed to!"
+    exit 1
+fi
+
+if ! diff temp/replies.exp "${OUT_STEM}.replies"; then
+    error_cleanup "Replies differ from the expected ones"
+fi
+if ! diff temp/out.exp "${OUT_STEM}.out"; then
+    error_cleanup "Receiver output differs from the expected one"
+fi
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
@@ -0,0 +1,272 @@
+#!/bin/bash
+
+# Usage: ./test_queue_policy.sh [port] [out_stem]
+#
+# For each --queue-policy, starts a server with a small --queue-cap,
+# joins a receiver and stops it with SIGSTOP, and has a pipelined
+# sender send it far more than the socket buffers and its queue can
+# hold, and then 2 * QUEUE_CAP more at once. Resumes the receiver and,
+# unless it was disconnected, sends one more message. Checks what the
+# receiver got (kept in ${OUT_STEM}.<policy>.out): fewer messages than
+# were sent, in the order they were sent, and of the last 2 * QUEUE_CAP,
+#   drop-oldest: the newest QUEUE_CAP, then the new message;
+#   drop-newest: the first few at most, never the newest, then the
+#     new message;
+#   disconnect: none, then "err:too many messages waiting,
+#     disconnecting", and the connection is closed.
+# Each server listens on the next port after the last one's.
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+REF_SENDER="reference/ref-sender"
+
+USER1=alice
+RECV_USER=eve
+ROOM="partytime"
+QUEUE_CAP=10
+POLICIES=(drop-oldest drop-newest disconnect)
+
+# messages sent while the receiver is stopped, each padded so that
+# together they are far more than the socket buffers hold, and the
+# messages sent after them
+MESSAGES=40000
+TAIL=$((2 * QUEUE_CAP))
+PADDING=$(printf 'x%.0s' $(seq 200))
+
+SERVER_PID=0
+RECEIVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    exec 3<&- 2> /dev/null
+    stop_receiver ${FLAGS}
+    stop_server ${FLAGS}
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+start_server() {
+    local POLICY=$1
+    local SERVER_ARGS="--queue-cap ${QUEUE_CAP} --queue-policy ${POLICY}"
+    if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+        valgrind --leak-check=full --track-origins=yes ./server ${SERVER_ARGS} ${PORT} &
+        SERVER_PID=$!
+    else
+        ./server ${SERVER_ARGS} ${PORT} &
+        SERVER_PID=$!
+    fi
+    # wait for server to come up
+    sleep 0.5
+}
+
+stop_server() {
+    local FLAGS=$1
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+        SERVER_PID=0
+    fi
+}
+
+# join a receiver whose every line goes to the given file, and wait
+# until it has been told it joined
+start_receiver() {
+    local OUTFILE=$1
+    (
+        exec 3<>/dev/tcp/localhost/${PORT}
+        printf 'rlogin:%s\njoin:%s\n' ${RECV_USER} ${ROOM} >&3
+        exec cat <&3
+    ) > "${OUTFILE}" &
+    RECEIVER_PID=$!
+    wait_for_line "${OUTFILE}" "ok:succesfully joined room."
+}
+
+stop_receiver() {
+    local FLAGS=$1
+    if [[ ${RECEIVER_PID} -ne 0 ]]; then
+        kill -CONT ${RECEIVER_PID} > /dev/null 2>&1
+        kill ${FLAGS} ${RECEIVER_PID} > /dev/null 2>&1
+        wait ${RECEIVER_PID} 2> /dev/null
+        RECEIVER_PID=0
+    fi
+}
+
+# wait up to 5 seconds for a file to end with the given line
+wait_for_line() {
+    local FILE=$1
+    local LINE=$2
+    for ((i = 0; i < 50; i++)); do
+        if [[ "$(tail -n 1 "${FILE}")" == "${LINE}" ]]; then
+            return
+        fi
+        sleep 0.1
+    done
+    error_cleanup "${FILE} does not end with ${LINE}"
+}
+
+# wait up to 5 seconds for a receiver to see its connection closed
+wait_for_exit() {
+    local PID=$1
+    for ((i = 0; i < 50; i++)); do
+        if ! kill -0 ${PID} 2> /dev/null; then
+            wait ${PID} 2> /dev/null || true
+            return
+        fi
+        sleep 0.1
+    done
+    error_cleanup "The server did not close the receiver's connection"
+}
+
+# send the messages numbered FIRST to LAST in one write as a
+# pipelining sender, and check that they were all accepted
+send_pipelined() {
+    local FIRST=$1
+    local LAST=$2
+    local LINE
+    echo "join:${ROOM}" > temp/batch.in
+    for ((N = FIRST; N <= LAST; N++)); do
+        echo "sendall:${N} ${PADDING}"
+    done >> temp/batch.in
+    echo "quit:" >> temp/batch.in
+
+    exec 3<>/dev/tcp/localhost/${PORT}
+    echo "slogin:${USER1};pipeline" >&3
+    if ! IFS= read -r -t 2 LINE <&3 || [[ "${LINE}" != "ok:logged in;pipeline" ]]; then
+        error_cleanup "Sender could not log in to pipeline: ${LINE}"
+    fi
+    cat temp/batch.in >&3
+    # each part of the batch the server reads at once is acknowledged
+    while [[ "${LINE}" != "ok:through $((LAST - FIRST + 3))" ]]; do
+        if ! IFS= read -r -t 10 LINE <&3 || [[ "${LINE}" != ok:through* ]]; then
+            error_cleanup "Sender's messages were not all accepted: ${LINE}"
+        fi
+    done
+    exec 3<&-
+}
+
+# the numbers of the messages delivered out of the batch, in order
+delivered_numbers() {
+    local OUTFILE=$1
+    grep "^delivery:${ROOM}:${USER1}:[0-9]* " "${OUTFILE}" | cut -d: -f4 | cut -d' ' -f1
+}
+
+# check that the numbers in a file run one after another from FIRST
+# to LAST
+check_run() {
+    local FILE=$1
+    local FIRST=$2
+    local LAST=$3
+    if ! diff <(seq ${FIRST} ${LAST}) "${FILE}" > /dev/null; then
+        error_cleanup "${FILE} does not hold messages ${FIRST} to ${LAST} in order"
+    fi
+}
+
+run_policy() {
+    local POLICY=$1
+    local OUTFILE="${OUT_STEM}.${POLICY}.out"
+    rm -f "${OUTFILE}"
+
+    echo "${POLICY}: spawning server"
+    start_server ${POLICY}
+    start_receiver "${OUTFILE}"
+
+    echo "${POLICY}: stopping the receiver and sending ${MESSAGES} messages"
+    kill -STOP ${RECEIVER_PID}
+    send_pipelined 1 ${MESSAGES}
+    send_pipelined $((MESSAGES + 1)) $((MESSAGES + TAIL))
+
+    echo "${POLICY}: resuming the receiver"
+    kill -CONT ${RECEIVER_PID}
+    if [[ ${POLICY} == disconnect ]]; then
+        wait_for_line "${OUTFILE}" "err:too many messages waiting, disconnecting"
+        wait_for_exit ${RECEIVER_PID}
+        RECEIVER_PID=0
+    else
+        printf '/join %s\nresumed\n/quit\n' ${ROOM} > temp/resumed.in
+        ${REF_SENDER} localhost ${PORT} ${USER1} < temp/resumed.in > /dev/null
+        wait_for_line "${OUTFILE}" "delivery:${ROOM}:${USER1}:resumed"
+        stop_receiver
+    fi
+
+    # check that server is still up
+    kill -0 ${SERVER_PID}
+    if [[ $? -ne 0 ]]; then
+        echo "Server died when it was not supposed to!"
+        exit 1
+    fi
+    stop_server
+
+    delivered_numbers "${OUTFILE}" > temp/delivered
+    local COUNT=$(wc -l < temp/delivered)
+    if [[ ${COUNT} -ge ${MESSAGES} ]]; then
+        error_cleanup "${POLICY}: no message was dropped"
+    fi
+    if ! sort -c -n -u temp/delivered 2> /dev/null; then
+        error_cleanup "${POLICY}: messages were delivered out of order or twice"
+    fi
+    awk -v LAST=${MESSAGES} '$1 > LAST' temp/delivered > temp/tail
+    local KEPT=$(wc -l < temp/tail)
+    case ${POLICY} in
+    drop-oldest)
+        tail -n ${QUEUE_CAP} temp/tail > temp/newest
+        check_run temp/newest $((MESSAGES + TAIL - QUEUE_CAP + 1)) $((MESSAGES + TAIL))
+        ;;
+    drop-newest)
+        # the socket may have taken a little more since it filled up,
+        # leaving room in the queue for the first few
+        if [[ ${KEPT} -ge ${TAIL} ]]; then
+            error_cleanup "${POLICY}: the newest message was delivered"
+        fi
+        check_run temp/tail $((MESSAGES + 1)) $((MESSAGES + KEPT))
+        ;;
+    disconnect)
+        if [[ ${KEPT} -ne 0 ]]; then
+            error_cleanup "${POLICY}: messages were delivered after the queue filled up"
+        fi
+        ;;
+    esac
+    local HEAD=$(head -n 2 "${OUTFILE}" | tr '\n' '|')
+    if [[ "${HEAD}" != "ok:logged in|ok:succesfully joined room.|" ]]; then
+        error_cleanup "${POLICY}: unexpected replies ${HEAD}"
+    fi
+
+    PORT=$((PORT + 1))
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# setup
+rm -rf temp/
+mkdir temp/
+
+for POLICY in ${POLICIES[@]}; do
+    run_policy ${POLICY}
+done
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
@@ -0,0 +1,174 @@
+#!/bin/bash
+
+# Usage: ./test_room_log.sh [port] [out_stem]
+#
+# Has a server with --log-dir log three messages to a room, cuts the
+# log short in the middle of the last record, as if the server had
+# stopped while writing it, and restarts the server. Checks that the
+# torn record was truncated away, that a receiver joining with a
+# replay gets the two whole messages (the exact lines it is sent go
+# in ${OUT_STEM}.out), and that a new message is logged after them.
+# The restarted server listens on port + 1.
+
+#############################################
+# globals section
+#############################################
+PORT=$1
+OUT_STEM=$2
+
+REF_SENDER="reference/ref-sender"
+
+USER1=alice
+RECV_USER=eve
+ROOM="partytime"
+LOG_DIR="temp/logs"
+LOG_FILE="${LOG_DIR}/${ROOM}.log"
+SERVER_ARGS="--history 10 --log-dir ${LOG_DIR}"
+
+SERVER_PID=0
+#############################################
+# functions section
+#############################################
+cleanup() {
+    local FLAGS=$1
+    exec 3<&- 2> /dev/null
+    if [[ ${SERVER_PID} -ne 0 ]]; then
+        kill ${FLAGS} ${SERVER_PID} > /dev/null 2>&1
+        wait ${SERVER_PID} 2> /dev/null
+    fi
+    rm -rf temp
+}
+
+# cleanup all resources on error
+error_cleanup () {
+    echo $1
+    cleanup -9
+    exit 1
+}
+
+start_server() {
+    if [[ ${VALGRIND_ENABLE} -eq 1 ]]; then
+        valgrind --leak-check=full --track-origins=yes ./server ${SERVER_ARGS} ${PORT} &
+        SERVER_PID=$!
+    else
+        ./server ${SERVER_ARGS} ${PORT} &
+        SERVER_PID=$!
+    fi
+    # wait for server to come up
+    sleep 0.5
+}
+
+stop_server() {
+    kill ${SERVER_PID}
+    wait ${SERVER_PID} 2> /dev/null || true
+    SERVER_PID=0
+}
+
+# bytes a record of a message takes in the log
+record_len() {
+    local SENDER=$1
+    local TEXT=$2
+    echo $((10 + ${#SENDER} + ${#TEXT}))
+}
+
+# read the given number of lines the server sends on fd 3 into the output
+receive_lines() {
+    local COUNT=$1
+    local LINE
+    for ((i = 0; i < COUNT; i++)); do
+        if ! IFS= read -r -t 2 LINE <&3; then
+            error_cleanup "Receiver got only ${i} of ${COUNT} lines"
+        fi
+        echo "${LINE}" >> "${OUT_STEM}.out"
+    done
+}
+
+check_log_size() {
+    local EXPECTED=$1
+    local SIZE=$(stat -c %s ${LOG_FILE})
+    if [[ ${SIZE} -ne ${EXPECTED} ]]; then
+        error_cleanup "${LOG_FILE} is ${SIZE} bytes, expected ${EXPECTED}"
+    fi
+}
+
+#############################################
+# Script body
+#############################################
+if [[ "$#" -ne 2 ]]; then
+    echo "Usage: $0 [port] [out_stem]"
+    exit 1
+fi
+# configure traps
+trap "error_cleanup 'cleanup on ERR...'" ERR
+trap "error_cleanup 'cleanup on SIGINT...'" SIGINT
+trap "error_cleanup 'cleanup on SIGTERM...'" SIGTERM
+
+# setup
+rm -rf temp/
+mkdir -p ${LOG_DIR}
+rm -f "${OUT_STEM}.out"
+
+printf '/join %s\none\ntwo\nthree\n/quit\n' ${ROOM} > temp/1.in
+printf '/join %s\nfour\n/quit\n' ${ROOM} > temp/2.in
+
+cat > temp/out.exp << EOF
+ok:logged in
+ok:succesfully joined room.
+delivery:${ROOM}:${USER1}:one
+delivery:${ROOM}:${USER1}:two
+delivery:${ROOM}:${USER1}:four
+EOF
+
+LEN_ONE=$(record_len ${USER1} one)
+LEN_TWO=$(record_len ${USER1} two)
+LEN_THREE=$(record_len ${USER1} three)
+LEN_FOUR=$(record_len ${USER1} four)
+
+echo "spawning server"
+start_server
+
+echo "logging three messages"
+${REF_SENDER} localhost ${PORT} ${USER1} < temp/1.in > /dev/null
+# give the log's writer time to write them out
+sleep 0.5
+stop_server
+check_log_size $((LEN_ONE + LEN_TWO + LEN_THREE))
+
+echo "tearing the last record"
+truncate -s $((LEN_ONE + LEN_TWO + LEN_THREE - 3)) ${LOG_FILE}
+
+# on the next port, as the last server's listening socket may take a
+# moment to be released once it has exited (with --uring, say)
+echo "restarting server"
+PORT=$((PORT + 1))
+start_server
+check_log_size $((LEN_ONE + LEN_TWO))
+
+echo "joining with a replay"
+exec 3<>/dev/tcp/localhost/${PORT}
+echo "rlogin:${RECV_USER}" >&3
+echo "join:${ROOM};history=10" >&3
+receive_lines 4
+
+echo "logging a new message"
+${REF_SENDER} localhost ${PORT} ${USER1} < temp/2.in > /dev/null
+receive_lines 1
+sleep 0.5
+check_log_size $((LEN_ONE + LEN_TWO + LEN_FOUR))
+
+# check that server is still up
+kill -0 ${SERVER_PID}
+if [[ $? -ne 0 ]]; then
+    echo "Server died when it was not supposed to!"
+    exit 1
+fi
+
+if ! diff temp/out.exp "${OUT_STEM}.out"; then
+    error_cleanup "Receiver output differs from the expected one"
+fi
+
+echo "cleaning up"
+cleanup
+trap - ERR
+
+exit 0
@@ -0,0 +1,498 @@
+/*
+ * Implementation of class describing an io_uring instance, set up with raw system calls.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include "uring.h"
+
+namespace {
+
+// the only group of provided buffers a Uring registers
+const uint16_t BUF_GROUP = 0;
+
+int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// The kernel reads the submission queue tail and the provided buffer
+// ring tail, and writes the completion queue tail, concurrently with
+// the owning thread, so those are accessed with acquire/release order.
+unsigned load_acquire(const unsigned *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void store_release(T *p, T value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/*
+ * Sets up a small Uring to see whether this kernel can run them.
+ *
+ * Returns:
+ *   true if a Uring with provided buffers could be set up
+ */
+bool check_support() {
+  Uring ring;
+  return ring.init(8) && ring.init_buffers(8, 4096);
+}
+
+}
+
+/*
+ * Default constructor for Uring object.
+ *
+ * Returns:
+ *   a Uring that has not been set up yet
+ */
+Uring::Uring()
+  : m_fd(-1)
+  , m_disabled(false)
+  , m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_sq_head(nullptr), m_sq_tail(nullptr)
+  , m_sq_mask(0), m_sq_entries(0), m_sqes(nullptr), m_sqes_size(0), m_sqe_tail(0)
+  , m_cq_ring(MAP_FAILED), m_cq_ring_size(0), m_cq_head(nullptr), m_cq_tail(nullptr)
+  , m_cq_mask(0), m_cqes(nullptr)
+  , m_buf_ring(nullptr), m_buf_ring_size(0), m_buffers(nullptr), m_buf_size(0)
+  , m_buf_count(0), m_buf_tail(0) {
+}
+
+/*
+ * Destructor for a Uring object.
+ * Closes the ring, which cancels whatever is still in flight, and
+ * unmaps its memory.
+ */
+Uring::~Uring() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+  if (m_buf_ring != nullptr) {
+    munmap(m_buf_ring, m_buf_ring_size);
+  }
+  delete[] m_buffers;
+  if (m_sqes != nullptr) {
+    munmap(m_sqes, m_sqes_size);
+  }
+  if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+    munmap(m_cq_ring, m_cq_ring_size);
+  }
+  if (m_sq_ring != MAP_FAILED) {
+    munmap(m_sq_ring, m_sq_ring_size);
+  }
+}
+
+/*
+ * Function to set up the submission and completion queues.
+ *
+ * Parameters:
+ *   entries - number of submission queue entries (a power of 2)
+ *
+ * Returns:
+ *   true if the kernel set up the ring and supports every operation used
+ */
+bool Uring::init(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // Only one thread submits, and completions are only needed when it
+  // waits for them, so the kernel can leave finishing operations until
+  // then rather than interrupting the thread. The thread is the one
+  // that enables the ring.
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN
+    | IORING_SETUP_R_DISABLED;
+  m_fd = io_uring_setup(entries, &params);
+  if (m_fd < 0 && errno == EINVAL) {
+    // before Linux 6.1
+    memset(&params, 0, sizeof(params));
+    m_fd = io_uring_setup(entries, &params);
+  }
+  if (m_fd < 0) {
+    return false; // ENOSYS without io_uring, EPERM if it is disabled
+  }
+  m_disabled = (params.flags & IORING_SETUP_R_DISABLED) != 0;
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    // both queues live in one mapping
+    if (m_cq_ring_size > m_sq_ring_size) {
+      m_sq_ring_size = m_cq_ring_size;
+    }
+    m_cq_ring_size = m_sq_ring_size;
+  }
+  m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (m_sq_ring == MAP_FAILED) {
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cq_ring = m_sq_ring;
+  } else {
+    m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (m_cq_ring == MAP_FAILED) {
+      return false;
+    }
+  }
+  m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  m_sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(m_sq_ring);
+  m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  m_sq_entries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+  m_sqe_tail = *m_sq_tail;
+  // entries are always submitted in order, so slot i always holds entry i
+  unsigned *array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  for (unsigned i = 0; i < m_sq_entries; i++) {
+    array[i] = i;
+  }
+
+  char *cq = static_cast<char *>(m_cq_ring);
+  m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  return probe();
+}
+
+/*
+ * Function to make the calling thread the one that submits to this
+ * Uring. Does nothing if the kernel could not restrict submitters.
+ *
+ * Returns:
+ *   true if the ring is enabled
+ */
+bool Uring::enable() {
+  if (!m_disabled) {
+    return true;
+  }
+  if (io_uring_register(m_fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+    return false;
+  }
+  m_disabled = false;
+  return true;
+}
+
+/*
+ * Function to register the buffers receives pick from.
+ *
+ * Parameters:
+ *   count - number of buffers (a power of 2, at most 32768)
+ *   size - size of each buffer in bytes
+ *
+ * Returns:
+ *   true if the kernel accepted the buffer ring
+ */
+bool Uring::init_buffers(unsigned count, size_t size) {
+  m_buf_ring_size = count * sizeof(struct io_uring_buf);
+  void *ring = mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  m_buf_ring = static_cast<struct io_uring_buf_ring *>(ring);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = count;
+  reg.bgid = BUF_GROUP;
+  if (io_uring_register(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return false; // before Linux 5.19
+  }
+
+  m_buffers = new char[count * size];
+  m_buf_size = size;
+  m_buf_count = count;
+  for (unsigned i = 0; i < count; i++) {
+    add_buffer(static_cast<uint16_t>(i));
+  }
+  store_release(&m_buf_ring->tail, m_buf_tail);
+  return true;
+}
+
+/*
+ * Function to check whether this kernel can run a Uring. The answer
+ * is worked out once, the first time this is called.
+ *
+ * Returns:
+ *   true if io_uring with provided buffers is available
+ */
+bool Uring::is_supported() {
+  static const bool supported = check_support();
+  return supported;
+}
+
+/*
+ * Function to make room for queueing several operations in a row.
+ *
+ * Parameters:
+ *   n - number of operations about to be queued
+ *
+ * Returns:
+ *   true if that many entries are free
+ */
+bool Uring::reserve(unsigned n) {
+  if (m_sqe_tail - load_acquire(m_sq_head) + n > m_sq_entries) {
+    submit(0);
+  }
+  return m_sqe_tail - load_acquire(m_sq_head) + n <= m_sq_entries;
+}
+
+/*
+ * Function to queue accepting a connection.
+ *
+ * Parameters:
+ *   fd - the listening socket
+ *   flags - flags for the accepted socket (as for accept4)
+ *   data - value handed back with the completion
+ *
+ * Returns:
+ *   true if the operation was queued
+ */
+bool Uring::accept(int fd, int flags, uint64_t data) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->accept_flags = flags;
+  sqe->user_data = data;
+  return true;
+}
+
+/*
+ * Function to queue a read into a buffer.
+ *
+ * Parameters:
+ *   fd - the file to read from
+ *   buf - pointer to the buffer, which must stay valid until completion
+ *   len - size of the buffer
+ *   data - value handed back with the completion
+ *
+ * Returns:
+ *   true if the operation was queued
+ */
+bool Uring::read(int fd, void *buf, size_t len, uint64_t data) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  sqe->user_data = data;
+  return true;
+}
+
+/*
+ * Function to queue a receive into whichever provided buffer is free
+ * once data arrives.
+ *
+ * Parameters:
+ *   fd - the socket to receive from
+ *   data - value handed back with the completion
+ *
+ * Returns:
+ *   true if the operation was queued
+ */
+bool Uring::recv(int fd, uint64_t data) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->len = static_cast<uint32_t>(m_buf_size);
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = data;
+  return true;
+}
+
+/*
+ * Function to queue a sendmsg.
+ *
+ * Parameters:
+ *   fd - the socket to send to
+ *   msg - pointer to the msghdr, which (with everything it points to)
+ *         must stay valid until completion
+ *   send_flags - the sendmsg flags
+ *   link - true to start the next queued operation only once this one
+ *          has completed, and cancel it if this one fails
+ *   data - value handed back with the completion
+ *
+ * Returns:
+ *   true if the operation was queued
+ */
+bool Uring::sendmsg(int fd, const struct msghdr *msg, int send_flags, bool link, uint64_t data) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = send_flags;
+  sqe->flags = link ? IOSQE_IO_LINK : 0;
+  sqe->user_data = data;
+  return true;
+}
+
+/*
+ * Function to submit every queued operation, optionally waiting
+ * for completions.
+ *
+ * Parameters:
+ *   wait_nr - number of completions to wait for
+ *
+ * Returns:
+ *   the number of operations submitted, or -errno
+ */
+int Uring::submit(unsigned wait_nr) {
+  // entries the kernel has not consumed yet, including any left over
+  // from an earlier call that could not submit everything
+  unsigned to_submit = m_sqe_tail - load_acquire(m_sq_head);
+  store_release(m_sq_tail, m_sqe_tail);
+  if (to_submit == 0 && wait_nr == 0) {
+    return 0;
+  }
+  int ret = io_uring_enter(m_fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+  return ret < 0 ? -errno : ret;
+}
+
+/*
+ * Function to look at the oldest unseen completion.
+ *
+ * Returns:
+ *   pointer to the completion, or nullptr if there is none
+ */
+struct io_uring_cqe *Uring::peek_cqe() {
+  unsigned head = *m_cq_head;
+  if (head == load_acquire(m_cq_tail)) {
+    return nullptr;
+  }
+  return &m_cqes[head & m_cq_mask];
+}
+
+/*
+ * Function to hand the slot of the completion returned by peek_cqe
+ * back to the kernel.
+ */
+void Uring::cqe_seen() {
+  store_release(m_cq_head, *m_cq_head + 1);
+}
+
+/*
+ * Function to find the provided buffer a receive completed into.
+ *
+ * Parameters:
+ *   cqe_flags - the flags of the receive's completion
+ *
+ * Returns:
+ *   pointer to the start of the buffer
+ */
+char *Uring::get_buffer(uint32_t cqe_flags) {
+  uint16_t bid = static_cast<uint16_t>(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+  return m_buffers + bid * m_buf_size;
+}
+
+/*
+ * Function to make the buffer a receive completed into available to
+ * other receives again.
+ *
+ * Parameters:
+ *   cqe_flags - the flags of the receive's completion
+ */
+void Uring::recycle_buffer(uint32_t cqe_flags) {
+  if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+    return;
+  }
+  add_buffer(static_cast<uint16_t>(cqe_flags >> IORING_CQE_BUFFER_SHIFT));
+  store_release(&m_buf_ring->tail, m_buf_tail);
+}
+
+/*
+ * Function to take a cleared submission queue entry, submitting what
+ * is queued first if every entry is in use.
+ *
+ * Returns:
+ *   pointer to the entry, or nullptr if none could be had
+ */
+struct io_uring_sqe *Uring::get_sqe() {
+  if (!reserve(1)) {
+    return nullptr;
+  }
+  struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  m_sqe_tail++;
+  return sqe;
+}
+
+/*
+ * Function to ask the kernel whether it supports every operation used.
+ *
+ * Returns:
+ *   true if it does
+ */
+bool Uring::probe() {
+  const int NUM_OPS = 256;
+  std::vector<char> buf(sizeof(struct io_uring_probe) + NUM_OPS * sizeof(struct io_uring_probe_op));
+  struct io_uring_probe *p = reinterpret_cast<struct io_uring_probe *>(buf.data());
+  if (io_uring_register(m_fd, IORING_REGISTER_PROBE, p, NUM_OPS) < 0) {
+    return false; // before Linux 5.6
+  }
+  const int used[] = { IORING_OP_ACCEPT, IORING_OP_READ, IORING_OP_RECV, IORING_OP_SENDMSG };
+  for (size_t i = 0; i < sizeof(used) / sizeof(used[0]); i++) {
+    if (used[i] > p->last_op || !(p->ops[used[i]].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Function to put a buffer on the provided buffer ring. The kernel
+ * sees it once the ring's tail is published.
+ *
+ * Parameters:
+ *   bid - index of the buffer
+ */
+void Uring::add_buffer(uint16_t bid) {
+  // not m_buf_ring->bufs: compiled as C++, the header's flexible array
+  // wrapper puts it 8 bytes past the start of the ring
+  struct io_uring_buf *bufs = reinterpret_cast<struct io_uring_buf *>(m_buf_ring);
+  struct io_uring_buf *buf = &bufs[m_buf_tail & (m_buf_count - 1)];
+  buf->addr = reinterpret_cast<uint64_t>(m_buffers + bid * m_buf_size);
+  buf->len = static_cast<uint32_t>(m_buf_size);
+  buf->bid = bid;
+  m_buf_tail++;
+}
@@ -0,0 +1,118 @@
+/*
+ * Class describing an io_uring instance, set up with raw system calls.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+struct msghdr;
+
+// A Uring is one io_uring: a submission queue the owning thread fills
+// with operations and a completion queue the kernel fills with their
+// results, both shared with the kernel so that a single io_uring_enter
+// call can submit a whole batch of operations and wait for results.
+// Receives can pick a buffer from a ring of provided buffers registered
+// with the kernel, so no buffer has to be set aside for a socket until
+// data arrives on it. A Uring may be set up by any thread, but must then
+// be enabled by the one thread that uses it.
+class Uring {
+public:
+  Uring();
+  ~Uring();
+
+  // Set up the rings with room for the given number of submissions
+  // (a power of 2). Returns false if the kernel lacks io_uring or one
+  // of the operations below.
+  bool init(unsigned entries);
+
+  // Make the calling thread the only one submitting to this Uring,
+  // before it submits anything. Returns false on failure.
+  bool enable();
+
+  // Register count buffers (a power of 2) of size bytes each for
+  // receives to pick from. Returns false if the kernel can't.
+  bool init_buffers(unsigned count, size_t size);
+
+  // Whether this kernel can run a Uring with provided buffers;
+  // checked once by setting up a small one.
+  static bool is_supported();
+
+  // Make room to queue n operations in a row, submitting what is
+  // queued already if needed, so that none of the n is submitted before
+  // the rest (a linked chain must be submitted whole). Returns false if
+  // there isn't room even then.
+  bool reserve(unsigned n);
+
+  // Queue operations; data is handed back with each completion.
+  // Each returns false if no submission entry could be had.
+  bool accept(int fd, int flags, uint64_t data);
+  bool read(int fd, void *buf, size_t len, uint64_t data);
+  // receive into one of the provided buffers
+  bool recv(int fd, uint64_t data);
+  // send_flags are the sendmsg flags; link makes the next queued
+  // operation start only once this one has fully completed
+  bool sendmsg(int fd, const struct msghdr *msg, int send_flags, bool link, uint64_t data);
+
+  // Submit everything queued and wait for at least wait_nr completions.
+  // Returns the number submitted, or -errno.
+  int submit(unsigned wait_nr);
+
+  // The oldest completion not yet seen, or nullptr if there is none;
+  // cqe_seen hands its slot back to the kernel.
+  struct io_uring_cqe *peek_cqe();
+  void cqe_seen();
+
+  // The provided buffer a receive completed into (given the completion's
+  // flags), and handing it back for another receive to use.
+  char *get_buffer(uint32_t cqe_flags);
+  void recycle_buffer(uint32_t cqe_flags);
+
+private:
+  // prohibit value semantics
+  Uring(const Uring &);
+  Uring &operator=(const Uring &);
+
+  struct io_uring_sqe *get_sqe();
+  bool probe();
+  void add_buffer(uint16_t bid);
+
+  int m_fd;
+  bool m_disabled; // set up disabled, until enable is called
+
+  // submission queue, shared with the kernel
+  void *m_sq_ring;
+  size_t m_sq_ring_size;
+  unsigned *m_sq_head;
+  unsigned *m_sq_tail;
+  unsigned m_sq_mask;
+  unsigned m_sq_entries;
+  struct io_uring_sqe *m_sqes;
+  size_t m_sqes_size;
+  unsigned m_sqe_tail; // entries handed out, including those not yet submitted
+
+  // completion queue, shared with the kernel (maybe in the same mapping)
+  void *m_cq_ring;
+  size_t m_cq_ring_size;
+  unsigned *m_cq_head;
+  unsigned *m_cq_tail;
+  unsigned m_cq_mask;
+  struct io_uring_cqe *m_cqes;
+
+  // provided buffers and the ring handing them to the kernel
+  struct io_uring_buf_ring *m_buf_ring;
+  size_t m_buf_ring_size;
+  char *m_buffers;
+  size_t m_buf_size;
+  unsigned m_buf_count;
+  uint16_t m_buf_tail;
+};
+
+#endif // URING_H
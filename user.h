@@ -10,17 +10,64 @@
 #ifndef USER_H
 #define USER_H
 
+#include <atomic>
 #include <string>
+#include "framing.h"
 #include "message_queue.h"
 
+// A User is reference counted: its Session holds one reference, and a
+// room it is removed from holds another until no broadcast can still be
+// delivering to it (see Room::remove_member), so it may outlive its
+// Session.
 struct User {
+  // Function called once the user has been freed
+  typedef void (*ReleasedFn)(void *arg);
+
   std::string username;
-  std::string room;
+
+  // framing the user's client asked for at login
+  Framing framing;
 
   // queue of pending messages awaiting delivery
   MessageQueue mqueue;
 
-  User(const std::string &username) : username(username) { }
+  // A user with a reference count of one owned by the caller
+  User(const std::string &username)
+    : username(username), framing(FRAMING_TEXT), refs(1), released(nullptr), released_arg(nullptr) { }
+
+  // Take another reference to this user.
+  void ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drop a reference, freeing the user when the last one is dropped
+  // (on whichever thread drops it), then calling the released function.
+  void unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      ReleasedFn fn = released;
+      void *arg = released_arg;
+      delete this;
+      if (fn != nullptr) {
+        fn(arg);
+      }
+    }
+  }
+
+  // Have fn(arg) called once the user has been freed. Must be called
+  // before the user is added to a room.
+  void set_released(ReleasedFn fn, void *arg) {
+    released = fn;
+    released_arg = arg;
+  }
+
+private:
+  // only freed through unref
+  ~User() { }
+  // prohibit value semantics
+  User(const User &);
+  User &operator=(const User &);
+
+  std::atomic<int> refs;
+  ReleasedFn released;
+  void *released_arg;
 };
 
 #endif // USER_H
@@ -0,0 +1,185 @@
+/*
+ * Implementation of class describing a fixed pool of threads serving client connections.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <string>
+#include <iostream>
+#include "guard.h"
+#include "message.h"
+#include "metrics.h"
+#include "worker_pool.h"
+
+/*
+ * Non-Default constructor for WorkerPool object.
+ *
+ * Parameters:
+ *   server - pointer to the Server the clients are connected to
+ *   num_threads - number of worker threads to run
+ *   serve - function the workers call to serve each client
+ *
+ * Returns:
+ *   a new WorkerPool whose threads have not been started yet
+ */
+WorkerPool::WorkerPool(Server *server, int num_threads, ServeFn serve)
+  : m_server(server)
+  , m_num_threads(num_threads)
+  , m_serve(serve)
+  , m_stopping(false) {
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_ready, NULL);
+}
+
+/*
+ * Destructor for a WorkerPool object. Closes the sockets still
+ * waiting for a worker, then waits for every worker to finish the
+ * client it is serving and exit.
+ */
+WorkerPool::~WorkerPool() {
+  {
+    Guard guard(m_lock);
+    m_stopping = true;
+    for (size_t i = 0; i < m_pending.size(); i++) {
+      close(m_pending[i].fd);
+    }
+    m_pending.clear();
+    pthread_cond_broadcast(&m_ready);
+  }
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    pthread_join(m_threads[i], NULL);
+  }
+  pthread_cond_destroy(&m_ready);
+  pthread_mutex_destroy(&m_lock);
+}
+
+/*
+ * Starts every worker thread.
+ *
+ * Returns:
+ *   true if all workers started
+ */
+bool WorkerPool::start() {
+  for (int i = 0; i < m_num_threads; i++) {
+    pthread_t thr_id;
+    if (pthread_create(&thr_id, NULL, run_thread, this) != 0) {
+      return false;
+    }
+    m_threads.push_back(thr_id);
+  }
+  return true;
+}
+
+/*
+ * Accepts client connections forever, queueing each for a worker,
+ * or refusing it if too many are waiting already. Meanwhile, clients
+ * that have waited too long are refused too.
+ *
+ * Parameters:
+ *   listen_fd - the server's listening socket
+ */
+void WorkerPool::accept_loop(int listen_fd) {
+  while (1) {
+    int timeout;
+    {
+      Guard guard(m_lock);
+      timeout = m_pending.empty() ? -1 : MAX_CLIENT_WAIT_MS / 10;
+    }
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout);
+    expire_waiting();
+    if (ready <= 0) {
+      continue;
+    }
+
+    int clientfd = accept(listen_fd, NULL, NULL);
+    if (clientfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "Error accepting client connection" << std::endl;
+      return;
+    }
+
+    Guard guard(m_lock);
+    if (m_pending.size() >= MAX_WAITING_CLIENTS) {
+      refuse(clientfd);
+      continue;
+    }
+    Waiting waiting = { clientfd, metrics_now_ns() };
+    m_pending.push_back(waiting);
+    pthread_cond_signal(&m_ready);
+  }
+}
+
+/*
+ * Helper function to refuse every client that has waited
+ * MAX_CLIENT_WAIT_MS for a worker.
+ */
+void WorkerPool::expire_waiting() {
+  uint64_t cutoff = metrics_now_ns() - static_cast<uint64_t>(MAX_CLIENT_WAIT_MS) * 1000000;
+  Guard guard(m_lock);
+  while (!m_pending.empty() && m_pending.front().since_ns <= cutoff) {
+    refuse(m_pending.front().fd);
+    m_pending.pop_front();
+  }
+}
+
+/*
+ * Helper function to tell a client no worker is free and close its
+ * socket. The client has not logged in yet, so the reply is a text
+ * line, and whatever it has sent is read first so that closing does
+ * not reset the connection before the reply gets there.
+ *
+ * Parameters:
+ *   clientfd - the client's socket
+ */
+void WorkerPool::refuse(int clientfd) {
+  std::string reply = Message(TAG_ERR, "no worker free, try again later").strMessage() + "\n";
+  send(clientfd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+  shutdown(clientfd, SHUT_WR);
+  char buf[256];
+  while (recv(clientfd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+  }
+  close(clientfd);
+}
+
+/*
+ * Thread entry point for a worker.
+ *
+ * Parameters:
+ *   arg - pointer to the WorkerPool
+ */
+void *WorkerPool::run_thread(void *arg) {
+  static_cast<WorkerPool *>(arg)->run();
+  return nullptr;
+}
+
+/*
+ * Worker loop: serves queued clients one after another until the
+ * pool is stopped.
+ */
+void WorkerPool::run() {
+  while (1) {
+    int clientfd;
+    {
+      Guard guard(m_lock);
+      while (m_pending.empty() && !m_stopping) {
+        pthread_cond_wait(&m_ready, &m_lock);
+      }
+      if (m_stopping) {
+        return;
+      }
+      clientfd = m_pending.front().fd;
+      m_pending.pop_front();
+    }
+    m_serve(m_server, clientfd);
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * Class describing a fixed pool of threads serving client connections.
+ * CSF Assignment 5
+ * Caroline Zhao
+ * czhao67@jhu.edu
+ * Miranda Qing
+ * mqing2@jhu.edu
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+class Server;
+
+// Most clients that may wait for a free worker, and the longest one
+// may wait, before it is sent an error and disconnected
+const size_t MAX_WAITING_CLIENTS = 64;
+const int MAX_CLIENT_WAIT_MS = 2000;
+
+// A WorkerPool runs a fixed number of threads created up front. The
+// accept loop hands accepted sockets over through a queue, and each
+// worker serves one client at a time from start to finish, exactly
+// like a thread-per-connection thread would. At most num_threads
+// clients are served at once; later ones wait in the queue until a
+// worker is free. As receivers keep their worker for as long as they
+// stay connected, the wait is bounded: a client that finds
+// MAX_WAITING_CLIENTS already waiting, or waits MAX_CLIENT_WAIT_MS
+// without a worker freeing up, is sent an error and disconnected
+// rather than left without a reply. A pool of num_threads workers
+// therefore serves at most num_threads receivers at once, which suits
+// only loads made mostly of senders.
+class WorkerPool {
+public:
+  // Function run by a worker to serve the client on a socket; it
+  // owns (and must close) the socket.
+  typedef void (*ServeFn)(Server *server, int clientfd);
+
+  WorkerPool(Server *server, int num_threads, ServeFn serve);
+  ~WorkerPool();
+
+  // Start the worker threads. Returns false if they could not
+  // be created.
+  bool start();
+
+  // Accept connections on the listening socket forever, queueing
+  // each for the workers. Returns only if accept fails.
+  void accept_loop(int listen_fd);
+
+private:
+  // prohibit value semantics
+  WorkerPool(const WorkerPool &);
+  WorkerPool &operator=(const WorkerPool &);
+
+  // a socket waiting for a worker, and when it was accepted
+  struct Waiting {
+    int fd;
+    uint64_t since_ns;
+  };
+
+  static void *run_thread(void *arg);
+  void run();
+  void expire_waiting();
+  static void refuse(int clientfd);
+
+  Server *m_server;
+  int m_num_threads;
+  ServeFn m_serve;
+  std::vector<pthread_t> m_threads;
+
+  pthread_mutex_t m_lock; // protects everything below
+  pthread_cond_t m_ready; // signaled when a socket is queued or on shutdown
+  std::deque<Waiting> m_pending;
+  bool m_stopping;
+};
+
+#endif // WORKER_POOL_H